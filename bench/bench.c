@@ -0,0 +1,1461 @@
+/*
+ * Microbenchmarks for the hot paths of thinkd, run against a fake sysfs
+ * tree generated by mkfakesys.sh:
+ *
+ *	thinkd-bench [-n iterations] [-v] ROOT
+ *
+ * Wall time and heap allocations are measured in this process. Syscalls
+ * are counted in a second pass where a forked child runs the same
+ * operations under ptrace, so tracing overhead never pollutes the timings.
+ *
+ * Finally an hour on battery is simulated through the real event loop and
+ * the daemon's self-cost is checked against the limits of the [daemon]
+ * section, and the probe, apply and log paths are run again to check
+ * that they no longer touch the heap. Peripheral batteries must be left
+ * out of the supplies, and batteries reporting energy and charge must
+ * not be added up. A stand-in service manager must be told about
+ * readiness and shutdown, and the control socket must be created 0600
+ * under the daemon's umask(0) and answer a status request. A stand-in pressure trigger must
+ * boost into performance and let go two windows after its last event.
+ * A fork/exec storm is then run
+ * against the process connector
+ * to measure what every exec costs the daemon, and a flapping charger is
+ * played on a virtual clock with and without the transition debounce,
+ * each flap told through a power supply uevent as the kernel sends it.
+ * The exit status is non-zero when a limit is exceeded, the steady state
+ * allocates, the storm leaves
+ * processes counted or the debounce doesn't save any knob writes.
+ *
+ * Then four weeks of battery history are written into a small ring and
+ * the last day is read back, checking that the file stays bounded and is
+ * written a few times an hour at most. Last, the top-wakers sampler is run
+ * against the fake /proc, which must neither allocate nor exceed its cpu
+ * budget, and a set of mode rules is compiled and checked for precedence
+ * and evaluation speed. Last, every GPU and cgroup knob file of the fake
+ * tree must hold what the profile just loaded sets, a negative frequency
+ * must be refused, weights must be clamped and a mode without cgroup
+ * keys must restore the defaults.
+ */
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+#include "void.h"
+#include "acpi.h"
+#include "conf_utils.h"
+#include "mode.h"
+#include "logger.h"
+#include "stats.h"
+#include "selfcost.h"
+#include "events.h"
+#include "thinkd.h"
+#include "state.h"
+#include "metrics.h"
+#include "psupply.h"
+#include "apps.h"
+#include "history.h"
+#include "wakers.h"
+#include "rules.h"
+#include "psi.h"
+#include "ctl.h"
+#include "notify.h"
+#include "uevent.h"
+
+#define DEFAULT_ITERATIONS 2000
+#define TRACED_ITERATIONS 50
+/* an odd number of flaps, so the storm ends on battery */
+#define FLAP_COUNT 41
+#define STEADY_STATE_ROUNDS 100
+#define FLAP_INTERVAL_MS 150
+#define STORM_EXECS 2000
+#define HISTORY_DAYS 28
+#define HISTORY_BENCH_KB 64
+#define WAKERS_SAMPLES 200
+#define RULES_EVALUATIONS 1000000
+#define PSI_BENCH_WINDOW 100
+#define KNOB_FILE_CASES 16	/* per mode */
+
+typedef struct __bench {
+	const char *name;
+	void (*setup)();
+	void (*run)();
+} bench_t;
+
+/* inputs, and the rule that must win for them */
+typedef struct __rules_case {
+	int inputs[RULE_INPUTS];
+	const char *winner;
+} rules_case_t;
+
+/* a knob file under the fake root, and its value once `mode` is loaded */
+typedef struct __knob_file_case {
+	const power_prefs_t *mode;
+	const char *path;
+	const char *value;
+} knob_file_case_t;
+
+typedef struct __bench_result {
+	double ns_per_op;
+	double allocs_per_op;
+	double syscalls_per_op;
+} bench_result_t;
+
+/* glibc entry points behind the interposed allocator below */
+extern void *__libc_malloc(size_t nbytes);
+extern void *__libc_calloc(size_t nelems, size_t nbytes);
+extern void *__libc_realloc(void *ptr, size_t nbytes);
+extern void __libc_free(void *ptr);
+
+static unsigned long alloc_count;
+static acpi_psupply_t bench_supplies;
+static unsigned int sim_probes_left;
+static unsigned int flaps_left;
+static bool flap_online;
+static volatile unsigned long syscall_count;
+static char config_path[MAX_SYSFS_PATH_LEN];
+static char state_path[MAX_SYSFS_PATH_LEN];
+
+static void bench_detect_setup();
+static void bench_detect();
+static void bench_scan();
+static void bench_batteries_setup();
+static void bench_batteries_uevent();
+static void bench_batteries_attrs();
+static void bench_load_mode();
+static void bench_switch_mode();
+static void bench_read_ini();
+static void bench_stats_record();
+static void bench_restart_cold();
+static void bench_restart_warm();
+static void bench_metrics_setup();
+static void bench_metrics_update();
+static void bench_metrics_scrape();
+static void bench_apps_match_setup();
+static void bench_apps_miss_setup();
+static void bench_apps_exec();
+static void bench_wakers_setup();
+static void bench_wakers_sample();
+static void storm_tick(void *data);
+static void set_ac_online(bool online);
+static void run_timed(const bench_t *b, unsigned long iterations,
+		      bench_result_t *result);
+static bool run_traced(const bench_t *benches, size_t count,
+		       bench_result_t *results);
+static int simulate_hour();
+static int simulate_steady_state();
+static int check_supplies();
+static int check_control();
+static int simulate_psi();
+static int simulate_exec_storm();
+static int simulate_flap_storm();
+static int simulate_history();
+static int simulate_wakers();
+static int check_wakers_slots();
+static int simulate_rules();
+static int check_knob_files();
+static const char *fake_read(const char *path, char *value, size_t len);
+static void fake_write(const char *path, const char *value);
+
+static const bench_t benches[] = {
+	{"detect_psupply_mode", bench_detect_setup, bench_detect},
+	{"scan_power_supply", NULL, bench_scan},
+	{"batteries (uevent)", bench_batteries_setup, bench_batteries_uevent},
+	{"batteries (attributes)", bench_batteries_setup, bench_batteries_attrs},
+	{"load_power_mode", NULL, bench_load_mode},
+	{"switch_mode", NULL, bench_switch_mode},
+	{"read_ini", NULL, bench_read_ini},
+	{"stats_record", NULL, bench_stats_record},
+	{"restart (no snapshot)", NULL, bench_restart_cold},
+	{"restart (snapshot)", bench_detect_setup, bench_restart_warm},
+	{"metrics_update", bench_metrics_setup, bench_metrics_update},
+	{"metrics_scrape", bench_metrics_setup, bench_metrics_scrape},
+	{"exec+exit (match)", bench_apps_match_setup, bench_apps_exec},
+	{"exec+exit (miss)", bench_apps_miss_setup, bench_apps_exec},
+	{"wakers_sample", bench_wakers_setup, bench_wakers_sample},
+};
+
+/* count every allocation, including the ones made inside libc */
+void *malloc(size_t nbytes)
+{
+	++alloc_count;
+	return __libc_malloc(nbytes);
+}
+
+void *calloc(size_t nelems, size_t nbytes)
+{
+	++alloc_count;
+	return __libc_calloc(nelems, nbytes);
+}
+
+void *realloc(void *ptr, size_t nbytes)
+{
+	++alloc_count;
+	return __libc_realloc(ptr, nbytes);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+int main(int argc, char *argv[])
+{
+	bench_result_t *results;
+	unsigned long iterations = DEFAULT_ITERATIONS;
+	bool verbose = false, traced;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:v")) != -1) {
+		switch (c) {
+		case 'n':
+			iterations = strtoul(optarg, NULL, 10);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n iterations] [-v] ROOT\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc || ! iterations) {
+		fprintf(stderr, "usage: %s [-n iterations] [-v] ROOT\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	sysroot = argv[optind];
+	snprintf(config_path, sizeof(config_path), "%s/etc/thinkd.ini", sysroot);
+	config_file = config_path;
+	snprintf(state_path, sizeof(state_path), "%s/run/thinkd.state", sysroot);
+	state_file = state_path;
+
+	/* the log isn't opened, keep its stderr fallback out of the way */
+	if (! verbose && ! freopen("/dev/null", "w", stderr))
+		return EXIT_FAILURE;
+
+	if (mode_init() || read_ini() < 0) {
+		printf("cannot read %s\n", config_file);
+		return EXIT_FAILURE;
+	}
+
+	/* shared so the traced child can hand back its counts */
+	results = mmap(NULL, sizeof(bench_result_t) * array_count(benches),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (results == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < array_count(benches); ++i)
+		run_timed(&benches[i], iterations, &results[i]);
+
+	traced = run_traced(benches, array_count(benches), results);
+
+	printf("%-22s %12s %10s %12s\n", "operation", "ns/op", "allocs/op", "syscalls/op");
+	for (size_t i = 0; i < array_count(benches); ++i) {
+		printf("%-22s %12.0f %10.1f ", benches[i].name,
+		       results[i].ns_per_op, results[i].allocs_per_op);
+		if (traced)
+			printf("%12.1f\n", results[i].syscalls_per_op);
+		else
+			printf("%12s\n", "n/a");
+	}
+
+	if (simulate_hour() || simulate_steady_state() || check_supplies() ||
+	    check_control() || simulate_psi() ||
+	    simulate_exec_storm() ||
+	    simulate_flap_storm() || simulate_history() || simulate_wakers() ||
+	    check_wakers_slots() ||
+	    simulate_rules() || check_knob_files()) {
+		mode_cleanup();
+		return EXIT_FAILURE;
+	}
+
+	mode_cleanup();
+	return EXIT_SUCCESS;
+}
+
+static void bench_detect_setup()
+{
+	/* measured without the exporter, which a traced child inherits */
+	metrics_close();
+
+	/* apply once, after that every probe is a steady state probe */
+	current_mode = NULL;
+	detect_psupply_mode();
+}
+
+static void bench_detect()
+{
+	detect_psupply_mode();
+}
+
+static void bench_scan()
+{
+	static acpi_psupply_t power_supply;
+
+	scan_power_supply(&power_supply);
+}
+
+static void bench_batteries_setup()
+{
+	scan_power_supply(&bench_supplies);
+}
+
+/* one pread() of the uevent file per battery */
+static void bench_batteries_uevent()
+{
+	psupply_read(&bench_supplies, PSUPPLY_READ_BATTERIES);
+}
+
+/* an open, read and close per attribute, as before */
+static void bench_batteries_attrs()
+{
+	psupply_read(&bench_supplies, PSUPPLY_READ_BATTERIES | PSUPPLY_READ_ATTRIBUTES);
+}
+
+/* every knob, as on startup or after a reload */
+static void bench_load_mode()
+{
+	knobs_forget();
+	load_power_mode(&mode_powersave);
+}
+
+/* a switch only writes the knobs the two profiles disagree on */
+static void bench_switch_mode()
+{
+	static bool performance;
+
+	performance = ! performance;
+	load_power_mode(performance ? &mode_performance : &mode_powersave);
+}
+
+static void bench_read_ini()
+{
+	read_ini();
+}
+
+static void bench_stats_record()
+{
+	/* the cost every instrumented operation pays for its histogram */
+	STATS_START(start);
+	STATS_END(STAT_PROBE, start);
+}
+
+/* what a restart does before it is ready: read the config, probe, apply */
+static void bench_restart_cold()
+{
+	unlink(state_file);
+	current_mode = NULL;
+	reload_config();
+	detect_psupply_mode();
+}
+
+static void bench_restart_warm()
+{
+	current_mode = NULL;
+	reload_config();
+	detect_psupply_mode();
+}
+
+static void bench_metrics_setup()
+{
+	struct sockaddr_un addr;
+	char root[MAX_SYSFS_PATH_LEN];
+	int len;
+
+	/* a unix socket is told apart from host:port by the leading slash */
+	if (! realpath(sysroot, root)) {
+		perror(sysroot);
+		exit(EXIT_FAILURE);
+	}
+	len = snprintf(daemon_prefs.metrics_listen, sizeof(addr.sun_path),
+		       "%s/run/metrics.sock", root);
+	if (len < 0 || (size_t) len >= sizeof(addr.sun_path)) {
+		printf("%s/run/metrics.sock is too long for a unix socket\n", root);
+		exit(EXIT_FAILURE);
+	}
+	metrics_configure();
+}
+
+static void bench_metrics_update()
+{
+	metrics_update();
+}
+
+/* both ends of a scrape: the client here, the daemon in event_dispatch() */
+static void bench_metrics_scrape()
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	const char request[] = "GET /metrics HTTP/1.0\r\n\r\n";
+	char buffer[METRICS_MAX_SNAPSHOT];
+	int fd;
+
+	memcpy(addr.sun_path, daemon_prefs.metrics_listen, sizeof(addr.sun_path));
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+	    write(fd, request, sizeof(request) - 1) < 0) {
+		close(fd);
+		return;
+	}
+
+	/* accept, then read the request and write the response */
+	event_dispatch();
+	event_dispatch();
+	while (read(fd, buffer, sizeof(buffer)) > 0)
+		;
+	close(fd);
+}
+
+/* the handlers alone, without the netlink socket or a boost callback */
+static void bench_apps_match_setup()
+{
+	snprintf(daemon_prefs.app_boost, MAX_CONF_LIST_LEN, "cc1,cc1plus,rustc,%s",
+		 program_invocation_short_name);
+	apps_configure(NULL);
+}
+
+static void bench_apps_miss_setup()
+{
+	snprintf(daemon_prefs.app_boost, MAX_CONF_LIST_LEN, "cc1,cc1plus,rustc");
+	apps_configure(NULL);
+}
+
+static void bench_apps_exec()
+{
+	apps_exec(getpid());
+	apps_exit(getpid());
+}
+
+static void bench_wakers_setup()
+{
+	daemon_prefs.wakers_interval = 60;
+	wakers_enable(true);
+}
+
+static void bench_wakers_sample()
+{
+	wakers_sample();
+}
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void run_timed(const bench_t *b, unsigned long iterations,
+		      bench_result_t *result)
+{
+	unsigned long allocs;
+	uint64_t start;
+
+	if (b->setup)
+		b->setup();
+
+	allocs = alloc_count;
+	start = now_ns();
+	for (unsigned long i = 0; i < iterations; ++i)
+		b->run();
+
+	result->ns_per_op = (double) (now_ns() - start) / iterations;
+	result->allocs_per_op = (double) (alloc_count - allocs) / iterations;
+}
+
+static void sim_probe(void *data)
+{
+	detect_psupply_mode();
+	if (--sim_probes_left)
+		event_timer_set(0, sim_probe, NULL);
+}
+
+/*
+ * An hour on battery runs 3600 / BAT_SLEEP_TIME probes. Fire them back to
+ * back through event_dispatch() and scale the sample to a virtual hour.
+ */
+static int simulate_hour()
+{
+	selfcost_t cost;
+	int over;
+
+	current_mode = NULL;
+	detect_psupply_mode();
+
+	sim_probes_left = 3600 / BAT_SLEEP_TIME;
+	selfcost_start();
+	event_timer_set(0, sim_probe, NULL);
+	while (sim_probes_left)
+		event_dispatch();
+
+	selfcost_sample(&cost);
+	cost.elapsed = 3600;
+
+	printf("\nself-cost per simulated hour on battery:\n");
+	printf("  wakeups        %10.0f (limit %d)\n",
+	       (double) cost.wakeups, daemon_prefs.selfcost_max_wakeups);
+	printf("  cpu time       %10.1fms (limit %dms)\n",
+	       (cost.user_time + cost.sys_time) * 1000, daemon_prefs.selfcost_max_cpu);
+	printf("  rw calls       %10.1f per probe (limit %d)\n",
+	       cost.probes ? (double) cost.rw_calls / cost.probes : 0.0,
+	       daemon_prefs.selfcost_max_rw_calls);
+	printf("  context sw     %10ld voluntary, %ld involuntary\n",
+	       cost.vol_ctxsw, cost.invol_ctxsw);
+	printf("  rss            %10ldkB, heap in use %ldkB\n", cost.rss_kb, cost.heap_kb);
+
+	over = selfcost_check(&cost);
+	if (over)
+		printf("FAIL: self-cost limits exceeded (mask 0x%x)\n", over);
+
+	return over;
+}
+
+static unsigned long steady_state_pass(unsigned int rounds)
+{
+	static acpi_psupply_t power_supply;
+	unsigned long allocs = alloc_count;
+	selfcost_t cost;
+
+	for (unsigned int i = 0; i < rounds; ++i) {
+		detect_psupply_mode();
+		scan_power_supply(&power_supply);
+		knobs_forget();
+		load_power_mode(i % 2 ? &mode_performance : &mode_powersave);
+		thinkd_log(LOG_INFO, "steady state round %u of %u", i, rounds);
+		selfcost_sample(&cost);
+	}
+
+	return alloc_count - allocs;
+}
+
+/*
+ * After startup nothing on the probe, apply or log paths may allocate:
+ * once warmed up, probes, rescans, full loads, log lines and self-cost
+ * samples must not make a single call into malloc.
+ */
+static int simulate_steady_state()
+{
+	unsigned long allocs;
+	selfcost_t cost;
+
+	metrics_close();
+	current_mode = NULL;
+	steady_state_pass(2);
+	allocs = steady_state_pass(STEADY_STATE_ROUNDS);
+	selfcost_sample(&cost);
+
+	printf("\nsteady state, %d rounds of probe, rescan, full load and log:\n",
+	       STEADY_STATE_ROUNDS);
+	printf("  allocations    %10lu\n", allocs);
+	printf("  rss            %10ldkB, heap in use %ldkB\n", cost.rss_kb, cost.heap_kb);
+
+	if (allocs) {
+		printf("FAIL: the steady state allocated\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * The fake tree's batteries are all at 80%, next to a mouse at 5%. A
+ * second table has one battery in uWh and one in uAh, which can only be
+ * averaged by percentage.
+ */
+static int check_supplies()
+{
+	psupply_type_t types[2] = { PSUPPLY_BATTERY, PSUPPLY_BATTERY };
+	unsigned int attrs[2] = {
+		PSUPPLY_HAS_CAPACITY | PSUPPLY_HAS_ENERGY | PSUPPLY_HAS_POWER,
+		PSUPPLY_HAS_CAPACITY | PSUPPLY_HAS_CHARGE | PSUPPLY_HAS_CURRENT,
+	};
+	int capacity[2] = { 80, 25 };
+	long energy_now[2] = { 40000000, 1000000 };
+	long energy_full[2] = { 50000000, 4000000 };
+	long rate[2] = { -9000000, -500000 };
+	acpi_psupply_t mixed = {
+		.count = 2, .types = types, .attrs = attrs, .capacity = capacity,
+		.energy_now = energy_now, .energy_full = energy_full, .rate = rate,
+	};
+	static acpi_psupply_t power_supply;
+	psupply_summary_t sum, mixed_sum;
+	int batteries;
+
+	batteries = scan_power_supply(&power_supply);
+	psupply_read(&power_supply, PSUPPLY_READ_ALL);
+	psupply_summarize(&power_supply, &sum);
+	psupply_summarize(&mixed, &mixed_sum);
+	for (size_t slot = 0; slot < power_supply.count; ++slot) {
+		if (strncmp(power_supply.names[slot], "hid-", 4) == 0)
+			sum.capacity = -1;
+	}
+
+	printf("\nsupplies:\n");
+	printf("  batteries      %10d at %d%%\n", batteries, sum.capacity);
+	printf("  mixed units    %10d%%, %ld of %ld\n", mixed_sum.capacity,
+	       mixed_sum.energy_now, mixed_sum.energy_full);
+
+	if ((batteries && sum.capacity != 80) || mixed_sum.capacity != 52 ||
+	    mixed_sum.energy_full || mixed_sum.rate) {
+		printf("FAIL: a peripheral was counted or units were mixed\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the next datagram on the stand-in notify socket, or "" */
+static const char *notify_received(int fd)
+{
+	static char message[256];
+	ssize_t len;
+
+	len = recv(fd, message, sizeof(message) - 1, MSG_DONTWAIT);
+	message[len > 0 ? len : 0] = '\0';
+	return message;
+}
+
+/*
+ * The bench plays the service manager: an abstract datagram socket is
+ * what NOTIFY_SOCKET names, and a client on the control socket asks for
+ * the status.
+ */
+static int check_control()
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char root[MAX_SYSFS_PATH_LEN], path[sizeof(addr.sun_path)];
+	char name[64], ready[64], reply[CTL_MAX_REPLY] = "";
+	const char *message;
+	socklen_t addrlen;
+	struct stat st;
+	int nfd, cfd, failed = 0;
+	mode_t mask;
+
+	if (! realpath(sysroot, root) ||
+	    (size_t) snprintf(path, sizeof(path), "%s/run/ctl.sock", root) >= sizeof(path)) {
+		printf("FAIL: no control socket path under %s fits a sockaddr_un\n", sysroot);
+		return -1;
+	}
+
+	/* a leading '@' is the abstract namespace, no file to clean up */
+	snprintf(name, sizeof(name), "@thinkd-bench-%d", (int) getpid());
+	memcpy(addr.sun_path, name, strlen(name));
+	addr.sun_path[0] = '\0';
+	addrlen = offsetof(struct sockaddr_un, sun_path) + strlen(name);
+	nfd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (nfd < 0 || bind(nfd, (struct sockaddr *) &addr, addrlen) < 0 ||
+	    setenv("NOTIFY_SOCKET", name, 1) < 0 || notify_init() < 0) {
+		printf("FAIL: cannot set up a stand-in notify socket\n");
+		close(nfd);
+		return -1;
+	}
+
+	printf("\ncontrol and notify sockets:\n");
+	notify_ready();
+	snprintf(ready, sizeof(ready), "READY=1\nMAINPID=%d", (int) getpid());
+	if (strcmp(notify_received(nfd), ready) != 0 || getenv("NOTIFY_SOCKET")) {
+		printf("FAIL: readiness wasn't sent, or children would see the socket\n");
+		failed = 1;
+	}
+
+	/* as left by daemonize() */
+	mask = umask(0);
+	if (ctl_listen(path) < 0 || stat(path, &st) < 0) {
+		umask(mask);
+		printf("FAIL: cannot listen on %s\n", path);
+		close(nfd);
+		notify_close();
+		return -1;
+	}
+	umask(mask);
+	printf("  control        %10o %s\n", st.st_mode & 0777, path);
+	if ((st.st_mode & 0777) != 0600) {
+		printf("FAIL: the control socket is open to other users\n");
+		failed = 1;
+	}
+
+	/* this process counts as a boost application while asking */
+	bench_apps_match_setup();
+	apps_exec(getpid());
+	memcpy(addr.sun_path, path, sizeof(path));
+	cfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (cfd >= 0 && connect(cfd, (struct sockaddr *) &addr, sizeof(addr)) == 0 &&
+	    write(cfd, "status\n", 7) == 7) {
+		/* accept, then read the command and reply */
+		event_dispatch();
+		event_dispatch();
+		if (read(cfd, reply, sizeof(reply) - 1) < 0)
+			reply[0] = '\0';
+	}
+	close(cfd);
+	ctl_close();
+	apps_exit(getpid());
+	bench_apps_miss_setup();
+	printf("  status         %10s %s", "", reply[0] ? reply : "no reply\n");
+	if (strncmp(reply, "mode=", 5) != 0) {
+		printf("FAIL: the control socket didn't answer\n");
+		failed = 1;
+	}
+	else if (! strstr(reply, "apps ")) {
+		printf("FAIL: the status doesn't show the application boost\n");
+		failed = 1;
+	}
+
+	notify_stopping();
+	message = notify_received(nfd);
+	printf("  notify         %10s READY=1, %s\n", "", message);
+	if (strcmp(message, "STOPPING=1") != 0) {
+		printf("FAIL: shutdown wasn't sent\n");
+		failed = 1;
+	}
+	notify_close();
+	close(nfd);
+
+	return failed;
+}
+
+/* dispatch until `prefs` is current, the ms it took or -1 after `limit` */
+static long wait_for_mode(const power_prefs_t *prefs, unsigned int limit)
+{
+	uint64_t start = event_now_ms();
+
+	event_timer_set(limit, storm_tick, NULL);
+	while (current_mode != prefs && event_now_ms() - start < limit)
+		event_dispatch();
+	event_timer_cancel(storm_tick, NULL);
+
+	return current_mode == prefs ? (long) (event_now_ms() - start) : -1;
+}
+
+/*
+ * A socketpair stands in for the kernel: out-of-band data raises POLLPRI
+ * like a trigger does. On battery the event boosts into performance at
+ * once, and powersave comes back two windows after it.
+ */
+static int simulate_psi()
+{
+	int debounce = daemon_prefs.transition_debounce;
+	bool psi_boost = daemon_prefs.psi_boost;
+	long boosted = -1, released = -1;
+	int sv[2];
+	char c;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0 ||
+	    psi_watch_fd(PSI_CPU, sv[0], PSI_BENCH_WINDOW) < 0) {
+		printf("FAIL: cannot watch a stand-in pressure trigger\n");
+		return -1;
+	}
+
+	/* the probe only hands over the callback, the real files stay shut */
+	daemon_prefs.psi_boost = false;
+	daemon_prefs.transition_debounce = 0;
+	set_ac_online(false);
+	current_mode = NULL;
+	detect_psupply_mode();
+
+	if (send(sv[1], "!", 1, MSG_OOB) == 1) {
+		boosted = wait_for_mode(&mode_performance, 1000);
+		/* the kernel raises a trigger once per window, the stand-in once */
+		recv(sv[0], &c, 1, MSG_OOB);
+		released = wait_for_mode(&mode_powersave, 10 * PSI_BENCH_WINDOW);
+	}
+	psi_disable();
+	close(sv[1]);
+	daemon_prefs.psi_boost = psi_boost;
+	daemon_prefs.transition_debounce = debounce;
+
+	printf("\npressure trigger, %dms window:\n", PSI_BENCH_WINDOW);
+	printf("  boost          %10ldms after the event\n", boosted);
+	printf("  release        %10ldms after the boost\n", released);
+
+	if (boosted < 0 || released < 2 * PSI_BENCH_WINDOW - 10) {
+		printf("FAIL: pressure didn't boost, or the boost ended early\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint64_t cpu_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* a child that runs STORM_EXECS short lived processes one after another */
+static pid_t exec_storm_start()
+{
+	pid_t storm = fork();
+
+	if (storm != 0)
+		return storm;
+
+	for (int i = 0; i < STORM_EXECS; ++i) {
+		pid_t pid = fork();
+
+		if (pid == 0) {
+			execl("/bin/true", "true", (char *) NULL);
+			_exit(127);
+		}
+		if (pid > 0)
+			waitpid(pid, NULL, 0);
+	}
+	_exit(0);
+}
+
+static void storm_tick(void *data)
+{
+	(void) data;
+	event_timer_set(10, storm_tick, NULL);
+}
+
+/*
+ * Every exec and exit of the storm reaches the daemon through the proc
+ * connector; the daemon's own cpu time divided by the execs is what a
+ * build costs it. Boosting for "true" makes each of them a match.
+ */
+static int simulate_exec_storm()
+{
+	unsigned long events;
+	unsigned int peak = 0, left;
+	uint64_t cpu, wakeups;
+	pid_t storm;
+	int status;
+
+	metrics_close();
+	snprintf(daemon_prefs.app_boost, MAX_CONF_LIST_LEN, "cc1,cc1plus,rustc,true");
+	if (apps_configure(NULL) < 0 || ! apps_listening()) {
+		printf("\nexec storm: no process connector, skipped\n");
+		apps_close();
+		return 0;
+	}
+
+	events = apps_events();
+	wakeups = event_wakeups();
+	cpu = cpu_ns();
+	storm = exec_storm_start();
+
+	/* the tick keeps polling while the storm is between processes */
+	event_timer_set(10, storm_tick, NULL);
+	while (waitpid(storm, &status, WNOHANG) == 0) {
+		event_dispatch();
+		if (apps_running() > peak)
+			peak = apps_running();
+	}
+	/* the last exit may still be queued */
+	event_timer_set(50, storm_tick, NULL);
+	event_dispatch();
+	event_timer_cancel(storm_tick, NULL);
+
+	cpu = cpu_ns() - cpu;
+	events = apps_events() - events;
+	wakeups = event_wakeups() - wakeups;
+
+	/* the kernel only multicasts into the initial network namespace */
+	if (! events) {
+		printf("\nexec storm: no process events delivered, skipped\n");
+		apps_close();
+		return 0;
+	}
+
+	printf("\nexec storm, %d fork/execs:\n", STORM_EXECS);
+	printf("  events         %10lu in %lu wakeups\n", events,
+	       (unsigned long) wakeups);
+	printf("  daemon cpu     %10.0fns per exec\n", (double) cpu / STORM_EXECS);
+	left = apps_running();
+	printf("  boosting       %10u at most, %u left\n", peak, left);
+
+	apps_close();
+	if (left) {
+		printf("FAIL: the storm wasn't seen or left processes counted\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void set_ac_online(bool online)
+{
+	sysfs_path_t path;
+	FILE *fp;
+
+	sysroot_sprintf(path, "%s/AC0/online", POWER_SUPPLY_DIRECTORY);
+	if ((fp = fopen(path, "w"))) {
+		fprintf(fp, "%d\n", online);
+		fclose(fp);
+	}
+	flap_online = online;
+}
+
+/* what the kernel multicasts when AC0 comes or goes */
+static const char ac_uevent[] = "change@/devices/LNXSYSTM:00/LNXSYBUS:00/ACPI0003:00/"
+	"power_supply/AC0\0ACTION=change\0DEVPATH=/devices/LNXSYSTM:00/LNXSYBUS:00/"
+	"ACPI0003:00/power_supply/AC0\0SUBSYSTEM=power_supply\0POWER_SUPPLY_NAME=AC0";
+
+/* each flap reaches the probe through its uevent, not a probe tick */
+static void sim_flap(void *data)
+{
+	set_ac_online(! flap_online);
+	uevent_dispatch(ac_uevent, sizeof(ac_uevent));
+	if (--flaps_left)
+		event_timer_set(FLAP_INTERVAL_MS, sim_flap, NULL);
+}
+
+/* knob writes for one storm, or -1 when it didn't end in powersave */
+static long flap_storm(int debounce)
+{
+	uint64_t writes, end;
+
+	daemon_prefs.transition_debounce = debounce;
+	set_ac_online(true);
+	current_mode = NULL;
+	detect_psupply_mode();
+
+	writes = stats_histogram(STAT_KNOB_WRITE)->count;
+	flaps_left = FLAP_COUNT;
+	event_timer_set(FLAP_INTERVAL_MS, sim_flap, NULL);
+
+	/* long enough for the last flap to settle */
+	end = event_now_ms() + FLAP_COUNT * FLAP_INTERVAL_MS + debounce + 1000;
+	while (event_now_ms() < end && event_dispatch() >= 0)
+		;
+
+	if (current_mode != &mode_powersave)
+		return -1;
+	return (long) (stats_histogram(STAT_KNOB_WRITE)->count - writes);
+}
+
+static int simulate_flap_storm()
+{
+	static const char backlight_uevent[] = "change@/devices/pci0000:00/0000:00:02.0/"
+		"backlight/intel_backlight\0ACTION=change\0SUBSYSTEM=backlight";
+	int debounce = daemon_prefs.transition_debounce;
+	sysfs_path_t path;
+	long plain, debounced;
+	uint64_t probes;
+
+	sysroot_sprintf(path, "%s/AC0/online", POWER_SUPPLY_DIRECTORY);
+	if (access(path, W_OK) < 0) {
+		printf("\nflap storm: no AC0 in the fake tree, skipped\n");
+		return 0;
+	}
+
+	/* the exporter's refresh timer would keep the virtual clock going */
+	metrics_close();
+	event_set_virtual_clock(event_now_ms());
+	/* the socket itself isn't polled on a virtual clock */
+	uevent_listen(detect_psupply_change);
+
+	probes = stats_histogram(STAT_PROBE)->count;
+	uevent_dispatch(backlight_uevent, sizeof(backlight_uevent));
+	if (stats_histogram(STAT_PROBE)->count != probes) {
+		printf("FAIL: a backlight uevent ran a probe\n");
+		uevent_close();
+		return -1;
+	}
+
+	plain = flap_storm(0);
+	debounced = flap_storm(debounce > 0 ? debounce : 2000);
+	daemon_prefs.transition_debounce = debounce;
+	uevent_close();
+
+	printf("\nflap storm, %d AC changes %dms apart:\n", FLAP_COUNT, FLAP_INTERVAL_MS);
+	printf("  knob writes    %10ld without debounce, %ld with %dms\n",
+	       plain, debounced, debounce > 0 ? debounce : 2000);
+
+	if (plain < 0 || debounced < 0 || debounced >= plain) {
+		printf("FAIL: the storm didn't settle in powersave with fewer writes\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Run every benchmark in a child traced by this process. The tracer stores
+ * its running syscall count straight into the child's syscall_count, which
+ * sits at the same address in both processes after fork().
+ */
+static bool run_traced(const bench_t *benches, size_t count,
+		       bench_result_t *results)
+{
+	unsigned long entries = 0;
+	bool in_syscall = false;
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	if (pid < 0)
+		return false;
+
+	if (pid == 0) {
+		if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0)
+			_exit(EXIT_FAILURE);
+		raise(SIGSTOP);
+
+		for (size_t i = 0; i < count; ++i) {
+			unsigned long before;
+
+			if (benches[i].setup)
+				benches[i].setup();
+
+			before = syscall_count;
+			for (int n = 0; n < TRACED_ITERATIONS; ++n)
+				benches[i].run();
+
+			results[i].syscalls_per_op =
+				(double) (syscall_count - before) / TRACED_ITERATIONS;
+		}
+		_exit(EXIT_SUCCESS);
+	}
+
+	if (waitpid(pid, &status, 0) < 0 || ! WIFSTOPPED(status))
+		return false;
+
+	ptrace(PTRACE_SETOPTIONS, pid, NULL,
+	       (void *) (PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL));
+
+	while (ptrace(PTRACE_SYSCALL, pid, NULL, NULL) == 0) {
+		if (waitpid(pid, &status, 0) < 0 || WIFEXITED(status) ||
+		    WIFSIGNALED(status))
+			break;
+
+		if (! WIFSTOPPED(status) || WSTOPSIG(status) != (SIGTRAP | 0x80))
+			continue;
+
+		/* stops alternate between syscall entry and exit */
+		in_syscall = ! in_syscall;
+		if (in_syscall)
+			ptrace(PTRACE_POKEDATA, pid, (void *) &syscall_count,
+			       (void *) ++entries);
+	}
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+static void count_history_point(const history_point_t *point, void *data)
+{
+	unsigned int *points = data;
+
+	if (point->capacity < 0 || point->capacity > 100 || point->energy_full <= 0)
+		points[HISTORY_MAX_BATTERIES] = 1;
+	++points[point->battery];
+}
+
+/*
+ * A sample a minute from two batteries for four weeks, flushed every hour
+ * like the daemon does, then a day of hourly points read back.
+ */
+static int simulate_history()
+{
+	unsigned int points[HISTORY_MAX_BATTERIES + 1] = { 0 };
+	char path[MAX_SYSFS_PATH_LEN];
+	int64_t start = 1700000000, end = start + HISTORY_DAYS * 86400;
+	unsigned long writes;
+	history_sample_t s;
+	struct stat st;
+	uint64_t ns;
+
+	snprintf(path, sizeof(path), "%s/run/history", sysroot);
+	unlink(path);
+	if (history_open(path, HISTORY_BENCH_KB) < 0) {
+		printf("FAIL: cannot open %s\n", path);
+		return -1;
+	}
+
+	writes = history_writes();
+	memset(&s, 0, sizeof(s));
+	for (int64_t t = start; t < end; t += 60) {
+		for (s.battery = 0; s.battery < 2; ++s.battery) {
+			/* discharging from 100% over 5 hours, 3 on AC charging back */
+			int64_t cycle = (t - start) % (8 * 3600);
+
+			s.time = t;
+			s.ac_online = cycle >= 5 * 3600;
+			s.mode = s.ac_online ? 2 : 1;
+			s.capacity = s.ac_online ? 40 + (int) ((cycle - 5 * 3600) / 180) :
+				100 - (int) (cycle / 300);
+			s.power = s.ac_online ? 20000 : -8000 - (long) (t % 7) * 100;
+			s.energy_full = 57000 - (long) ((t - start) / 86400) * 5 - s.battery * 1000;
+			history_append(&s);
+		}
+		if ((t - start) % 3600 == 3540)
+			history_flush();
+	}
+	history_close();
+	writes = history_writes() - writes;
+
+	ns = now_ns();
+	history_query(path, end - 86400, end, 3600, count_history_point, points);
+	ns = now_ns() - ns;
+	stat(path, &st);
+
+	printf("\nbattery history, %d days of 2 batteries a minute:\n", HISTORY_DAYS);
+	printf("  file size      %10ldkB of %dkB\n", (long) st.st_size / 1024,
+	       HISTORY_BENCH_KB);
+	printf("  writes         %10.1f per hour\n", writes / (HISTORY_DAYS * 24.0));
+	printf("  last day       %10u + %u hourly points in %.0fus\n", points[0],
+	       points[1], ns / 1000.0);
+	unlink(path);
+
+	if (st.st_size > HISTORY_BENCH_KB * 1024 || writes > HISTORY_DAYS * 24 * 4 ||
+	    points[0] != 24 || points[1] != 24 || points[HISTORY_MAX_BATTERIES]) {
+		printf("FAIL: the history grew, wrote too often or read back wrong\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * A battery session sampling the fake /proc: the samples must not touch
+ * the heap, and must cost less than the budget at the default interval.
+ */
+static int simulate_wakers()
+{
+	wakers_cost_t cost;
+	unsigned long allocs;
+	uint64_t per_minute_us;
+	int failed = 0;
+
+	wakers_close();
+	daemon_prefs.wakers_interval = 60;
+	wakers_enable(true);
+	allocs = alloc_count;
+	for (int i = 0; i < WAKERS_SAMPLES; ++i)
+		wakers_sample();
+	allocs = alloc_count - allocs;
+	wakers_get_cost(&cost);
+	wakers_close();
+
+	if (! cost.samples) {
+		printf("FAIL: no wakers samples taken\n");
+		return 1;
+	}
+	per_minute_us = cost.cpu_ns / cost.samples * 60 / daemon_prefs.wakers_interval / 1000;
+
+	printf("\nwakers sampling every %d s:\n", daemon_prefs.wakers_interval);
+	printf("  cpu time       %10.1fus per sample, %lu us per minute (budget %d us)\n",
+	       cost.cpu_ns / 1000.0 / cost.samples, (unsigned long) per_minute_us,
+	       WAKERS_BUDGET_US);
+	printf("  allocations    %10lu in %lu samples\n", allocs, cost.samples);
+
+	if (per_minute_us > WAKERS_BUDGET_US) {
+		printf("FAIL: sampling costs more than its budget\n");
+		failed = 1;
+	}
+	if (allocs) {
+		printf("FAIL: sampling allocates\n");
+		failed = 1;
+	}
+
+	return failed;
+}
+
+/*
+ * The fake /proc has 280 user processes for 256 slots, the busiest last,
+ * and kernel threads. A kernel thread and the busiest process wake up
+ * between two samples: only the latter may be reported, and first.
+ */
+static int check_wakers_slots()
+{
+	static const char *busiest = "proc/1765/schedstat", *kworker = "proc/407/schedstat";
+	char report[4096], old_busiest[64], old_kworker[64], top[64] = "none", *line;
+	int failed = 0;
+
+	fake_read(busiest, old_busiest, sizeof(old_busiest));
+	fake_read(kworker, old_kworker, sizeof(old_kworker));
+
+	wakers_close();
+	daemon_prefs.wakers_interval = 60;
+	wakers_enable(true);
+	fake_write(busiest, "1765000 0 50000");
+	fake_write(kworker, "407000 0 90000");
+	/* the flap storm left the loop on a virtual clock */
+	event_set_virtual_clock(event_now_ms() + 60000);
+	wakers_sample();
+	wakers_report(report, sizeof(report), WAKERS_TOP);
+	wakers_close();
+
+	fake_write(busiest, old_busiest);
+	fake_write(kworker, old_kworker);
+
+	if ((line = strstr(report, "\nwakeups ")))
+		snprintf(top, sizeof(top), "%.*s", (int) strcspn(line + 1, "\n"), line + 1);
+	printf("\nwakers slots:\n  top waker      %s\n", top);
+	if (! strstr(top, "thinkd") || ! strstr(top, " 1765 ")) {
+		printf("FAIL: the busiest process isn't the top waker\n");
+		failed = 1;
+	}
+	if (strstr(report, "kworker")) {
+		printf("FAIL: a kernel thread was sampled\n");
+		failed = 1;
+	}
+	if (! strstr(report, "\n24 processes not tracked")) {
+		printf("FAIL: untracked processes miscounted:\n%s", report);
+		failed = 1;
+	}
+
+	return failed;
+}
+
+/*
+ * The first rule that holds wins, numbered ones before the built-in ones;
+ * inputs that couldn't be read fail every comparison on them.
+ */
+static int simulate_rules()
+{
+	static const char *const test_rules[MAX_CONF_RULES] = {
+		[0] = "critical if battery<5 and !ac",
+		[1] = "heavy_powersave if battery < 20 and !ac",
+		[2] = "powersave if temp>=85",
+		[3] = "powersave if lid=closed and !boost",
+		[4] = "heavy_powersave if on_battery>=120 and battery<50",
+		[5] = "turbo if ac",
+		[6] = "powersave if battery>",
+		[8] = "performance if ac",
+	};
+	/* ac, boost, battery, temp, on_battery, lid */
+	static const rules_case_t cases[] = {
+		{{ 0, 0, 3, 50, 10, 0 }, "Rule1:"},
+		{{ 0, 0, 5, 50, 0, 0 }, "Rule2:"},
+		{{ 0, 0, 15, 90, 10, 0 }, "Rule2:"},
+		{{ 1, 0, 3, 90, 0, 0 }, "Rule3:"},
+		{{ 1, 0, 80, 85, 0, 0 }, "Rule3:"},
+		{{ 1, 0, 80, 50, 0, 1 }, "Rule4:"},
+		{{ 0, 0, 40, 50, 150, 0 }, "Rule5:"},
+		{{ 1, 0, RULES_UNKNOWN, RULES_UNKNOWN, 0, RULES_UNKNOWN }, "Rule9:"},
+		{{ 0, 1, 80, 50, 0, 1 }, "boosting"},
+		{{ 0, 0, 60, 50, 150, 0 }, "on battery"},
+		{{ 0, 0, RULES_UNKNOWN, RULES_UNKNOWN, 30, RULES_UNKNOWN }, "on battery"},
+	};
+	int sensed[RULE_INPUTS], written = 0, compiled, failed = 0;
+	unsigned long allocs;
+	volatile int sink = 0;
+	uint64_t start, elapsed;
+
+	memset(&rule_prefs, 0, sizeof(rule_prefs));
+	for (int n = 0; n < MAX_CONF_RULES; ++n) {
+		if (test_rules[n]) {
+			snprintf(rule_prefs.rules[n], MAX_CONF_STR_LEN, "%s", test_rules[n]);
+			++written;
+		}
+	}
+	compiled = rules_compile(&rule_prefs);
+	rules_sense(sensed);
+
+	printf("\nrules, %d of %d compiled:\n", compiled, written);
+	if (compiled != written - 2) {
+		printf("FAIL: the two broken rules weren't left out\n");
+		failed = 1;
+	}
+	if (sensed[RULE_TEMP] != 52 || sensed[RULE_LID] != 0) {
+		printf("FAIL: sensed temp %d and lid %d, not 52 and 0\n", sensed[RULE_TEMP],
+		       sensed[RULE_LID]);
+		failed = 1;
+	}
+
+	for (size_t i = 0; i < array_count(cases); ++i) {
+		const char *text = rules_text(rules_eval(cases[i].inputs));
+
+		if (strncmp(text, cases[i].winner, strlen(cases[i].winner)) != 0) {
+			printf("FAIL: case %zu selects '%s' instead of %s\n", i, text,
+			       cases[i].winner);
+			failed = 1;
+		}
+	}
+
+	allocs = alloc_count;
+	start = now_ns();
+	for (int i = 0; i < RULES_EVALUATIONS; ++i)
+		sink += rules_eval(cases[i % array_count(cases)].inputs);
+	elapsed = now_ns() - start;
+	allocs = alloc_count - allocs;
+	(void) sink;
+
+	printf("  precedence     %10zu cases %s\n", array_count(cases), failed ? "FAILED" : "ok");
+	printf("  evaluations    %10.1fM per second, %.0fns each\n",
+	       RULES_EVALUATIONS * 1000.0 / elapsed, (double) elapsed / RULES_EVALUATIONS);
+	printf("  allocations    %10lu\n", allocs);
+	if (allocs) {
+		printf("FAIL: evaluating rules allocates\n");
+		failed = 1;
+	}
+
+	/* back to the built-in rules */
+	memset(&rule_prefs, 0, sizeof(rule_prefs));
+	rules_compile(&rule_prefs);
+
+	return failed;
+}
+
+/* the first line of a file under the fake root, "" when it can't be read */
+static const char *fake_read(const char *path, char *value, size_t len)
+{
+	char full[MAX_SYSFS_PATH_LEN];
+	FILE *fp;
+
+	value[0] = '\0';
+	snprintf(full, sizeof(full), "%s/%s", sysroot, path);
+	if ((fp = fopen(full, "r"))) {
+		if (! fgets(value, (int) len, fp))
+			value[0] = '\0';
+		fclose(fp);
+	}
+	value[strcspn(value, "\n")] = '\0';
+	return value;
+}
+
+static void fake_write(const char *path, const char *value)
+{
+	char full[MAX_SYSFS_PATH_LEN];
+	FILE *fp;
+
+	snprintf(full, sizeof(full), "%s/%s", sysroot, path);
+	if ((fp = fopen(full, "w"))) {
+		fputs(value, fp);
+		fclose(fp);
+	}
+}
+
+/*
+ * Load `prefs` with the files of its cases emptied first. sysfs takes
+ * every write whole, but a regular file would keep the tail of a longer
+ * old value behind the kept handle's pwrite(). A file still empty after
+ * the load wasn't written and gets its old value back.
+ */
+static void load_fake_mode(const power_prefs_t *prefs, const knob_file_case_t *cases,
+			   size_t count)
+{
+	char old[KNOB_FILE_CASES][64];
+	size_t n = 0;
+
+	for (size_t i = 0; i < count && n < array_count(old); ++i) {
+		if (cases[i].mode != prefs)
+			continue;
+		fake_read(cases[i].path, old[n++], sizeof(old[0]));
+		fake_write(cases[i].path, "");
+	}
+
+	knobs_forget();
+	load_power_mode((power_prefs_t *) prefs);
+
+	for (size_t i = 0, m = 0; i < count && m < n; ++i) {
+		char full[MAX_SYSFS_PATH_LEN];
+		struct stat st;
+
+		if (cases[i].mode != prefs)
+			continue;
+		snprintf(full, sizeof(full), "%s/%s", sysroot, cases[i].path);
+		if (stat(full, &st) == 0 && ! st.st_size)
+			fake_write(cases[i].path, old[m]);
+		++m;
+	}
+}
+
+/*
+ * Load each mode of a config setting the GPU and cgroup knobs and compare
+ * what the fake files hold afterwards. The negative minimum is refused,
+ * so the performance profile leaves the powersave one in place, and it
+ * sets no cgroup key, so the slices get their defaults back. Weights are
+ * clamped to what cpu.weight takes.
+ */
+static int check_knob_files()
+{
+	static const char ini[] =
+		"[powersave]\n"
+		"Gpu_Min_Freq=300\n"
+		"Gpu_Max_Freq=600\n"
+		"Gpu_Boost_Freq=600\n"
+		"Gpu_Level=low\n"
+		"Cgroup_Weight=20\n"
+		"Cgroup_Cpu_Max=50\n"
+		"Cgroup_Efficiency_Cores=on\n"
+		"[performance]\n"
+		"Gpu_Min_Freq=-1\n"
+		"Gpu_Max_Freq=1300\n"
+		"Gpu_Boost_Freq=1300\n"
+		"Gpu_Level=manual\n"
+		"Gpu_Profile=3d_full_screen\n"
+		"[heavy_powersave]\n"
+		"Cgroup_Weight=-5\n"
+		"[critical]\n"
+		"Cgroup_Weight=20000\n"
+		"[daemon]\n"
+		"Cgroup_Slices=system.slice,user.slice/background.slice\n";
+	static const knob_file_case_t cases[] = {
+		{&mode_powersave, "sys/class/drm/card0/gt_min_freq_mhz", "300"},
+		{&mode_powersave, "sys/class/drm/card0/gt_max_freq_mhz", "600"},
+		{&mode_powersave, "sys/class/drm/card0/gt_boost_freq_mhz", "600"},
+		{&mode_powersave, "sys/class/drm/card1/device/power_dpm_force_performance_level",
+		 "low"},
+		{&mode_powersave, "sys/class/drm/card1/device/pp_power_profile_mode", "0"},
+		{&mode_powersave, "sys/fs/cgroup/system.slice/cpu.weight", "20"},
+		{&mode_powersave, "sys/fs/cgroup/user.slice/background.slice/cpu.weight", "20"},
+		/* half of 12 cpus */
+		{&mode_powersave, "sys/fs/cgroup/system.slice/cpu.max", "600000 100000"},
+		{&mode_powersave, "sys/fs/cgroup/system.slice/cpuset.cpus", "4-11"},
+		{&mode_performance, "sys/class/drm/card0/gt_min_freq_mhz", "300"},
+		{&mode_performance, "sys/class/drm/card0/gt_max_freq_mhz", "1300"},
+		{&mode_performance, "sys/class/drm/card0/gt_boost_freq_mhz", "1300"},
+		{&mode_performance, "sys/class/drm/card1/device/power_dpm_force_performance_level",
+		 "manual"},
+		{&mode_performance, "sys/class/drm/card1/device/pp_power_profile_mode", "1"},
+		{&mode_performance, "sys/fs/cgroup/system.slice/cpu.weight", "100"},
+		{&mode_performance, "sys/fs/cgroup/system.slice/cpu.max", "max 100000"},
+		{&mode_performance, "sys/fs/cgroup/system.slice/cpuset.cpus", ""},
+		{&mode_heavy_powersave, "sys/fs/cgroup/system.slice/cpu.weight", "1"},
+		{&mode_critical, "sys/fs/cgroup/system.slice/cpu.weight", "10000"},
+	};
+	const power_prefs_t *mode = NULL;
+	char path[MAX_SYSFS_PATH_LEN], value[64];
+	int matched = 0;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/etc/knobs.ini", sysroot);
+	if (! (fp = fopen(path, "w")) || fputs(ini, fp) < 0 || fclose(fp) != 0) {
+		printf("FAIL: cannot write %s\n", path);
+		return -1;
+	}
+	config_file = path;
+	reload_config();
+
+	printf("\nknob files:\n");
+	for (size_t i = 0; i < array_count(cases); ++i) {
+		if (cases[i].mode != mode) {
+			mode = cases[i].mode;
+			load_fake_mode(mode, cases, array_count(cases));
+		}
+
+		if (strcmp(fake_read(cases[i].path, value, sizeof(value)), cases[i].value) == 0)
+			++matched;
+		else
+			printf("FAIL: %s holds '%s' in %s mode instead of '%s'\n",
+			       cases[i].path, value, mode_name(mode), cases[i].value);
+	}
+	printf("  as set         %10d of %zu\n", matched, array_count(cases));
+
+	config_file = config_path;
+	reload_config();
+	unlink(path);
+
+	return matched == (int) array_count(cases) ? 0 : -1;
+}
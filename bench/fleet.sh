@@ -0,0 +1,68 @@
+#!/bin/sh
+# Start a fleet of thinkd instances on loopback, each on its own fake sysfs
+# tree, and drive them all at once with thinkd-remote.
+#
+# usage: fleet.sh DIR [instances] [first port]
+
+set -e
+
+DIR="$1"
+COUNT="${2:-16}"
+PORT="${3:-17600}"
+BENCHDIR="$(dirname "$0")"
+
+if [ -z "$DIR" ]; then
+	echo "usage: $0 DIR [instances] [first port]" >&2
+	exit 1
+fi
+
+rm -rf "$DIR"
+mkdir -p "$DIR"
+DIR="$(cd "$DIR" && pwd)"
+KEY="$DIR/thinkd.key"
+head -c 32 /dev/urandom | od -An -tx1 | tr -d ' \n' > "$KEY"
+chmod 600 "$KEY"
+
+pids=""
+hosts=""
+stop() {
+	[ -n "$pids" ] && kill $pids 2>/dev/null
+	wait 2>/dev/null || true
+}
+trap stop EXIT
+
+i=0
+while [ "$i" -lt "$COUNT" ]; do
+	root="$DIR/host$i"
+	sh "$BENCHDIR/mkfakesys.sh" "$root" 1 1 3
+	mkdir -p "$root/etc"
+	sed -e '/^\[daemon\]/a Remote_Listen=127.0.0.1:'$((PORT + i)) \
+	    -e '/^\[daemon\]/a Remote_Key_File='"$KEY" thinkd.ini > "$root/etc/thinkd.ini"
+	./thinkd --foreground --no-probe --root "$root" --config "$root/etc/thinkd.ini" \
+		--state-file "$root/run/thinkd.state" --socket "$root/run/thinkd.socket" \
+		2> "$root/thinkd.log" &
+	pids="$pids $!"
+	hosts="$hosts 127.0.0.1:$((PORT + i))"
+	i=$((i + 1))
+done
+
+# give the listeners a moment to come up
+sleep 1
+
+status=0
+for cmd in status "mode performance" status "mode auto" reload; do
+	echo "== $cmd"
+	# identical replies are folded into one line with a count
+	./thinkd-remote -k "$KEY" "$cmd" $hosts > "$DIR/replies" || status=1
+	cut -d' ' -f2- "$DIR/replies" | sort | uniq -c
+done
+
+echo "== status with a wrong key"
+echo wrong > "$DIR/wrong.key"
+chmod 600 "$DIR/wrong.key"
+if ./thinkd-remote -k "$DIR/wrong.key" status $hosts > /dev/null; then
+	echo "FAIL: accepted a wrong key"
+	status=1
+fi
+
+exit $status
@@ -0,0 +1,168 @@
+#!/bin/sh
+# Generate a fake ThinkPad /sys and /proc tree for benchmarks and simulation.
+#
+# usage: mkfakesys.sh ROOT [batteries] [mains] [rfkill devices]
+#
+# The tree only contains the files thinkd reads or writes, run thinkd
+# against it with --root ROOT.
+
+set -e
+
+ROOT="$1"
+BATTERIES="${2:-2}"
+MAINS="${3:-1}"
+RFKILLS="${4:-3}"
+
+if [ -z "$ROOT" ]; then
+	echo "usage: $0 ROOT [batteries] [mains] [rfkill devices]" >&2
+	exit 1
+fi
+
+put() {
+	mkdir -p "$(dirname "$1")"
+	printf '%s\n' "$2" > "$1"
+}
+
+rm -rf "$ROOT"
+PSUPPLY="$ROOT/sys/class/power_supply"
+
+i=0
+while [ "$i" -lt "$BATTERIES" ]; do
+	bat="$PSUPPLY/BAT$i"
+	put "$bat/type" Battery
+	put "$bat/present" 1
+	put "$bat/status" Discharging
+	put "$bat/capacity" 80
+	put "$bat/energy_full" 50000000
+	put "$bat/energy_now" 40000000
+	put "$bat/power_now" 9000000
+	put "$bat/voltage_now" 12000000
+	cat > "$bat/uevent" <<UEVENT
+POWER_SUPPLY_NAME=BAT$i
+POWER_SUPPLY_TYPE=Battery
+POWER_SUPPLY_STATUS=Discharging
+POWER_SUPPLY_PRESENT=1
+POWER_SUPPLY_VOLTAGE_NOW=12000000
+POWER_SUPPLY_POWER_NOW=9000000
+POWER_SUPPLY_ENERGY_FULL=50000000
+POWER_SUPPLY_ENERGY_NOW=40000000
+POWER_SUPPLY_CAPACITY=80
+UEVENT
+	i=$((i + 1))
+done
+
+# a bluetooth mouse, which must not count towards the charge
+mouse="$PSUPPLY/hid-00:1f:20:aa:bb:cc-battery"
+put "$mouse/type" Battery
+put "$mouse/scope" Device
+put "$mouse/capacity" 5
+printf 'POWER_SUPPLY_NAME=hid-00:1f:20:aa:bb:cc-battery\nPOWER_SUPPLY_SCOPE=Device\nPOWER_SUPPLY_CAPACITY=5\n' > "$mouse/uevent"
+
+i=0
+while [ "$i" -lt "$MAINS" ]; do
+	ac="$PSUPPLY/AC$i"
+	put "$ac/type" Mains
+	put "$ac/online" 0
+	printf 'POWER_SUPPLY_NAME=AC%s\nPOWER_SUPPLY_ONLINE=0\n' "$i" > "$ac/uevent"
+	i=$((i + 1))
+done
+
+i=0
+while [ "$i" -lt "$RFKILLS" ]; do
+	case "$i" in
+	0) name=tpacpi_bluetooth_sw; type=bluetooth ;;
+	1) name=tpacpi_wwan_sw; type=wwan ;;
+	*) name=phy$((i - 2)); type=wlan ;;
+	esac
+	put "$ROOT/sys/class/rfkill/rfkill$i/name" "$name"
+	put "$ROOT/sys/class/rfkill/rfkill$i/type" "$type"
+	put "$ROOT/sys/class/rfkill/rfkill$i/state" 1
+	i=$((i + 1))
+done
+
+put "$ROOT/sys/class/backlight/acpi_video0/max_brightness" 15
+put "$ROOT/sys/class/backlight/acpi_video0/brightness" 15
+put "$ROOT/sys/module/snd_hda_intel/parameters/power_save" 0
+put "$ROOT/sys/module/snd_hda_intel/parameters/power_save_controller" N
+mkdir -p "$ROOT/sys/devices/platform/thinkpad_acpi"
+
+# an integrated i915 and a discrete amdgpu, plus a connector to skip
+DRM="$ROOT/sys/class/drm"
+mkdir -p "$DRM/card0/device" "$DRM/card0-eDP-1" "$DRM/card1/device"
+ln -s ../../../../bus/pci/drivers/i915 "$DRM/card0/device/driver"
+ln -s ../../../../bus/pci/drivers/amdgpu "$DRM/card1/device/driver"
+put "$DRM/card0/gt_min_freq_mhz" 300
+put "$DRM/card0/gt_max_freq_mhz" 1100
+put "$DRM/card0/gt_boost_freq_mhz" 1100
+put "$DRM/card1/device/power_dpm_force_performance_level" auto
+put "$DRM/card1/device/pp_power_profile_mode" 0
+
+# a hybrid cpu with 4 P-cores and 8 E-cores, and the slices to confine
+put "$ROOT/sys/devices/system/cpu/online" 0-11
+put "$ROOT/sys/devices/cpu_core/cpus" 0-3
+put "$ROOT/sys/devices/cpu_atom/cpus" 4-11
+for slice in system.slice user.slice/background.slice; do
+	put "$ROOT/sys/fs/cgroup/$slice/cpu.weight" 100
+	put "$ROOT/sys/fs/cgroup/$slice/cpu.max" "max 100000"
+	put "$ROOT/sys/fs/cgroup/$slice/cpuset.cpus" ""
+done
+put "$ROOT/proc/acpi/ibm/light" "status:		off"
+put "$ROOT/proc/acpi/ibm/volume" "level:		7"
+put "$ROOT/proc/sys/kernel/nmi_watchdog" 1
+put "$ROOT/proc/pressure/cpu" "some avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+put "$ROOT/proc/pressure/io" "some avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+# a busy laptop's interrupts on 12 cpus, and the system totals
+{
+	printf '      '
+	for cpu in 0 1 2 3 4 5 6 7 8 9 10 11; do printf '      CPU%d' $cpu; done
+	printf '\n'
+	for irq in 0:2-edge:timer 8:8-edge:rtc0 9:9-fasteoi:acpi 16:16-fasteoi:i801_smbus \
+	    120:327680-edge:xhci_hcd 121:32768-edge:i915 122:1048576-edge:iwlwifi \
+	    123:514048-edge:snd_hda_intel:card0 124:520192-edge:enp0s31f6 \
+	    125:1572864-edge:nvme0q0 126:1572865-edge:nvme0q1 LOC NMI RES CAL TLB; do
+		printf '%4s:' "${irq%%:*}"
+		for cpu in 0 1 2 3 4 5 6 7 8 9 10 11; do printf ' %9d' $((cpu * 7919 + 104729)); done
+		case $irq in
+		[0-9]*) rest=${irq#*:}; printf '  IR-PCI-MSI %s   %s\n' "${rest%%:*}" "${rest#*:}" ;;
+		*) printf '   %s interrupts\n' "$irq" ;;
+		esac
+	done
+	printf ' ERR:          0\n MIS:          0\n'
+} > "$ROOT/proc/interrupts"
+put "$ROOT/proc/stat" "cpu  106112 2217 41532 3410761 6721 9011 4301 0 0 0
+cpu0 8843 184 3461 284230 560 751 358 0 0 0
+intr 24931785 0 9 0 0 0 0 0 0 38 0 0 0 0 0 0 0 312
+ctxt 51833212
+btime 1760850000
+processes 183204
+procs_running 1
+procs_blocked 0"
+# a desktop's worth of processes, each with its cpu time and runs: more
+# than the sampler has slots, the busiest last, and kernel threads
+# (PF_KTHREAD in the flags, children of kthreadd) it must leave out
+i=1
+for comm in systemd kthreadd rcu_sched kworker/0:1 ksoftirqd/0 systemd-journal \
+    systemd-udevd dbus-daemon NetworkManager wpa_supplicant pipewire \
+    wireplumber Xorg gnome-shell firefox Isolated\ Web\ Co cc1 thinkd; do
+	case $comm in
+	k*|rcu*) parent=2 flags=6291712 ;;
+	*) parent=1 flags=4194560 ;;
+	esac
+	n=0
+	while [ "$n" -lt 20 ]; do
+		pid=$((i * 97 + n))
+		put "$ROOT/proc/$pid/stat" "$pid ($comm) S $parent $pid $pid 0 -1 $flags \
+1200 0 0 0 $((pid * 3 % 5000)) $((pid % 700)) 0 0 20 0 1 0 42 0 0"
+		put "$ROOT/proc/$pid/schedstat" "$((pid * 1000)) 0 $((pid * 7 % 90000))"
+		n=$((n + 1))
+	done
+	i=$((i + 1))
+done
+put "$ROOT/sys/class/thermal/thermal_zone0/temp" 45000
+put "$ROOT/sys/class/thermal/thermal_zone1/temp" 52000
+put "$ROOT/sys/class/thermal/cooling_device0/cur_state" 0
+put "$ROOT/proc/acpi/button/lid/LID/state" "state:      open"
+put "$ROOT/proc/sys/kernel/random/boot_id" "5a1f0e2c-7d3b-4c8e-9f61-2b4d8a0c3e57"
+put "$ROOT/sys/class/dmi/id/product_name" 20BWS03F00
+put "$ROOT/sys/class/dmi/id/product_version" "ThinkPad T450s"
+mkdir -p "$ROOT/run" "$ROOT/var/lock"
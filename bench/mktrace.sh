@@ -0,0 +1,45 @@
+#!/bin/sh
+# Generate a synthetic thinkd trace for thinkd-replay: a laptop that is
+# docked through the working day, runs on battery mornings, lunch and
+# evenings, charges overnight and sees a loose charger blip once a day.
+#
+# usage: mktrace.sh [days] > TRACE
+
+DAYS="${1:-7}"
+
+awk -v days="$DAYS" '
+function at(h) { return int(h * 3600000) }
+function ev(t, s) { printf "%d %s\n", t, s }
+function battery(t, rate) {
+	cap += rate * 15 / 60 / 1000000 * 2
+	if (cap > 100) cap = 100
+	if (cap < 5) cap = 5
+	ev(t, sprintf("battery BAT0 %d %d %d", cap, cap * 500000, rate))
+}
+# plugged state per half hour slot of a day
+function plugged(h) {
+	return ! ((h >= 8 && h < 9) || (h >= 12.5 && h < 13.5) || (h >= 18 && h < 23))
+}
+BEGIN {
+	print "# thinkd trace 1, synthetic"
+	ev(0, "supply AC Mains 0")
+	ev(0, "supply BAT0 Battery 50000000")
+	ev(0, "online AC 1")
+	cap = 80
+	online = 1
+	for (d = 0; d < days; ++d) {
+		for (q = 0; q < 96; ++q) {
+			h = q / 4
+			t = d * at(24) + at(h)
+			if (plugged(h) != online) {
+				online = plugged(h)
+				ev(t, "online AC " online)
+			}
+			battery(t, online ? (cap < 100 ? 20000000 : 0) : -9000000)
+		}
+		# the charger slips out of the socket for three seconds
+		t = d * at(24) + at(15.25) + 20000
+		ev(t, "online AC 0")
+		ev(t + 3000, "online AC 1")
+	}
+}' | sort -n -s -k1,1
@@ -0,0 +1,329 @@
+/*
+ * Replays a trace recorded with thinkd --record against a fake sysfs tree
+ * generated by mkfakesys.sh:
+ *
+ *	thinkd-replay [-v] [-c config] ROOT TRACE
+ *
+ * The power supplies of ROOT are rewritten from the trace while the real
+ * probe loop runs on a virtual clock, so days of recording replay in well
+ * under a second. Prints the resulting mode timeline, the time spent in
+ * each mode and the writes and wakeups the policy caused.
+ *
+ * Pressure events are listed but not emulated: boosting depends on kernel
+ * triggers, the replay keeps psi_boost off.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+
+#include "void.h"
+#include "acpi.h"
+#include "conf_utils.h"
+#include "mode.h"
+#include "events.h"
+#include "psupply.h"
+#include "stats.h"
+#include "state.h"
+#include "thinkd.h"
+
+#define MAX_TRACE_LINE 256
+#define MAX_MODES 8
+#define REPLAY_SLACK_MS 1000
+
+typedef struct __mode_time {
+	const char *name;
+	uint64_t ms;
+} mode_time_t;
+
+static FILE *trace_fp;
+static char pending[MAX_TRACE_LINE];
+static uint64_t pending_ms;
+static bool trace_done, finished, seen_mode;
+static unsigned long recorded_changes, pressure_events, replayed_changes;
+static const power_prefs_t *last_mode;
+static uint64_t last_change_ms;
+static mode_time_t mode_times[MAX_MODES];
+static char config_path[MAX_SYSFS_PATH_LEN];
+static char state_path[MAX_SYSFS_PATH_LEN];
+
+static bool next_event();
+static void apply_due();
+static void apply_event(const char *event);
+static void trace_step(void *data);
+static void replay_probe(void *data);
+static void replay_end(void *data);
+static void note_mode();
+static void put(const char *supply, const char *attr, const char *format, ...)
+	THINKD_ATTR_PRINTF(3);
+
+int main(int argc, char *argv[])
+{
+	bool verbose = false, own_config = false;
+	struct timespec start, end;
+	uint64_t total_ms;
+	double real_ms;
+	int c;
+
+	while ((c = getopt(argc, argv, "c:v")) != -1) {
+		switch (c) {
+		case 'c':
+			config_file = optarg;
+			own_config = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-v] [-c config] ROOT TRACE\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind + 2 != argc) {
+		fprintf(stderr, "usage: %s [-v] [-c config] ROOT TRACE\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	sysroot = argv[optind];
+	if (! own_config) {
+		snprintf(config_path, sizeof(config_path), "%s/etc/thinkd.ini", sysroot);
+		config_file = config_path;
+	}
+	snprintf(state_path, sizeof(state_path), "%s/run/thinkd.state", sysroot);
+	state_file = state_path;
+
+	trace_fp = fopen(argv[optind + 1], "r");
+	if (! trace_fp) {
+		perror(argv[optind + 1]);
+		return EXIT_FAILURE;
+	}
+
+	if (! verbose && ! freopen("/dev/null", "w", stderr))
+		return EXIT_FAILURE;
+
+	if (mode_init() || read_ini() < 0) {
+		printf("cannot read %s\n", config_file);
+		return EXIT_FAILURE;
+	}
+	daemon_prefs.psi_boost = false;
+
+	sysroot_sprintf(pending, "%s", POWER_SUPPLY_DIRECTORY);
+	mkdir(pending, 0755);
+	unlink(state_file);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	event_set_virtual_clock(0);
+
+	/* same order as the daemon: supplies at startup, first probe, loop */
+	printf("%-14s %s\n", "time", "mode");
+	trace_done = ! next_event();
+	trace_step(NULL);
+	replay_probe(NULL);
+	while (! finished && event_dispatch() >= 0)
+		;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	note_mode();
+	total_ms = event_now_ms();
+	real_ms = (end.tv_sec - start.tv_sec) * 1000.0 +
+		  (end.tv_nsec - start.tv_nsec) / 1000000.0;
+
+	printf("\nreplayed %.1f hours in %.0fms (%.0fx real time)\n",
+	       total_ms / 3600000.0, real_ms, real_ms > 0 ? total_ms / real_ms : 0);
+	for (size_t i = 0; i < array_count(mode_times) && mode_times[i].name; ++i)
+		printf("  %-16s %6.1f%%\n", mode_times[i].name,
+		       total_ms ? mode_times[i].ms * 100.0 / total_ms : 0);
+	printf("  probes       %10" PRIu64 "\n", stats_histogram(STAT_PROBE)->count);
+	printf("  wakeups      %10" PRIu64 "\n", event_wakeups());
+	printf("  knob writes  %10" PRIu64 "\n", stats_histogram(STAT_KNOB_WRITE)->count);
+	printf("  mode changes %10lu (%lu recorded)\n", replayed_changes, recorded_changes);
+	if (pressure_events)
+		printf("  pressure     %10lu events, not emulated\n", pressure_events);
+
+	fclose(trace_fp);
+	mode_cleanup();
+	return EXIT_SUCCESS;
+}
+
+/* read the next event into `pending`, skipping comments */
+static bool next_event()
+{
+	char line[MAX_TRACE_LINE];
+
+	while (fgets(line, sizeof(line), trace_fp)) {
+		char *rest;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		pending_ms = strtoull(line, &rest, 10);
+		while (*rest == ' ')
+			++rest;
+		rest[strcspn(rest, "\n")] = '\0';
+		snprintf(pending, sizeof(pending), "%s", rest);
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Readings are stamped when the recording daemon's probe saw them, a few
+ * ms after its deadline. Apply them that much early so the replayed probe
+ * on the same deadline sees them too.
+ */
+static void apply_due()
+{
+	while (! trace_done && pending_ms <= event_now_ms() + REPLAY_SLACK_MS) {
+		apply_event(pending);
+		trace_done = ! next_event();
+	}
+}
+
+static void trace_step(void *data)
+{
+	uint64_t now = event_now_ms();
+
+	apply_due();
+
+	/* one more probe to see the final state */
+	if (trace_done)
+		event_timer_set(sleep_time * 1000, replay_end, NULL);
+	else if (pending_ms > now + REPLAY_SLACK_MS)
+		event_timer_set(pending_ms - REPLAY_SLACK_MS - now, trace_step, NULL);
+}
+
+static void replay_probe(void *data)
+{
+	apply_due();
+	detect_psupply_mode();
+	note_mode();
+	event_timer_set(sleep_time * 1000, replay_probe, NULL);
+}
+
+static void replay_end(void *data)
+{
+	finished = true;
+}
+
+static void apply_event(const char *event)
+{
+	char name[MAX_PSUPPLY_NAME], type[16];
+	long energy, rate;
+	int value, capacity;
+
+	if (sscanf(event, "supply %31s %15s %ld", name, type, &energy) == 3) {
+		sysfs_path_t path;
+
+		sysroot_sprintf(path, "%s/%s", POWER_SUPPLY_DIRECTORY, name);
+		mkdir(path, 0755);
+		put(name, "type", "%s", type);
+		if (strcmp(type, "Battery") == 0) {
+			put(name, "energy_full", "%ld", energy);
+			put(name, "energy_now", "0");
+			put(name, "capacity", "0");
+			put(name, "power_now", "0");
+			put(name, "status", "Unknown");
+			put(name, "uevent", "POWER_SUPPLY_STATUS=Unknown\n"
+			    "POWER_SUPPLY_POWER_NOW=0\nPOWER_SUPPLY_ENERGY_FULL=%ld\n"
+			    "POWER_SUPPLY_ENERGY_NOW=0\nPOWER_SUPPLY_CAPACITY=0", energy);
+		}
+		else
+			put(name, "online", "0");
+	}
+	else if (sscanf(event, "gone %31s", name) == 1) {
+		const char *attrs[] = {
+			"type", "online", "energy_full", "energy_now",
+			"capacity", "power_now", "status", "uevent",
+		};
+		sysfs_path_t path;
+
+		for (size_t i = 0; i < array_count(attrs); ++i) {
+			sysroot_sprintf(path, "%s/%s/%s", POWER_SUPPLY_DIRECTORY,
+					name, attrs[i]);
+			unlink(path);
+		}
+		sysroot_sprintf(path, "%s/%s", POWER_SUPPLY_DIRECTORY, name);
+		rmdir(path);
+	}
+	else if (sscanf(event, "online %31s %d", name, &value) == 2)
+		put(name, "online", "%d", value);
+	else if (sscanf(event, "battery %31s %d %ld %ld", name, &capacity,
+			&energy, &rate) == 4) {
+		put(name, "capacity", "%d", capacity);
+		put(name, "energy_now", "%ld", energy);
+		put(name, "power_now", "%ld", rate < 0 ? -rate : rate);
+		put(name, "status", "%s", rate < 0 ? "Discharging" :
+		    rate > 0 ? "Charging" : "Full");
+		/* what the batteries are actually read from, in one go */
+		put(name, "uevent", "POWER_SUPPLY_STATUS=%s\nPOWER_SUPPLY_POWER_NOW=%ld\n"
+		    "POWER_SUPPLY_ENERGY_NOW=%ld\nPOWER_SUPPLY_CAPACITY=%d",
+		    rate < 0 ? "Discharging" : rate > 0 ? "Charging" : "Full",
+		    rate < 0 ? -rate : rate, energy, capacity);
+	}
+	else if (strncmp(event, "mode ", 5) == 0) {
+		/* the first one is the mode applied at startup */
+		if (seen_mode)
+			++recorded_changes;
+		seen_mode = true;
+	}
+	else if (strncmp(event, "pressure ", 9) == 0)
+		++pressure_events;
+	else
+		fprintf(stderr, "unknown trace event \"%s\"\n", event);
+}
+
+/* extend the timeline when the last probe switched modes */
+static void note_mode()
+{
+	uint64_t now = event_now_ms();
+	mode_time_t *slot = NULL;
+
+	if (last_mode) {
+		const char *name = mode_name(last_mode);
+
+		for (size_t i = 0; i < array_count(mode_times) && ! slot; ++i) {
+			if (! mode_times[i].name || mode_times[i].name == name)
+				slot = &mode_times[i];
+		}
+		if (slot) {
+			slot->name = name;
+			slot->ms += now - last_change_ms;
+		}
+	}
+	last_change_ms = now;
+
+	if (current_mode == last_mode)
+		return;
+
+	printf("%3" PRIu64 "d %02" PRIu64 ":%02" PRIu64 ":%02" PRIu64 "  %s\n",
+	       now / 86400000, now / 3600000 % 24, now / 60000 % 60,
+	       now / 1000 % 60, mode_name(current_mode));
+	last_mode = current_mode;
+	if (now)
+		++replayed_changes;
+}
+
+static void put(const char *supply, const char *attr, const char *format, ...)
+{
+	sysfs_path_t path;
+	va_list args;
+	FILE *fp;
+
+	sysroot_sprintf(path, "%s/%s/%s", POWER_SUPPLY_DIRECTORY, supply, attr);
+	if (! (fp = fopen(path, "w")))
+		return;
+
+	va_start(args, format);
+	vfprintf(fp, format, args);
+	va_end(args);
+	fputc('\n', fp);
+	fclose(fp);
+}
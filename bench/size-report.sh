@@ -0,0 +1,52 @@
+#!/bin/sh
+# Compare thinkd builds: file size, sections, linking, and the memory each
+# one settles at when run for a while against the same fake sysfs tree.
+#
+# usage: size-report.sh DIR BINARY...
+
+set -e
+
+DIR="$1"
+BENCHDIR="$(dirname "$0")"
+CONFIG="$BENCHDIR/../thinkd.ini"
+RUN_SECONDS="${RUN_SECONDS:-3}"
+
+if [ -z "$DIR" ] || [ $# -lt 2 ]; then
+	echo "usage: $0 DIR BINARY..." >&2
+	exit 1
+fi
+shift
+
+sh "$BENCHDIR/mkfakesys.sh" "$DIR" 2 1 3
+DIR="$(cd "$DIR" && pwd)"
+mkdir -p "$DIR/etc" "$DIR/run"
+cp "$CONFIG" "$DIR/etc/thinkd.ini"
+
+# field of /proc/PID/status, in kB
+status() {
+	awk -v key="$2:" '$1 == key { print $2 }' "/proc/$1/status"
+}
+
+printf '%-24s %9s %9s %7s %7s %8s %7s %7s\n' binary bytes text data bss linking \
+	"rss kB" "hwm kB"
+for bin in "$@"; do
+	set -- $(size "$bin" | awk 'NR == 2 { print $1, $2, $3 }')
+	if readelf -l "$bin" | grep -q INTERP; then
+		linking=dynamic
+	else
+		linking=static
+	fi
+
+	rm -f "$DIR/run/"*
+	"$bin" -f -r "$DIR" -c "$DIR/etc/thinkd.ini" -s "$DIR/run/thinkd.state" \
+		-S "$DIR/run/thinkd.socket" > "$DIR/run/log" 2>&1 &
+	pid=$!
+	sleep "$RUN_SECONDS"
+	rss=$(status $pid VmRSS)
+	hwm=$(status $pid VmHWM)
+	kill $pid
+	wait $pid 2>/dev/null || true
+
+	printf '%-24s %9d %9d %7d %7d %8s %7s %7s\n' "$bin" "$(wc -c < "$bin")" \
+		"$1" "$2" "$3" $linking "$rss" "$hwm"
+done
@@ -1,247 +1,713 @@
+#define _GNU_SOURCE 1
+
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <dirent.h>
-#include <glob.h>
 #include <stdarg.h>
 
 #include "void.h"
 #include "acpi.h"
 #include "logger.h"
-
-#define POWER_SUPPLY_DIRECTORY "/sys/class/power_supply"
-#define BACKLIGHT_DIRECTORY "/sys/class/backlight/acpi_video0"
-#define HDA_INTEL_DIR "/sys/module/snd_hda_intel/"
-#define AC97_DIR "/sys/module/snd_ac97_codec/"
+#include "stats.h"
+#include "state.h"
+#include "rfkill.h"
+#include "gpu.h"
+#include "cgroup.h"
+#include "usdt.h"
+
+#define AC97_DIR "/sys/module/snd_ac97_codec"
+#define MAX_RFKILL_DEVICES 16
+#define MAX_KNOB_HANDLES 48
+#define DIRENT_BUFFER_SIZE 4096
+
+typedef void (*knob_encoder_t)(const char *target, unsigned int value);
+
+typedef struct __knob_writer {
+	const char *target;
+	knob_encoder_t encode;
+} knob_writer_t;
+
+/* a knob file kept open for writing */
+typedef struct __knob_handle {
+	sysfs_path_t path;
+	knob_id_t knob;
+	int fd;
+} knob_handle_t;
+
+#if WITH_RADIO_KNOBS
+typedef struct __rfkill_device {
+	sysfs_value_t type;
+	sysfs_path_t state_path;
+} rfkill_device_t;
+#endif
+
+const char *sysroot = "";
 
 static int pprintf(const char *path, const char *format, ...) THINKD_ATTR_PRINTF(2);
-static void set_audio_state(audio_type_t type, const power_prefs_t *prefs);
-static void set_rfkill_devices(const power_prefs_t *prefs);
+static void encode_backlight(const char *target, unsigned int value);
+static void encode_on_off(const char *target, unsigned int value);
+static void encode_int(const char *target, unsigned int value);
+static void encode_mute(const char *target, unsigned int value);
+static void encode_hda_powersave(const char *target, unsigned int value);
+#if WITH_RADIO_KNOBS
+static void encode_rfkill(const char *target, unsigned int value);
+static void rfkill_scan();
+static int rfkill_add(int dirfd, const char *name, void *data);
+#endif
+#if WITH_GPU_KNOBS
+static void encode_amdgpu_level(const char *target, unsigned int value);
+static void encode_amdgpu_profile(const char *target, unsigned int value);
+static void encode_i915_freq(const char *target, unsigned int value);
+#endif
+#if WITH_CGROUP_KNOBS
+static void encode_cgroup_weight(const char *target, unsigned int value);
+static void encode_cgroup_max(const char *target, unsigned int value);
+static void encode_cgroup_cpuset(const char *target, unsigned int value);
+static void cgroup_write(const char *target, const char *value);
+#endif
+static int backlight_find(int dirfd, const char *name, void *data);
+static void knob_open(const char *path);
+static int knob_handle(const char *path);
+static void knob_handle_drop(int fd);
+static void knobs_close_handles(knob_mask_t knobs);
+
+/* where and how each knob is written, generated from KNOB_LIST */
+static const knob_writer_t knob_writers[KNOB_COUNT] = {
+#define KNOB_WRITER(id, key, type, group, target, encoder) \
+	[KNOB_##id] = { target, encoder },
+	KNOB_LIST(KNOB_WRITER)
+#undef KNOB_WRITER
+};
+
+/* what the knobs were last set to, for those in applied_known */
+static power_prefs_t applied;
+static knob_mask_t applied_known;
+#if WITH_RADIO_KNOBS
+static rfkill_device_t rfkill_devices[MAX_RFKILL_DEVICES];
+static int rfkill_count = -1;
+#endif
+
+/* what knobs_probe() found: the knobs with something to write, their handles */
+static knob_mask_t knobs_present = KNOB_MASK_ALL;
+static bool knobs_probed;
+static knob_handle_t knob_handles[MAX_KNOB_HANDLES];
+static int knob_errors[KNOB_COUNT];
+static bool probing;
+static knob_id_t probing_knob;
+static sysfs_path_t brightness_path;
+static int max_brightness;
+
+int sysfs_read_int(const char *path)
+{
+	sysfs_value_t buffer;
+
+	if (! sysfs_read_str(buffer, sizeof(buffer), path))
+		return 0;
+
+	return (int) strtol(buffer, NULL, 10);
+}
+
+/* read() into the caller's buffer, stdio would malloc a FILE per call */
+char *sysfs_read_str(char * dest, size_t len, const char *path)
+{
+	if (sysfs_read_str_at(AT_FDCWD, path, dest, len) < 0) {
+		thinkd_log(LOG_ERR, "open: %d (%s). File: %s", errno, strerror(errno), path);
+		stats_error(path);
+		return NULL;
+	}
+
+	return dest;
+}
+
+/*
+ * Read a single attribute relative to a directory handle. Returns the
+ * length read or -1 with errno set; logging is left to the caller since
+ * a missing attribute is often expected.
+ */
+int sysfs_read_str_at(int dirfd, const char *name, char *dest, size_t len)
+{
+	ssize_t nread;
+	int fd;
+	STATS_START(start);
+
+	fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	nread = read(fd, dest, len - 1);
+	close(fd);
+	if (nread < 0)
+		return -1;
+
+	/* strip newline */
+	while (nread && dest[nread - 1] == '\n')
+		--nread;
+	dest[nread] = '\0';
 
-int scan_power_supply(acpi_psupply_t *dest)
+	STATS_END(STAT_SYSFS_READ, start);
+	return (int) nread;
+}
+
+int sysfs_read_long_at(int dirfd, const char *name, long *value)
 {
-	int batt_count = 0;
-	sysfs_path_t psup_path;
-	char *name;
-	DIR *psup_dir;
-	struct dirent *psup_entry;
+	sysfs_value_t buffer;
+	char *end;
 
-	psup_dir = opendir(POWER_SUPPLY_DIRECTORY);
-	if (! psup_dir) {
-		thinkd_log(LOG_ERR, "can't open power supply dir");
+	if (sysfs_read_str_at(dirfd, name, buffer, sizeof(buffer)) < 0)
+		return -1;
+
+	errno = 0;
+	*value = strtol(buffer, &end, 10);
+	if (end == buffer || errno) {
+		errno = errno ? errno : EINVAL;
 		return -1;
 	}
 
-	while ((psup_entry = readdir(psup_dir))) {
-		sysfs_value_t tmp_type; /* either Mains or Battery */
-		name = psup_entry->d_name;
+	return 0;
+}
 
-		/* skip .. and . */
-		if (! strncmp(".", name, 1) || ! strncmp("..", name, 2))
-			continue;
+/*
+ * Call `cb` for every entry of a directory but . and .., stopping early
+ * when it returns non-zero. The entries are read with getdents64() into a
+ * stack buffer, opendir() would allocate a DIR and its buffer each time.
+ */
+int sysfs_foreach_entry(const char *path, dir_entry_cb cb, void *data)
+{
+	char buffer[DIRENT_BUFFER_SIZE] __attribute__((aligned(8)));
+	ssize_t nread;
+	int fd, stop = 0;
 
-		sysfs_sprintf(psup_path, "%s/%s/type", POWER_SUPPLY_DIRECTORY, name);
-		sysfs_gets(tmp_type, psup_path);
-		
-		if (strncmp("Battery", tmp_type, 7) == 0) {
-			sprintf(dest->batteries[batt_count],
-				POWER_SUPPLY_DIRECTORY "/%s", name);
-			++batt_count;
-			if (batt_count == MAX_BATTERIES)
-				break;
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	while (! stop && (nread = getdents64(fd, buffer, sizeof(buffer))) > 0) {
+		for (ssize_t off = 0; ! stop && off < nread;) {
+			struct dirent64 *entry = (struct dirent64 *) (buffer + off);
+
+			off += entry->d_reclen;
+			if (strcmp(entry->d_name, ".") == 0 ||
+			    strcmp(entry->d_name, "..") == 0)
+				continue;
+			stop = cb(fd, entry->d_name, data);
 		}
-		else if (strncmp("Mains", tmp_type, 5) == 0) {
-			sprintf(dest->acdir,
-				POWER_SUPPLY_DIRECTORY "/%s", name);
-		}		
 	}
 
-	closedir(psup_dir);
+	close(fd);
+	return nread < 0 && ! stop ? -1 : 0;
+}
 
-	return batt_count;
+void load_power_mode(const power_prefs_t *prefs)
+{
+	load_power_knobs(prefs, KNOBS_ALL);
 }
 
-int sysfs_read_int(const char *path)
+/*
+ * Write the knobs of `groups` that differ from what was last written, or
+ * weren't written yet. Visible knobs are cheap and noticed by the user,
+ * the deferred ones wake up or reset devices.
+ */
+void load_power_knobs(const power_prefs_t *prefs, unsigned int groups)
 {
-	int result;
-	FILE *fp;
+	knob_mask_t dirty = knobs_diff(prefs, &applied) | ~applied_known;
+	STATS_START(start);
+
+	dirty &= knobs_in_groups(groups);
+#if WITH_RADIO_KNOBS
+	rfkill_count = -1;
+#endif
+	if (! knobs_probed)
+		knobs_probe(KNOB_MASK_ALL);
+
+	while (dirty) {
+		knob_id_t id = __builtin_ctz(dirty);
+		unsigned int value = knob_get(prefs, id);
+
+		dirty &= dirty - 1;
+		/* knobs this machine doesn't have count as applied */
+		if (knobs_present & (1u << id)) {
+			USDT3(knob_start, id, knob_layout[id].key, value);
+			knob_writers[id].encode(knob_writers[id].target, value);
+			USDT2(knob_end, id, knob_layout[id].key);
+		}
+		knob_set(&applied, id, value);
+		applied_known |= 1u << id;
+	}
+	STATS_END(STAT_LOAD_MODE, start);
+}
 
-	fp = fopen(path, "r");
-	if (! fp) {
-		thinkd_log(LOG_ERR, "fopen: %d (%s)", errno, strerror(errno));
-		return 0;
+/* the next load writes every knob, e.g. after a reload or on startup */
+void knobs_forget()
+{
+	applied_known = 0;
+}
+
+/* the knobs are known to hold `prefs` already, like after a restart */
+void knobs_assume(const power_prefs_t *prefs)
+{
+	memcpy(&applied, prefs, sizeof(struct __power_prefs));
+	applied_known = KNOB_MASK_ALL;
+}
+
+bool knobs_known()
+{
+	return applied_known == KNOB_MASK_ALL;
+}
+
+/*
+ * Find out which of `knobs` exist and can be written, keeping their files
+ * open. The encoders are run without writing anything: each file they
+ * would write is opened instead, and a knob with none is left out of
+ * every load until it is probed again. Knobs that just appeared are
+ * written by the next load.
+ */
+void knobs_probe(knob_mask_t knobs)
+{
+	knob_mask_t before = knobs_present;
+
+	knobs_close_handles(knobs);
+	knobs_present &= ~knobs;
+	probing = true;
+	for (knob_id_t id = 0; id < KNOB_COUNT; ++id) {
+		if (! (knobs & (1u << id)))
+			continue;
+		probing_knob = id;
+		knob_errors[id] = ENOENT;
+		knob_writers[id].encode(knob_writers[id].target, 1);
 	}
+	probing = false;
 
-	if (! fscanf(fp, "%d", &result))
-		LOG_SIMPLE_ERR("fscanf");
-		
-	fclose(fp);
-	
-	return result;
+	applied_known &= ~(knobs_present & ~before);
+	for (knob_id_t id = 0; knobs_probed && id < KNOB_COUNT; ++id) {
+		if ((knobs_present ^ before) & (1u << id))
+			thinkd_log(LOG_INFO, "%s: %s", knob_layout[id].key,
+				   knobs_present & (1u << id) ? "appeared" : "went away");
+	}
+	knobs_probed = true;
 }
 
-char *sysfs_read_str(char * dest, size_t len, const char *path)
+/* knobs to probe again on a rescan, in case their driver was loaded since */
+knob_mask_t knobs_missing()
 {
-	FILE *fp;
-	char *pch;
-	
-	fp = fopen(path, "r");
-	if (! fp) {
-		thinkd_log(LOG_ERR, "fopen: %d (%s). File: %s", errno, strerror(errno), path);
-		return NULL;
+	return KNOB_MASK_ALL & ~knobs_present;
+}
+
+/* every knob with the files it writes, or why it can't be */
+void knobs_report(FILE *fp)
+{
+	for (knob_id_t id = 0; id < KNOB_COUNT; ++id) {
+		const char *key = knob_layout[id].key;
+		bool files = false;
+
+		if (! (knobs_present & (1u << id))) {
+			fprintf(fp, "%-24s -  %s\n", key, knob_errors[id] == ENOENT ?
+				"not found" : strerror(knob_errors[id]));
+			continue;
+		}
+
+		for (knob_handle_t *h = knob_handles; h < knob_handles + MAX_KNOB_HANDLES; ++h) {
+			if (h->path[0] && h->knob == id) {
+				fprintf(fp, "%-24s %s  %s\n", files ? "" : key, files ? " " : "+",
+					h->path);
+				files = true;
+			}
+		}
+		if (! files)
+			fprintf(fp, "%-24s +  %s\n", key, knob_writers[id].target);
 	}
+}
+
+void knobs_close()
+{
+	knobs_close_handles(KNOB_MASK_ALL);
+	knobs_present = KNOB_MASK_ALL;
+	knobs_probed = false;
+}
 
-	if (! fgets(dest, len, fp)) {
-		LOG_SIMPLE_ERR("fgets");		
-		goto clean;
+/*
+ * target is a directory holding brightness and max_brightness, or else
+ * the first backlight of its class. Both are looked up when probing.
+ */
+static void encode_backlight(const char *target, unsigned int value)
+{
+	if (probing) {
+		sysfs_path_t path, class_dir;
+		long max;
+
+		max_brightness = 0;
+		sysroot_sprintf(path, "%s/max_brightness", target);
+		if (sysfs_read_long_at(AT_FDCWD, path, &max) == 0 && max > 0) {
+			sysroot_sprintf(brightness_path, "%s/brightness", target);
+			max_brightness = (int) max;
+		}
+		else {
+			sysroot_sprintf(class_dir, "%s", target);
+			*strrchr(class_dir, '/') = '\0';
+			sysfs_foreach_entry(class_dir, backlight_find, class_dir);
+		}
 	}
-	
-	/* strip newline */
-	pch = strchr(dest, '\n');
-	if (pch)
-		*pch = '\0';
 
-clean:
-	fclose(fp);	
-	return dest;
+	/* no backlight, or an unreadable one */
+	if (max_brightness <= 0)
+		return;
+
+	pprintf(brightness_path, "%d", (int) value * max_brightness / 100);
+}
+
+static void encode_on_off(const char *target, unsigned int value)
+{
+	sysfs_path_t path;
+
+	sysroot_sprintf(path, "%s", target);
+	pprintf(path, "%s", value ? "on" : "off");
 }
 
-void set_nmi_watchdog(bool state)
+static void encode_int(const char *target, unsigned int value)
 {
-	const char *nmi_path = "/proc/sys/kernel/nmi_watchdog";
-	pprintf(nmi_path, "%u", (unsigned int) state);
+	sysfs_path_t path;
+
+	sysroot_sprintf(path, "%s", target);
+	pprintf(path, "%u", value);
+}
+
+static void encode_mute(const char *target, unsigned int value)
+{
+	sysfs_path_t path;
+
+	sysroot_sprintf(path, "%s", target);
+	pprintf(path, "%s", value ? "mute" : "unmute");
 }
 
-void set_audio_powersaving(const power_prefs_t *prefs)
+/* target is the parameters directory of snd_hda_intel */
+static void encode_hda_powersave(const char *target, unsigned int value)
 {
-	DIR *dir;
+	sysfs_path_t path;
 
-	dir = opendir(HDA_INTEL_DIR);
-	if (dir) {
-		set_audio_state(HDA_INTEL, prefs);
-		closedir(dir);
+	sysroot_sprintf(path, "%s", target);
+	if (access(path, F_OK) < 0) {
+		sysroot_sprintf(path, "%s", AC97_DIR);
+		if (access(path, F_OK) == 0)
+			thinkd_log(LOG_INFO, "AC97 powersaving not supported");
+		return;
 	}
-	else if ((dir = opendir(AC97_DIR))) {
-		set_audio_state(AC97, prefs);
-		closedir(dir);
+
+	sysroot_sprintf(path, "%s/power_save_controller", target);
+	pprintf(path, "%c", value ? 'Y' : 'N');
+	sysroot_sprintf(path, "%s/power_save", target);
+	pprintf(path, "%d", value ? 1 : 0);
+}
+
+#if WITH_RADIO_KNOBS
+/*
+ * target is an rfkill type: one write to /dev/rfkill switches them all,
+ * the state files of each device are the fallback
+ */
+static void encode_rfkill(const char *target, unsigned int value)
+{
+	/* rescanned on every probe, so a dongle plugged in later is found
+	   when knobs_missing() asks again */
+	if (probing) {
+		rfkill_scan();
+		for (int i = 0; i < rfkill_count; ++i) {
+			if (strcmp(rfkill_devices[i].type, target) == 0) {
+				knobs_present |= 1u << probing_knob;
+				break;
+			}
+		}
+		return;
+	}
+
+	if (rfkill_set(target, value) == 0)
+		return;
+
+	if (rfkill_count < 0)
+		rfkill_scan();
+
+	for (int i = 0; i < rfkill_count; ++i) {
+		if (strcmp(rfkill_devices[i].type, target) == 0)
+			pprintf(rfkill_devices[i].state_path, "%u", value);
 	}
 }
+#endif /* WITH_RADIO_KNOBS */
+
+#if WITH_GPU_KNOBS
+/* target is relative to the amdgpu card, a zero level leaves it */
+static void encode_amdgpu_level(const char *target, unsigned int value)
+{
+	const char *card = gpu_card(GPU_AMDGPU);
+	sysfs_path_t path;
+
+	if (! card || ! value)
+		return;
+
+	sysfs_sprintf(path, "%s/%s", card, target);
+	pprintf(path, "%s", gpu_level_names[value]);
+}
+
+/* only taken while the level is manual, which is left to the config */
+static void encode_amdgpu_profile(const char *target, unsigned int value)
+{
+	const char *card = gpu_card(GPU_AMDGPU);
+	sysfs_path_t path;
+
+	if (! card || ! value)
+		return;
+
+	sysfs_sprintf(path, "%s/%s", card, target);
+	pprintf(path, "%u", value - 1);
+}
 
-static void set_rfkill_devices(const power_prefs_t *prefs)
+/*
+ * target is one of the gt_*_freq_mhz files of the i915 card. The driver
+ * refuses a minimum above the maximum and the other way round, so the
+ * opposite bound is moved out of the way first; when both change the
+ * other knob sets it to its real value right after.
+ */
+static void encode_i915_freq(const char *target, unsigned int value)
 {
-	const char *RFKILL_DIR = STANDARD_RFKILL_DIR;
-	sysfs_path_t rfkill_paths;
-	glob_t glob_buf;
+	const char *card = gpu_card(GPU_I915);
+	sysfs_path_t path;
+	int bound;
 
-	/* use glob to search for bluetooth rfkill */
-	sysfs_sprintf(rfkill_paths, "%s/rfkill?", RFKILL_DIR);
-	if (! glob(rfkill_paths, 0, NULL, &glob_buf) == 0) {
-		LOG_SIMPLE_ERR("glob");
+	if (! card || ! value)
 		return;
+
+	if (strcmp(target, "gt_min_freq_mhz") == 0) {
+		sysfs_sprintf(path, "%s/gt_max_freq_mhz", card);
+		if ((bound = sysfs_read_int(path)) > 0 && (int) value > bound)
+			pprintf(path, "%u", value);
 	}
-		
-	for (char **p = glob_buf.gl_pathv; *p; ++p) {
-		sysfs_path_t rf_state_path, rf_name_path;
-		sysfs_value_t name;
-
-		sysfs_sprintf(rf_name_path, "%s/%s", *p, "name");
-		sysfs_sprintf(rf_state_path, "%s/%s", *p, "state");
-		sysfs_gets(name, rf_name_path);
-		
-		if (strcmp(name, "tpacpi_bluetooth_sw") == 0) 
-			pprintf(rf_state_path, "%d", (int) prefs->bluetooth);
-		else if (strcmp(name, "tpacpi_wwan_sw") == 0) 
-			pprintf(rf_state_path, "%d", (int) prefs->wwan);
-		else {
-			/* Check if this is actually wifi */
-			pprintf(rf_state_path, "%d", (int) prefs->wireless);
-		}
+	else if (strcmp(target, "gt_max_freq_mhz") == 0) {
+		sysfs_sprintf(path, "%s/gt_min_freq_mhz", card);
+		if ((bound = sysfs_read_int(path)) > 0 && (int) value < bound)
+			pprintf(path, "%u", value);
 	}
-	
-	globfree(&glob_buf);
+
+	sysfs_sprintf(path, "%s/%s", card, target);
+	pprintf(path, "%u", value);
+}
+#endif /* WITH_GPU_KNOBS */
+
+#if WITH_CGROUP_KNOBS
+/* 0 restores the kernel's default weight */
+static void encode_cgroup_weight(const char *target, unsigned int value)
+{
+	char weight[16];
+
+	snprintf(weight, sizeof(weight), "%u", value ? value : CGROUP_DEFAULT_WEIGHT);
+	cgroup_write(target, weight);
 }
 
-static void set_audio_state(audio_type_t type, const power_prefs_t *prefs)
+/* a percentage of all cpus; 0 or 100 lifts the limit */
+static void encode_cgroup_max(const char *target, unsigned int value)
 {
-	const char *MUTE_ON = "mute";
-	const char *MUTE_OFF = "unmute";
-	const char *BASE_ACPI_PATH = THINKPAD_PROC_ACPI_DIR;
-	sysfs_path_t mute_path;
-	int state = prefs->audio_powersave;
-	
-	switch (type) {
-	case HDA_INTEL: {
-		const char *PATH_FORMAT = "%s/parameters/%s";
-		const char *BASE_PATH = HDA_INTEL_DIR;
-		sysfs_path_t ps_path_c, ps_path;
-		
-		sysfs_sprintf(ps_path_c, PATH_FORMAT, BASE_PATH, "power_save_controller");
-		sysfs_sprintf(ps_path, PATH_FORMAT, BASE_PATH, "power_save");
-		pprintf(ps_path_c, "%c", state ? 'Y' : 'N');
-		pprintf(ps_path, "%d", state ? 1 : 0);
-		break;
+	char max[32];
+
+	if (! value || value >= 100)
+		snprintf(max, sizeof(max), "max %d", CGROUP_CPU_PERIOD);
+	else
+		snprintf(max, sizeof(max), "%ld %d", (long) value * cgroup_cpus() *
+			 CGROUP_CPU_PERIOD / 100, CGROUP_CPU_PERIOD);
+	cgroup_write(target, max);
+}
+
+/* an empty cpuset.cpus uses whatever the parent has */
+static void encode_cgroup_cpuset(const char *target, unsigned int value)
+{
+	const char *cpus = cgroup_efficiency_cpus();
+
+	if (value && ! cpus[0])
+		return;
+
+	cgroup_write(target, value ? cpus : "\n");
+}
+
+/*
+ * Every value goes to each slice in a single write(), which the kernel
+ * applies as a whole, so a cgroup never sees half a quota or cpu list.
+ */
+static void cgroup_write(const char *target, const char *value)
+{
+	const char *cursor = daemon_prefs.cgroup_slices;
+	sysfs_path_t path;
+
+	while (cgroup_next(&cursor, target, path))
+		pprintf(path, "%s", value);
+}
+#endif /* WITH_CGROUP_KNOBS */
+
+static int backlight_find(int dirfd, const char *name, void *data)
+{
+	const char *class_dir = data;
+	sysfs_path_t max_path;
+	long max;
+
+	sysfs_sprintf(max_path, "%s/max_brightness", name);
+	if (sysfs_read_long_at(dirfd, max_path, &max) < 0 || max <= 0)
+		return 0;
+
+	sysfs_sprintf(brightness_path, "%s/%s/brightness", class_dir, name);
+	max_brightness = (int) max;
+	return 1;
+}
+
+/* while probing, keep `path` open for the knob being probed */
+static void knob_open(const char *path)
+{
+	knob_handle_t *slot = NULL;
+	int fd;
+
+	for (knob_handle_t *h = knob_handles; h < knob_handles + MAX_KNOB_HANDLES; ++h) {
+		if (h->path[0] && strcmp(h->path, path) == 0)
+			return;
+		if (! h->path[0] && ! slot)
+			slot = h;
+	}
+
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		knob_errors[probing_knob] = errno;
+		return;
 	}
-	case AC97:
-		thinkd_log(LOG_INFO, "AC97 powersaving not supported");
-		break;
 
-	default:
-		thinkd_log(LOG_ERR, "not found: %d", (int) type);
-		break;
+	knobs_present |= 1u << probing_knob;
+	/* without a free slot the file is opened on every write */
+	if (! slot) {
+		close(fd);
+		return;
 	}
 
-	/* unmute or mute sound */
-	sysfs_sprintf(mute_path, "%s/%s", BASE_ACPI_PATH, "volume");
-	pprintf(mute_path, "%s", prefs->mute_state ? MUTE_ON : MUTE_OFF);
+	snprintf(slot->path, sizeof(slot->path), "%s", path);
+	slot->knob = probing_knob;
+	slot->fd = fd;
 }
 
-void load_power_mode(const power_prefs_t *prefs)
+static int knob_handle(const char *path)
 {
-	const char *BASE_ACPI_PROC = THINKPAD_PROC_ACPI_DIR;
-	const int VAL_SIZ = 256;
-	char buffer[VAL_SIZ];
-	int max_brightness, brightness_adjust;
+	for (knob_handle_t *h = knob_handles; h < knob_handles + MAX_KNOB_HANDLES; ++h) {
+		if (h->path[0] && strcmp(h->path, path) == 0)
+			return h->fd;
+	}
 
-	/* set brightness */
-	snprintf(buffer, VAL_SIZ, BACKLIGHT_DIRECTORY "/max_brightness");
-	max_brightness = sysfs_read_int(buffer);
+	return -1;
+}
 
-	brightness_adjust = prefs->brightness / (100 / max_brightness);
-	if (brightness_adjust < 0)
-		brightness_adjust = 0;
-	else if (brightness_adjust > max_brightness)
-		brightness_adjust = max_brightness;
+static void knob_handle_drop(int fd)
+{
+	for (knob_handle_t *h = knob_handles; h < knob_handles + MAX_KNOB_HANDLES; ++h) {
+		if (h->path[0] && h->fd == fd)
+			h->path[0] = '\0';
+	}
+	close(fd);
+}
 
-	snprintf(buffer, VAL_SIZ, BACKLIGHT_DIRECTORY "/brightness");
-	pprintf(buffer, "%d", brightness_adjust);
+static void knobs_close_handles(knob_mask_t knobs)
+{
+	for (knob_handle_t *h = knob_handles; h < knob_handles + MAX_KNOB_HANDLES; ++h) {
+		if (h->path[0] && knobs & (1u << h->knob)) {
+			close(h->fd);
+			h->path[0] = '\0';
+		}
+	}
+}
 
-	/* set nmi_watchdog */
-	set_nmi_watchdog(prefs->nmi_watchdog);
-	set_audio_powersaving(prefs);
-	set_rfkill_devices(prefs);
+#if WITH_RADIO_KNOBS
+/* once per load, and only when /dev/rfkill is missing */
+static void rfkill_scan()
+{
+	sysfs_path_t rfkill_dir;
 
-	snprintf(buffer, VAL_SIZ, "%s/%s", BASE_ACPI_PROC, "light");
-	pprintf(buffer, "%s", prefs->thinklight_state ? "on" : "off");
+	rfkill_count = 0;
+	sysroot_sprintf(rfkill_dir, "%s", STANDARD_RFKILL_DIR);
+	if (sysfs_foreach_entry(rfkill_dir, rfkill_add, rfkill_dir) < 0)
+		LOG_SIMPLE_ERR("rfkill scan");
 }
 
+static int rfkill_add(int dirfd, const char *name, void *data)
+{
+	const char *rfkill_dir = data;
+	rfkill_device_t *dev = &rfkill_devices[rfkill_count];
+	sysfs_path_t rf_type_path;
+
+	if (strncmp(name, "rfkill", 6) != 0)
+		return 0;
+
+	if (rfkill_count == MAX_RFKILL_DEVICES) {
+		thinkd_log(LOG_ERR, "more than %d rfkill devices, ignoring %s",
+			   MAX_RFKILL_DEVICES, name);
+		return 1;
+	}
+
+	sysfs_sprintf(rf_type_path, "%s/%s", name, "type");
+	if (sysfs_read_str_at(dirfd, rf_type_path, dev->type, sizeof(dev->type)) < 0)
+		return 0;
+	sysfs_sprintf(dev->state_path, "%s/%s/%s", rfkill_dir, name, "state");
+	++rfkill_count;
+	return 0;
+}
+#endif /* WITH_RADIO_KNOBS */
+
+/*
+ * Format into a local buffer and hand it to the kernel in a single write(),
+ * sysfs attributes take their whole value in one store anyway. Knob files
+ * go through the handle kept open since the probe, anything else is
+ * opened for the write. While probing nothing is written.
+ */
 static int pprintf(const char *path, const char *format, ...)
 {
+	char buffer[MAX_SYSFS_STR_LEN];
 	va_list args;
-	FILE *fp;
-	int ret;
-	
-	fp = fopen(path, "w");
-	if (! fp) {
-		thinkd_log(LOG_ERR, "while opening %s", path);
-		LOG_SIMPLE_ERR("fopen");
+	ssize_t written = -1;
+	int fd, len;
+	STATS_START(start);
+
+	if (probing) {
+		knob_open(path);
 		return 0;
 	}
 
 	va_start(args, format);
-	ret = vfprintf(fp, format, args);
-	fclose(fp);
-
+	len = vsnprintf(buffer, sizeof(buffer), format, args);
 	va_end(args);
-	return ret;
+	if (len < 0 || len >= (int) sizeof(buffer))
+		return 0;
+
+	USDT2(sysfs_write, path, buffer);
+	if ((fd = knob_handle(path)) >= 0) {
+		written = pwrite(fd, buffer, len, 0);
+		/* the device went away underneath the handle, try the path */
+		if (written < 0 && errno != EINVAL) {
+			knob_handle_drop(fd);
+			fd = -1;
+		}
+	}
+
+	if (fd < 0) {
+		fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+		if (fd < 0) {
+			thinkd_log(LOG_ERR, "while opening %s", path);
+			LOG_SIMPLE_ERR("open");
+			stats_error(path);
+			return 0;
+		}
+		written = write(fd, buffer, len);
+		close(fd);
+	}
+
+	if (written != len) {
+		/* sysfs reports rejected values from the store */
+		thinkd_log(LOG_ERR, "while writing %s", path);
+		LOG_SIMPLE_ERR("write");
+		stats_error(path);
+		len = 0;
+	}
+	else
+		state_journal_record(path, buffer);
+
+	STATS_END(STAT_KNOB_WRITE, start);
+	return len;
 }
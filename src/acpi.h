@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 #include "conf_utils.h"
 
@@ -14,8 +15,8 @@
 #define MAX_SYSFS_PATH_LEN 512
 #define MAX_PROCFS_PATH_LEN MAX_SYSFS_PATH_LEN
 #define MAX_PROCFS_STR_LEN MAX_SYSFS_STR_LEN
-#define MAX_POW_SUPPLY_PATH 128
-#define MAX_BATTERIES 2
+#define sysroot_sprintf(str, format, ...) \
+	snprintf(str, MAX_SYSFS_PATH_LEN, "%s" format, sysroot, __VA_ARGS__)
 #define sysfs_sprintf(str, format, ...) \
 	snprintf(str, MAX_SYSFS_PATH_LEN, format, __VA_ARGS__)
 #define procfs_sprintf(str, format, ...) \
@@ -23,25 +24,30 @@
 #define sysfs_gets(dest, path) \
 	sysfs_read_str(dest, MAX_SYSFS_PATH_LEN, path)
 
-typedef enum __audio_type {
-	HDA_INTEL,
-	AC97,
-} audio_type_t;
-
 typedef char sysfs_value_t[MAX_SYSFS_STR_LEN];
 typedef char procfs_value_t[MAX_PROCFS_STR_LEN];
 typedef char sysfs_path_t[MAX_SYSFS_PATH_LEN];
 typedef char procfs_path_t[MAX_PROCFS_PATH_LEN];
-typedef struct __acpi_psupply {
-	char batteries[MAX_BATTERIES][MAX_POW_SUPPLY_PATH];
-	char acdir[MAX_POW_SUPPLY_PATH];
-} acpi_psupply_t;
 
-extern int scan_power_supply(acpi_psupply_t *dest);
+/* called with the directory's fd and an entry name, non-zero stops */
+typedef int (*dir_entry_cb)(int dirfd, const char *name, void *data);
+
+/* prefix for every /sys and /proc path, empty on real hardware */
+extern const char *sysroot;
+
 extern int sysfs_read_int(const char *path);
 extern char *sysfs_read_str(char * dest, size_t len, const char *path);
+extern int sysfs_read_str_at(int dirfd, const char *name, char *dest, size_t len);
+extern int sysfs_read_long_at(int dirfd, const char *name, long *value);
+extern int sysfs_foreach_entry(const char *path, dir_entry_cb cb, void *data);
 extern void load_power_mode(const power_prefs_t *prefs);
-extern void set_nmi_watchdog(bool state);
-extern void set_audio_powersaving(const power_prefs_t *prefs);
+extern void load_power_knobs(const power_prefs_t *prefs, unsigned int groups);
+extern void knobs_forget();
+extern void knobs_assume(const power_prefs_t *prefs);
+extern bool knobs_known();
+extern void knobs_probe(knob_mask_t knobs);
+extern knob_mask_t knobs_missing();
+extern void knobs_report(FILE *fp);
+extern void knobs_close();
 
 #endif /* _ACPI_H_ */
@@ -0,0 +1,404 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+#include "void.h"
+#include "apps.h"
+#include "events.h"
+#include "conf_utils.h"
+#include "acpi.h"
+#include "logger.h"
+
+/*
+ * Per-application boosts. The kernel proc connector multicasts an event
+ * for every exec and exit; an exec'd process whose comm matches one of
+ * the App_Boost names is remembered by pid until it exits or execs into
+ * something else, so the number of boosting processes is always known
+ * without walking /proc. That only happens when subscribing and after
+ * the socket overflowed, since events were lost then.
+ *
+ * Both lookups are open addressed hash tables: rules by FNV-1a of the
+ * name, pids by their low bits since the kernel hands them out in order.
+ */
+
+#define APPS_RECV_BUFFER 8192
+
+typedef struct __apps_rule {
+	char name[APPS_MAX_NAME];
+	uint32_t hash;
+} apps_rule_t;
+
+static apps_rule_t rules[APPS_RULE_SLOTS];
+static unsigned int num_rules;
+static char loaded_rules[MAX_CONF_LIST_LEN];
+static pid_t pids[APPS_PID_SLOTS];
+static unsigned int running;
+static unsigned long num_events;
+static int nl_fd = -1;
+static apps_change_cb change_cb;
+
+static uint32_t name_hash(const char *name);
+static void rules_load(const char *list);
+static bool rule_match(const char *comm);
+static bool pid_add(pid_t pid);
+static bool pid_remove(pid_t pid);
+static int read_comm(pid_t pid, char *dest);
+static int netlink_subscribe(int fd, enum proc_cn_mcast_op op);
+static void apps_event(int fd, short revents, void *data);
+static void apps_resync();
+static int resync_entry(int dirfd, const char *name, void *data);
+static void apps_update(bool was_boosting);
+
+/*
+ * (Re)load the rules from App_Boost and listen for process events while
+ * there are any. Unchanged rules keep the subscription and the counts.
+ */
+int apps_configure(apps_change_cb on_change)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = CN_IDX_PROC,
+	};
+	int fd;
+
+	change_cb = on_change;
+	if (strcmp(loaded_rules, daemon_prefs.app_boost) == 0 &&
+	    (nl_fd >= 0 || ! num_rules))
+		return 0;
+
+	rules_load(daemon_prefs.app_boost);
+	if (! num_rules) {
+		apps_close();
+		return 0;
+	}
+
+	if (nl_fd < 0) {
+		fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			    NETLINK_CONNECTOR);
+		if (fd < 0) {
+			LOG_SIMPLE_ERR("socket");
+			return -1;
+		}
+
+		if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+		    netlink_subscribe(fd, PROC_CN_MCAST_LISTEN) < 0) {
+			thinkd_log(LOG_ERR, "apps: cannot subscribe to process events: %s",
+				   strerror(errno));
+			close(fd);
+			return -1;
+		}
+
+		if (event_add_fd(fd, POLLIN, apps_event, NULL) < 0) {
+			netlink_subscribe(fd, PROC_CN_MCAST_IGNORE);
+			close(fd);
+			return -1;
+		}
+		nl_fd = fd;
+	}
+
+	/* matches changed, or processes started before we listened */
+	apps_resync();
+	thinkd_log(LOG_INFO, "apps: boosting for %u executables, %u running",
+		   num_rules, running);
+
+	return 0;
+}
+
+void apps_close()
+{
+	memset(pids, 0, sizeof(pids));
+	running = 0;
+	loaded_rules[0] = '\0';
+	if (nl_fd < 0)
+		return;
+
+	netlink_subscribe(nl_fd, PROC_CN_MCAST_IGNORE);
+	event_del_fd(nl_fd);
+	close(nl_fd);
+	nl_fd = -1;
+}
+
+bool apps_listening()
+{
+	return nl_fd >= 0;
+}
+
+bool apps_boosting()
+{
+	return running > 0;
+}
+
+/* processes running one of the boost executables */
+unsigned int apps_running()
+{
+	return running;
+}
+
+/* exec and exit events handled since startup */
+unsigned long apps_events()
+{
+	return num_events;
+}
+
+/* `pid` exec'd: it counts from now on if the new image matches a rule */
+void apps_exec(pid_t pid)
+{
+	bool was_boosting = apps_boosting();
+	char comm[APPS_MAX_NAME];
+
+	++num_events;
+	pid_remove(pid);
+	if (read_comm(pid, comm) == 0 && rule_match(comm))
+		pid_add(pid);
+	apps_update(was_boosting);
+}
+
+void apps_exit(pid_t pid)
+{
+	bool was_boosting = apps_boosting();
+
+	++num_events;
+	if (pid_remove(pid))
+		apps_update(was_boosting);
+}
+
+static uint32_t name_hash(const char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*name)
+		hash = (hash ^ (unsigned char) *name++) * 16777619u;
+	return hash;
+}
+
+/* a comma separated list, names longer than a comm are cut like the kernel does */
+static void rules_load(const char *list)
+{
+	const char *p = list;
+
+	memset(rules, 0, sizeof(rules));
+	num_rules = 0;
+	snprintf(loaded_rules, sizeof(loaded_rules), "%s", list);
+
+	while (*p) {
+		char name[APPS_MAX_NAME];
+		size_t len = strcspn(p, ",");
+		uint32_t hash, slot;
+
+		if (len >= APPS_MAX_NAME)
+			thinkd_log(LOG_INFO, "apps: matching %.*s as %.*s", (int) len, p,
+				   APPS_MAX_NAME - 1, p);
+		snprintf(name, sizeof(name), "%.*s", (int) len, p);
+		p += len;
+		if (*p == ',')
+			++p;
+
+		if (! name[0] || rule_match(name))
+			continue;
+		if (num_rules == APPS_MAX_RULES) {
+			thinkd_log(LOG_ERR, "apps: more than %d rules, ignoring %s",
+				   APPS_MAX_RULES, name);
+			continue;
+		}
+
+		hash = name_hash(name);
+		for (slot = hash & (APPS_RULE_SLOTS - 1); rules[slot].name[0];
+		     slot = (slot + 1) & (APPS_RULE_SLOTS - 1))
+			;
+		memcpy(rules[slot].name, name, sizeof(name));
+		rules[slot].hash = hash;
+		++num_rules;
+	}
+}
+
+static bool rule_match(const char *comm)
+{
+	uint32_t hash = name_hash(comm);
+
+	for (uint32_t slot = hash & (APPS_RULE_SLOTS - 1); rules[slot].name[0];
+	     slot = (slot + 1) & (APPS_RULE_SLOTS - 1)) {
+		if (rules[slot].hash == hash && strcmp(rules[slot].name, comm) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static bool pid_add(pid_t pid)
+{
+	uint32_t slot = pid & (APPS_PID_SLOTS - 1);
+
+	/* keep one slot empty so probes always terminate */
+	if (running == APPS_PID_SLOTS - 1) {
+		thinkd_log(LOG_ERR, "apps: too many boosting processes, ignoring %d",
+			   (int) pid);
+		return false;
+	}
+
+	while (pids[slot])
+		slot = (slot + 1) & (APPS_PID_SLOTS - 1);
+	pids[slot] = pid;
+	++running;
+
+	return true;
+}
+
+/* backward shift deletion, so no tombstones pile up */
+static bool pid_remove(pid_t pid)
+{
+	uint32_t slot = pid & (APPS_PID_SLOTS - 1), next;
+
+	while (pids[slot] != pid) {
+		if (! pids[slot])
+			return false;
+		slot = (slot + 1) & (APPS_PID_SLOTS - 1);
+	}
+
+	for (next = (slot + 1) & (APPS_PID_SLOTS - 1); pids[next];
+	     next = (next + 1) & (APPS_PID_SLOTS - 1)) {
+		uint32_t home = pids[next] & (APPS_PID_SLOTS - 1);
+
+		/* move it up unless its home lies cyclically in (slot, next] */
+		if (((next - home) & (APPS_PID_SLOTS - 1)) >=
+		    ((next - slot) & (APPS_PID_SLOTS - 1))) {
+			pids[slot] = pids[next];
+			slot = next;
+		}
+	}
+	pids[slot] = 0;
+	--running;
+
+	return true;
+}
+
+static int read_comm(pid_t pid, char *dest)
+{
+	char path[32];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "/proc/%d/comm", (int) pid);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;	/* already gone again */
+
+	len = read(fd, dest, APPS_MAX_NAME - 1);
+	close(fd);
+	if (len <= 0)
+		return -1;
+
+	if (dest[len - 1] == '\n')
+		--len;
+	dest[len] = '\0';
+
+	return 0;
+}
+
+static int netlink_subscribe(int fd, enum proc_cn_mcast_op op)
+{
+	char buffer[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))]
+		__attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nlh = (struct nlmsghdr *) buffer;
+	struct cn_msg *msg = NLMSG_DATA(nlh);
+
+	memset(buffer, 0, sizeof(buffer));
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+	nlh->nlmsg_type = NLMSG_DONE;
+	nlh->nlmsg_pid = getpid();
+	msg->id.idx = CN_IDX_PROC;
+	msg->id.val = CN_VAL_PROC;
+	msg->len = sizeof(op);
+	memcpy(msg->data, &op, sizeof(op));
+
+	return send(fd, buffer, nlh->nlmsg_len, 0) < 0 ? -1 : 0;
+}
+
+/* drain everything queued, a fork storm delivers many events per wakeup */
+static void apps_event(int fd, short revents, void *data)
+{
+	char buffer[APPS_RECV_BUFFER] __attribute__((aligned(NLMSG_ALIGNTO)));
+	ssize_t len;
+
+	(void) data;
+	if (revents & (POLLERR | POLLNVAL)) {
+		thinkd_log(LOG_ERR, "apps: process event socket failed");
+		apps_close();
+		return;
+	}
+
+	while ((len = recv(fd, buffer, sizeof(buffer), 0)) != 0) {
+		if (len < 0) {
+			if (errno == ENOBUFS) {
+				thinkd_log(LOG_INFO, "apps: process events lost, rescanning");
+				apps_resync();
+				continue;
+			}
+			if (errno != EAGAIN && errno != EINTR)
+				LOG_SIMPLE_ERR("recv");
+			return;
+		}
+
+		for (struct nlmsghdr *nlh = (struct nlmsghdr *) buffer;
+		     NLMSG_OK(nlh, (size_t) len); nlh = NLMSG_NEXT(nlh, len)) {
+			struct cn_msg *msg = NLMSG_DATA(nlh);
+			struct proc_event *ev = (struct proc_event *) msg->data;
+
+			if (nlh->nlmsg_type != NLMSG_DONE ||
+			    msg->id.idx != CN_IDX_PROC || msg->id.val != CN_VAL_PROC)
+				continue;
+
+			/* threads exit one by one, only the leader ends the process */
+			if (ev->what == PROC_EVENT_EXEC)
+				apps_exec(ev->event_data.exec.process_tgid);
+			else if (ev->what == PROC_EVENT_EXIT &&
+				 ev->event_data.exit.process_pid ==
+				 ev->event_data.exit.process_tgid)
+				apps_exit(ev->event_data.exit.process_tgid);
+		}
+	}
+}
+
+/* the one place /proc is walked: on subscribing and after lost events */
+static void apps_resync()
+{
+	bool was_boosting = apps_boosting();
+
+	memset(pids, 0, sizeof(pids));
+	running = 0;
+
+	if (sysfs_foreach_entry("/proc", resync_entry, NULL) < 0)
+		LOG_SIMPLE_ERR("resync");
+
+	apps_update(was_boosting);
+}
+
+static int resync_entry(int dirfd, const char *name, void *data)
+{
+	char comm[APPS_MAX_NAME];
+	pid_t pid;
+
+	(void) dirfd;
+	(void) data;
+	if (! isdigit((unsigned char) name[0]))
+		return 0;
+
+	pid = (pid_t) strtol(name, NULL, 10);
+	if (read_comm(pid, comm) == 0 && rule_match(comm))
+		pid_add(pid);
+	return 0;
+}
+
+static void apps_update(bool was_boosting)
+{
+	if (change_cb && apps_boosting() != was_boosting)
+		change_cb(apps_boosting());
+}
@@ -0,0 +1,24 @@
+#ifndef _APPS_H_
+#define _APPS_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* executables are matched by their comm, which the kernel cuts at 15 bytes */
+#define APPS_MAX_NAME 16
+#define APPS_MAX_RULES 64
+#define APPS_RULE_SLOTS 128	/* power of two, twice the rules */
+#define APPS_PID_SLOTS 1024	/* power of two, boosting processes tracked */
+
+typedef void (*apps_change_cb)(bool boosting);
+
+extern int apps_configure(apps_change_cb on_change);
+extern void apps_close();
+extern bool apps_listening();
+extern bool apps_boosting();
+extern unsigned int apps_running();
+extern unsigned long apps_events();
+extern void apps_exec(pid_t pid);
+extern void apps_exit(pid_t pid);
+
+#endif /* _APPS_H_ */
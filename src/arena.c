@@ -0,0 +1,47 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "logger.h"
+
+void *arena_alloc(arena_t *arena, size_t nbytes)
+{
+	size_t start = (arena->used + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+	if (start > arena->size || nbytes > arena->size - start) {
+		thinkd_log(LOG_ERR, "arena of %zu bytes exhausted, %zu more wanted",
+			   arena->size, nbytes);
+		return NULL;
+	}
+
+	arena->used = start + nbytes;
+	if (arena->used > arena->peak)
+		arena->peak = arena->used;
+
+	return arena->base + start;
+}
+
+void *arena_calloc(arena_t *arena, size_t nelems, size_t nbytes)
+{
+	void *ptr;
+
+	if (nbytes && nelems > SIZE_MAX / nbytes)
+		return NULL;
+
+	ptr = arena_alloc(arena, nelems * nbytes);
+	if (ptr)
+		memset(ptr, 0, nelems * nbytes);
+	return ptr;
+}
+
+size_t arena_mark(const arena_t *arena)
+{
+	return arena->used;
+}
+
+/* everything allocated after `mark` is gone */
+void arena_release(arena_t *arena, size_t mark)
+{
+	if (mark < arena->used)
+		arena->used = mark;
+}
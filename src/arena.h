@@ -0,0 +1,27 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+#define ARENA_ALIGN 16
+
+/*
+ * A bump allocator over a fixed buffer. Allocations are released all at
+ * once, either completely or back to a mark, so nothing is ever freed one
+ * by one and nothing fragments.
+ */
+typedef struct __arena {
+	char *base;
+	size_t size;
+	size_t used;
+	size_t peak;
+} arena_t;
+
+#define ARENA_INIT(buffer) { (char *) (buffer), sizeof(buffer), 0, 0 }
+
+extern void *arena_alloc(arena_t *arena, size_t nbytes);
+extern void *arena_calloc(arena_t *arena, size_t nelems, size_t nbytes);
+extern size_t arena_mark(const arena_t *arena);
+extern void arena_release(arena_t *arena, size_t mark);
+
+#endif /* _ARENA_H_ */
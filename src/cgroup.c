@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "void.h"
+#include "cgroup.h"
+#include "conf_utils.h"
+#include "logger.h"
+
+/*
+ * cgroup v2 limits for the slices listed in Cgroup_Slices, written by the
+ * cgroup knobs in acpi.c. The CPU topology is read once at startup: on
+ * hybrid Intel parts the kernel lists the E-cores in cpu_atom/cpus, on
+ * others the CPUs below the highest cpu_capacity are the efficient ones.
+ */
+
+#define CPU_DIR "/sys/devices/system/cpu"
+#define HYBRID_ATOM_CPUS "/sys/devices/cpu_atom/cpus"
+
+static sysfs_value_t efficiency_cpus;
+static int online_cpus;
+static long capacities[CGROUP_MAX_CPUS];
+
+static int count_cpus(const char *list);
+static int read_capacity(int dirfd, const char *name, void *data);
+static void capacity_cpus(char *dest, size_t len);
+
+/* the number of efficiency cores found, 0 without a hybrid topology */
+int cgroup_discover()
+{
+	sysfs_path_t path;
+	sysfs_value_t online;
+
+	efficiency_cpus[0] = '\0';
+	online_cpus = 0;
+
+	sysroot_sprintf(path, "%s/online", CPU_DIR);
+	if (sysfs_read_str_at(AT_FDCWD, path, online, sizeof(online)) >= 0)
+		online_cpus = count_cpus(online);
+	if (online_cpus <= 0)
+		online_cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+	sysroot_sprintf(path, "%s", HYBRID_ATOM_CPUS);
+	if (sysfs_read_str_at(AT_FDCWD, path, efficiency_cpus,
+			      sizeof(efficiency_cpus)) < 0)
+		capacity_cpus(efficiency_cpus, sizeof(efficiency_cpus));
+
+	if (efficiency_cpus[0])
+		thinkd_log(LOG_INFO, "cgroup: efficiency cores %s of %d cpus",
+			   efficiency_cpus, online_cpus);
+
+	return count_cpus(efficiency_cpus);
+}
+
+/*
+ * Walk the comma separated Cgroup_Slices: stores the path of `attr` in
+ * the next one in `path` and returns it, or NULL after the last one.
+ * `cursor` starts out pointing at the list.
+ */
+const char *cgroup_next(const char **cursor, const char *attr, sysfs_path_t path)
+{
+	const char *p = *cursor;
+	size_t len;
+
+	while (*p == ',')
+		++p;
+	if (! *p)
+		return NULL;
+
+	len = strcspn(p, ",");
+	sysroot_sprintf(path, "%s/%.*s/%s", CGROUP_ROOT, (int) len, p, attr);
+	*cursor = p + len;
+	return path;
+}
+
+/* a cpuset list, empty when there are no efficiency cores */
+const char *cgroup_efficiency_cpus()
+{
+	return efficiency_cpus;
+}
+
+int cgroup_cpus()
+{
+	return online_cpus > 0 ? online_cpus : 1;
+}
+
+/* the number of cpus in a list like 0-3,8,10-11 */
+static int count_cpus(const char *list)
+{
+	unsigned int first, last;
+	int count = 0, used;
+
+	while (*list) {
+		if (sscanf(list, "%u%n", &first, &used) != 1)
+			break;
+		list += used;
+		last = first;
+		if (*list == '-' && sscanf(list + 1, "%u%n", &last, &used) == 1)
+			list += used + 1;
+		if (last >= first)
+			count += last - first + 1;
+		if (*list != ',')
+			break;
+		++list;
+	}
+
+	return count;
+}
+
+static int read_capacity(int dirfd, const char *name, void *data)
+{
+	sysfs_path_t attr;
+	unsigned int cpu;
+	char tail;
+	long value;
+
+	if (sscanf(name, "cpu%u%c", &cpu, &tail) != 1 || cpu >= CGROUP_MAX_CPUS)
+		return 0;
+
+	sysfs_sprintf(attr, "%s/cpu_capacity", name);
+	if (sysfs_read_long_at(dirfd, attr, &value) == 0)
+		capacities[cpu] = value;
+	return 0;
+}
+
+/* the cpus below the highest capacity, as ranges */
+static void capacity_cpus(char *dest, size_t len)
+{
+	sysfs_path_t cpu_dir;
+	long highest = 0;
+	size_t used = 0;
+	int cpu, start;
+
+	dest[0] = '\0';
+	memset(capacities, 0, sizeof(capacities));
+	sysroot_sprintf(cpu_dir, "%s", CPU_DIR);
+	if (sysfs_foreach_entry(cpu_dir, read_capacity, NULL) < 0)
+		return;
+
+	for (cpu = 0; cpu < CGROUP_MAX_CPUS; ++cpu) {
+		if (capacities[cpu] > highest)
+			highest = capacities[cpu];
+	}
+
+	for (cpu = 0; cpu < CGROUP_MAX_CPUS; ++cpu) {
+		if (! capacities[cpu] || capacities[cpu] >= highest)
+			continue;
+
+		for (start = cpu; cpu + 1 < CGROUP_MAX_CPUS && capacities[cpu + 1] &&
+		     capacities[cpu + 1] < highest; ++cpu)
+			;
+		if (start == cpu)
+			used += snprintf(dest + used, len - used, "%s%d", used ? "," : "", cpu);
+		else
+			used += snprintf(dest + used, len - used, "%s%d-%d", used ? "," : "",
+					 start, cpu);
+		if (used >= len) {
+			/* too many holes to fit, better none than a wrong set */
+			dest[0] = '\0';
+			return;
+		}
+	}
+}
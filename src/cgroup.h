@@ -0,0 +1,22 @@
+#ifndef _CGROUP_H_
+#define _CGROUP_H_
+
+#include "acpi.h"
+#include "config.h"
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define CGROUP_CPU_PERIOD 100000	/* us, the kernel's default */
+#define CGROUP_DEFAULT_WEIGHT 100
+#define CGROUP_MAX_CPUS 1024
+
+#if WITH_CGROUP_KNOBS
+extern int cgroup_discover();
+#else
+static inline int cgroup_discover() { return 0; }
+#endif
+extern const char *cgroup_next(const char **cursor, const char *attr,
+			       sysfs_path_t path);
+extern const char *cgroup_efficiency_cpus();
+extern int cgroup_cpus();
+
+#endif /* _CGROUP_H_ */
@@ -6,42 +6,139 @@
 #include <string.h>
 #include <strings.h>
 
-#include "eclib.h"
+#include "arena.h"
 #include "config.h"
 #include "conf_utils.h"
+#include "gpu.h"
 #include "logger.h"
+#include "usdt.h"
 #include "void.h"
 
 #define OFFSET_OF(TYPE, MEMBER) ((size_t) &((TYPE *)0)->MEMBER)
 #define MAX_SECTION_LEN 512
 #define MAX_KEYVAL_LEN 512
+#define CONFIG_ARENA_SIZE 1024
 #define load_section(name, fh, mode)					\
 	do {								\
 		thinkd_log(LOG_INFO, "LOADING SECTION [%s]", name);	\
-		read_section(fh, mode);					\
+		read_section(fh, mode, ini_table_defs,			\
+			     array_count(ini_table_defs));		\
 	} while (0)
 
 /* variables */
 static ini_table_t **search_tab;
+static size_t search_tab_mark;
+/* the search tables of one section at a time, never on the heap */
+static char config_pool[CONFIG_ARENA_SIZE];
+static arena_t config_arena = ARENA_INIT(config_pool);
 
+const char *config_file = THINKD_INI_FILE;
 power_prefs_t mode_performance;
 power_prefs_t mode_powersave;
 power_prefs_t mode_heavy_powersave;
 power_prefs_t mode_critical;
+daemon_prefs_t daemon_prefs;
+hook_prefs_t hook_prefs;
+rule_prefs_t rule_prefs;
+
+static const daemon_prefs_t daemon_defaults = {
+	.psi_boost = false,
+	.psi_cpu_stall = 150,
+	.psi_io_stall = 150,
+	.psi_window = 1000,
+	.transition_debounce = 2000,
+	.selfcost_interval = 3600,
+	.selfcost_max_wakeups = 1000,
+	.selfcost_max_cpu = 1000,
+	.selfcost_max_rw_calls = 100,
+	.remote_listen = "",
+	.remote_key_file = THINKD_KEY_FILE,
+	.metrics_listen = "",
+	.app_boost = "",
+	.cgroup_slices = "",
+	.history_file = "",
+	.history_interval = 60,
+	.history_max_kb = 1024,
+	.wakers_interval = 0,
+};
+
+static const hook_prefs_t hook_defaults = {
+	.timeout = 30,
+	.max_running = 2,
+};
+
+static unsigned int parse_knob_BOOL(const char *value);
+static unsigned int parse_knob_PERCENT(const char *value);
+#if WITH_GPU_KNOBS
+static unsigned int parse_knob_MHZ(const char *value);
+static unsigned int parse_knob_GPU_LEVEL(const char *value);
+static unsigned int parse_knob_GPU_PROFILE(const char *value);
+static int parse_name(const char *value, const char *const *names, int count);
+#endif
+#if WITH_CGROUP_KNOBS
+static unsigned int parse_knob_WEIGHT(const char *value);
+#endif
+
+/* one reader per knob, storing straight into the packed profile */
+#define KNOB_READER(id, key, type, ...)					\
+	static void read_knob_##id(void *store, const char *value)	\
+	{								\
+		knob_set(store, KNOB_##id, parse_knob_##type(value));	\
+	}
+KNOB_LIST(KNOB_READER)
+#undef KNOB_READER
 
 ini_table_t ini_table_defs[] = {
-	{"bluetooth", OFFSET_OF(power_prefs_t, bluetooth), str_read_bool},
-	{"nmi_watchdog", OFFSET_OF(power_prefs_t, nmi_watchdog), str_read_bool},
-	{"wireless", OFFSET_OF(power_prefs_t, wireless), str_read_bool},
-	{"wwan", OFFSET_OF(power_prefs_t, wwan), str_read_bool},
-	{"brightness", OFFSET_OF(power_prefs_t, brightness), str_read_int},
-	{"audio_powersave", OFFSET_OF(power_prefs_t, audio_powersave),str_read_bool},
-	{"sound_muted", OFFSET_OF(power_prefs_t, mute_state), str_read_bool},
-	{"thinklight", OFFSET_OF(power_prefs_t, thinklight_state), str_read_bool}
+#define KNOB_ENTRY(id, key, ...) {key, 0, read_knob_##id},
+	KNOB_LIST(KNOB_ENTRY)
+#undef KNOB_ENTRY
 };
 
+ini_table_t daemon_table_defs[] = {
+	{"psi_boost", OFFSET_OF(daemon_prefs_t, psi_boost), str_read_bool},
+	{"psi_cpu_stall", OFFSET_OF(daemon_prefs_t, psi_cpu_stall), str_read_int},
+	{"psi_io_stall", OFFSET_OF(daemon_prefs_t, psi_io_stall), str_read_int},
+	{"psi_window", OFFSET_OF(daemon_prefs_t, psi_window), str_read_int},
+	{"transition_debounce", OFFSET_OF(daemon_prefs_t, transition_debounce), str_read_int},
+	{"selfcost_interval", OFFSET_OF(daemon_prefs_t, selfcost_interval), str_read_int},
+	{"selfcost_max_wakeups", OFFSET_OF(daemon_prefs_t, selfcost_max_wakeups), str_read_int},
+	{"selfcost_max_cpu", OFFSET_OF(daemon_prefs_t, selfcost_max_cpu), str_read_int},
+	{"selfcost_max_rw_calls", OFFSET_OF(daemon_prefs_t, selfcost_max_rw_calls), str_read_int},
+	{"remote_listen", OFFSET_OF(daemon_prefs_t, remote_listen), str_read_str},
+	{"remote_key_file", OFFSET_OF(daemon_prefs_t, remote_key_file), str_read_str},
+	{"metrics_listen", OFFSET_OF(daemon_prefs_t, metrics_listen), str_read_str},
+	{"app_boost", OFFSET_OF(daemon_prefs_t, app_boost), str_read_list},
+	{"cgroup_slices", OFFSET_OF(daemon_prefs_t, cgroup_slices), str_read_list},
+	{"history_file", OFFSET_OF(daemon_prefs_t, history_file), str_read_str},
+	{"history_interval", OFFSET_OF(daemon_prefs_t, history_interval), str_read_int},
+	{"history_max_kb", OFFSET_OF(daemon_prefs_t, history_max_kb), str_read_int},
+	{"wakers_interval", OFFSET_OF(daemon_prefs_t, wakers_interval), str_read_int}
+};
+
+ini_table_t hook_table_defs[] = {
+	{"powersave_enter", OFFSET_OF(hook_prefs_t, powersave_enter), str_read_list},
+	{"powersave_exit", OFFSET_OF(hook_prefs_t, powersave_exit), str_read_list},
+	{"performance_enter", OFFSET_OF(hook_prefs_t, performance_enter), str_read_list},
+	{"performance_exit", OFFSET_OF(hook_prefs_t, performance_exit), str_read_list},
+	{"heavy_powersave_enter", OFFSET_OF(hook_prefs_t, heavy_powersave_enter), str_read_list},
+	{"heavy_powersave_exit", OFFSET_OF(hook_prefs_t, heavy_powersave_exit), str_read_list},
+	{"critical_enter", OFFSET_OF(hook_prefs_t, critical_enter), str_read_list},
+	{"critical_exit", OFFSET_OF(hook_prefs_t, critical_exit), str_read_list},
+	{"timeout", OFFSET_OF(hook_prefs_t, timeout), str_read_int},
+	{"max_running", OFFSET_OF(hook_prefs_t, max_running), str_read_int}
+};
+
+#define RULE_ENTRY(n) {"rule" #n, OFFSET_OF(rule_prefs_t, rules[n - 1]), str_read_str}
+ini_table_t rule_table_defs[] = {
+	RULE_ENTRY(1), RULE_ENTRY(2), RULE_ENTRY(3), RULE_ENTRY(4),
+	RULE_ENTRY(5), RULE_ENTRY(6), RULE_ENTRY(7), RULE_ENTRY(8),
+	RULE_ENTRY(9), RULE_ENTRY(10), RULE_ENTRY(11), RULE_ENTRY(12),
+	RULE_ENTRY(13), RULE_ENTRY(14), RULE_ENTRY(15), RULE_ENTRY(16),
+};
+#undef RULE_ENTRY
+
 /* static void debug_output(const char *path, const char *out, ...); */
-static void read_section(FILE *fp, power_prefs_t *prefs);
+static void read_section(FILE *fp, void *store, ini_table_t *table, size_t nelems);
 static void search_tab_mv_end(unsigned int idx, unsigned int last_non_null);
 static void initialize_defaults(power_prefs_t *defaults);
 
@@ -49,19 +146,25 @@ int read_ini()
 {
 	FILE *ini_fp;
 	char buffer[MAX_SECTION_LEN];
-	power_prefs_t *defaults;
+	power_prefs_t defaults;
+
+	USDT1(config_start, config_file);
 
 	/* attempt to open the file */
 	/* return errno on fail to be able to thinkd_log it */
-	ini_fp = fopen(THINKD_INI_FILE, "r");
-	if (! ini_fp)
+	ini_fp = fopen(config_file, "r");
+	memcpy(&daemon_prefs, &daemon_defaults, sizeof(struct __daemon_prefs));
+	memcpy(&hook_prefs, &hook_defaults, sizeof(struct __hook_prefs));
+	memset(&rule_prefs, 0, sizeof(struct __rule_prefs));
+	if (! ini_fp) {
+		USDT1(config_end, -1);
 		return -1;
+	}
 
 	/* read the ini file */
-	defaults = (power_prefs_t*) ec_malloc(sizeof(struct __power_prefs));
-	load_section("default", ini_fp, defaults);
-	initialize_defaults(defaults);
-	free(defaults);
+	memset(&defaults, 0, sizeof(struct __power_prefs));
+	load_section("default", ini_fp, &defaults);
+	initialize_defaults(&defaults);
 	
 	while (fgets(buffer, MAX_SECTION_LEN, ini_fp)) {
 		char *bptr = buffer;
@@ -84,9 +187,25 @@ int read_ini()
 			load_section(bptr, ini_fp, &mode_critical);
 		else if (strcmp(bptr, "heavy_powersave") == 0)
 			load_section(bptr, ini_fp, &mode_heavy_powersave);	
+		else if (strcmp(bptr, "daemon") == 0) {
+			thinkd_log(LOG_INFO, "LOADING SECTION [%s]", bptr);
+			read_section(ini_fp, &daemon_prefs, daemon_table_defs,
+				     array_count(daemon_table_defs));
+		}
+		else if (strcmp(bptr, "hooks") == 0) {
+			thinkd_log(LOG_INFO, "LOADING SECTION [%s]", bptr);
+			read_section(ini_fp, &hook_prefs, hook_table_defs,
+				     array_count(hook_table_defs));
+		}
+		else if (strcmp(bptr, "rules") == 0) {
+			thinkd_log(LOG_INFO, "LOADING SECTION [%s]", bptr);
+			read_section(ini_fp, &rule_prefs, rule_table_defs,
+				     array_count(rule_table_defs));
+		}
 	}
 
 	fclose(ini_fp);
+	USDT1(config_end, 0);
 	
 	return 0;
 }
@@ -98,18 +217,17 @@ static void initialize_defaults(power_prefs_t *defaults)
 		&mode_critical, &mode_heavy_powersave
 	};
 
-	for (power_prefs_t *p = *prefs + array_count(prefs) - 1;
-	     p >= *prefs; --p) {
-		thinkd_log(LOG_DEBUG, "currently initializing %p to defaults", (void *) p);
-		memcpy(p, defaults, sizeof(struct __power_prefs));
+	for (power_prefs_t **p = prefs; p < prefs + array_count(prefs); ++p) {
+		thinkd_log(LOG_DEBUG, "currently initializing %p to defaults", (void *) *p);
+		memcpy(*p, defaults, sizeof(struct __power_prefs));
 	}
 }
 
-static void read_section(FILE *fp, power_prefs_t *prefs)
+static void read_section(FILE *fp, void *store, ini_table_t *table, size_t nelems)
 {
 	char buffer[MAX_KEYVAL_LEN];
 	size_t num_elems;
-#ifdef CONF_DEBUG
+#if CONF_DEBUG
 	size_t tries = 0;
 #endif
 	
@@ -117,7 +235,7 @@ static void read_section(FILE *fp, power_prefs_t *prefs)
 		return;
 
 	/* initialize ini table */
-	num_elems = alloc_ini_table();
+	num_elems = alloc_ini_table(table, nelems);
 	if (!num_elems)
 		return;
 
@@ -129,7 +247,7 @@ static void read_section(FILE *fp, power_prefs_t *prefs)
 
 		
 		if (! eq_pch) {
-#ifdef EXTENDED_INI_SUPPORT
+#if EXTENDED_INI_SUPPORT
 			size_t buflen;
 			char *buf_pch = buffer;
 			
@@ -166,7 +284,7 @@ static void read_section(FILE *fp, power_prefs_t *prefs)
 		/* find key */
 		while (++idx < num_elems) {
 			char *val_pch, *newl_pch;
-#ifdef CONF_DEBUG
+#if CONF_DEBUG
 			++tries;
 #endif
 			if (! search_tab[idx])
@@ -194,7 +312,7 @@ static void read_section(FILE *fp, power_prefs_t *prefs)
 			*newl_pch = '\0';
 			
 			thinkd_log(LOG_INFO, "SET %s = %s", buffer, val_pch);
-			search_tab[idx]->handler((char *) prefs + search_tab[idx]->store_offset,
+			search_tab[idx]->handler((char *) store + search_tab[idx]->store_offset,
 						 val_pch);
 			
 			/* Decrease length of search table, set this element to the end
@@ -206,7 +324,7 @@ static void read_section(FILE *fp, power_prefs_t *prefs)
 	}
 	
 clean_table:
-#ifdef CONF_DEBUG
+#if CONF_DEBUG
 	thinkd_log(LOG_INFO, "Read section in %d tries\n", (int) tries);
 #endif
 	free_ini_table();
@@ -222,21 +340,20 @@ static void search_tab_mv_end(unsigned int idx, unsigned int last_non_null)
 	}
 }
 
-size_t alloc_ini_table()
+size_t alloc_ini_table(ini_table_t *table, size_t elems)
 {
 	int idx = 0;
-	size_t tab_size, elems, alloc_size;
-	tab_size = sizeof(ini_table_defs);
-	elems = tab_size / sizeof(struct __ini_table);
+	size_t alloc_size;
 	alloc_size = elems * sizeof(struct __ini_table*);
 	
-	search_tab = (ini_table_t**) ec_malloc(alloc_size);
+	search_tab_mark = arena_mark(&config_arena);
+	search_tab = (ini_table_t**) arena_alloc(&config_arena, alloc_size);
 	if (! search_tab)
 		return (size_t) 0;
 
-	/* copy ini_table_defs */
+	/* copy the table definitions */
 	while (idx < elems) {
-		search_tab[idx] = &ini_table_defs[idx];
+		search_tab[idx] = &table[idx];
 		++idx;
 	}
 	
@@ -245,7 +362,7 @@ size_t alloc_ini_table()
 
 void free_ini_table()
 {
-	free(search_tab);
+	arena_release(&config_arena, search_tab_mark);
 	search_tab = NULL;
 }
 
@@ -262,6 +379,114 @@ void str_read_bool(void *store, const char *value)
 		*dest = false;
 }
 
+static unsigned int parse_knob_BOOL(const char *value)
+{
+	bool state;
+
+	str_read_bool(&state, value);
+	return state;
+}
+
+static unsigned int parse_knob_PERCENT(const char *value)
+{
+	int percent = 0;
+
+	str_read_int(&percent, value);
+	if (percent < 0)
+		return 0;
+	return percent > 100 ? 100 : (unsigned int) percent;
+}
+
+#if WITH_GPU_KNOBS
+static unsigned int parse_knob_MHZ(const char *value)
+{
+	int mhz = 0;
+
+	str_read_int(&mhz, value);
+	if (mhz < 0 || mhz >= 1 << KNOB_WIDTH_MHZ) {
+		thinkd_log(LOG_ERR, "%d MHz is out of range", mhz);
+		return 0;
+	}
+	return (unsigned int) mhz;
+}
+
+static unsigned int parse_knob_GPU_LEVEL(const char *value)
+{
+	int level = parse_name(value, gpu_level_names, GPU_LEVELS);
+
+	if (level < 0) {
+		thinkd_log(LOG_ERR, "unknown gpu level %s", value);
+		return 0;
+	}
+	return (unsigned int) level;
+}
+
+/* a profile name or the number amdgpu lists it with */
+static unsigned int parse_knob_GPU_PROFILE(const char *value)
+{
+	int profile = parse_name(value, gpu_profile_names, GPU_PROFILES);
+
+	if (profile < 0 && isdigit((unsigned char) value[0]))
+		str_read_int(&profile, value);
+	if (profile < 0 || profile + 1 >= 1 << KNOB_WIDTH_GPU_PROFILE) {
+		thinkd_log(LOG_ERR, "unknown gpu profile %s", value);
+		return 0;
+	}
+	return (unsigned int) profile + 1;
+}
+
+static int parse_name(const char *value, const char *const *names, int count)
+{
+	for (int i = 0; i < count; ++i) {
+		if (strcasecmp(value, names[i]) == 0)
+			return i;
+	}
+
+	return -1;
+}
+#endif /* WITH_GPU_KNOBS */
+
+#if WITH_CGROUP_KNOBS
+/* cpu.weight takes 1 to 10000 */
+static unsigned int parse_knob_WEIGHT(const char *value)
+{
+	int weight = 0;
+
+	str_read_int(&weight, value);
+	if (weight < 1 || weight > 10000) {
+		thinkd_log(LOG_ERR, "cgroup weight %d is out of 1..10000", weight);
+		return weight < 1 ? 1 : 10000;
+	}
+	return (unsigned int) weight;
+}
+#endif
+
+/* store is a char[MAX_CONF_STR_LEN], longer values are refused */
+void str_read_str(void *store, const char *value)
+{
+	char *dest = (char*) store;
+
+	if (strlen(value) >= MAX_CONF_STR_LEN) {
+		thinkd_log(LOG_ERR, "str_read_str(): value too long, got %s", value);
+		return;
+	}
+
+	strcpy(dest, value);
+}
+
+/* store is a char[MAX_CONF_LIST_LEN] */
+void str_read_list(void *store, const char *value)
+{
+	char *dest = (char*) store;
+
+	if (strlen(value) >= MAX_CONF_LIST_LEN) {
+		thinkd_log(LOG_ERR, "str_read_list(): list too long, got %s", value);
+		return;
+	}
+
+	strcpy(dest, value);
+}
+
 void str_read_int(void *store, const char *value)
 {
 	int *dest = (int*) store;
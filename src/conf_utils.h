@@ -5,22 +5,59 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#include "knobs.h"
+
 /* this makes our configuration a little more clear */
 #define ENABLED true
 #define DISABLED false
 
 #define THINKD_INI_FILE "/etc/thinkd.ini"
+#define THINKD_KEY_FILE "/etc/thinkd.key"
+#define MAX_CONF_STR_LEN 128
+#define MAX_CONF_LIST_LEN 448
+#define MAX_CONF_RULES 16
+
+
+/* daemon wide settings from the [daemon] section */
+typedef struct __daemon_prefs {
+	bool psi_boost;
+	int psi_cpu_stall;	/* ms of stall per window that triggers a boost */
+	int psi_io_stall;
+	int psi_window;		/* ms, between 500 and 10000 */
+	int transition_debounce;	/* ms a supply change must hold, 0 applies at once */
+	int selfcost_interval;	/* s between self-cost reports, 0 disables */
+	int selfcost_max_wakeups;	/* per hour, 0 means no limit */
+	int selfcost_max_cpu;	/* ms of cpu time per hour */
+	int selfcost_max_rw_calls;	/* read/write calls per probe */
+	char remote_listen[MAX_CONF_STR_LEN];	/* host:port, empty disables */
+	char remote_key_file[MAX_CONF_STR_LEN];
+	char metrics_listen[MAX_CONF_STR_LEN];	/* unix socket path or host:port */
+	char app_boost[MAX_CONF_LIST_LEN];	/* comma separated executable names */
+	char cgroup_slices[MAX_CONF_LIST_LEN];	/* cgroups under /sys/fs/cgroup */
+	char history_file[MAX_CONF_STR_LEN];	/* battery history, empty disables */
+	int history_interval;	/* s between battery samples */
+	int history_max_kb;	/* size the history file is kept at */
+	int wakers_interval;	/* s between wakeup samples on battery, 0 disables */
+} daemon_prefs_t;
+
+/* commands run on mode transitions, from the [hooks] section */
+typedef struct __hook_prefs {
+	char powersave_enter[MAX_CONF_LIST_LEN];
+	char powersave_exit[MAX_CONF_LIST_LEN];
+	char performance_enter[MAX_CONF_LIST_LEN];
+	char performance_exit[MAX_CONF_LIST_LEN];
+	char heavy_powersave_enter[MAX_CONF_LIST_LEN];
+	char heavy_powersave_exit[MAX_CONF_LIST_LEN];
+	char critical_enter[MAX_CONF_LIST_LEN];
+	char critical_exit[MAX_CONF_LIST_LEN];
+	int timeout;		/* s a hook may run before it is killed, 0 never */
+	int max_running;	/* hooks at once, the rest wait */
+} hook_prefs_t;
 
-typedef struct __power_prefs {
-	int brightness;
-	bool bluetooth;
-	bool nmi_watchdog;
-	bool wireless;
-	bool wwan;
-	bool audio_powersave;
-	bool mute_state;
-	bool thinklight_state;
-} power_prefs_t;
+/* Rule1 to Rule16 of the [rules] section, the first that holds wins */
+typedef struct __rule_prefs {
+	char rules[MAX_CONF_RULES][MAX_CONF_STR_LEN];
+} rule_prefs_t;
 
 typedef struct __ini_table {
 	const char *key;
@@ -29,17 +66,24 @@ typedef struct __ini_table {
 } ini_table_t;
 
 /* global variables */
+extern const char *config_file;
 extern ini_table_t ini_table_defs[];
+extern ini_table_t daemon_table_defs[];
+extern daemon_prefs_t daemon_prefs;
+extern hook_prefs_t hook_prefs;
+extern rule_prefs_t rule_prefs;
 extern power_prefs_t mode_performance;
 extern power_prefs_t mode_powersave;
 extern power_prefs_t mode_heavy_powersave;
 extern power_prefs_t mode_critical;
 
-extern size_t alloc_ini_table();
+extern size_t alloc_ini_table(ini_table_t *table, size_t nelems);
 extern void free_ini_table();
 extern int read_ini();
 
 extern void str_read_bool(void *store, const char *value);
 extern void str_read_int(void *store, const char *value);
+extern void str_read_str(void *store, const char *value);
+extern void str_read_list(void *store, const char *value);
 
 #endif /* _CONF_UTILS_H_ */
@@ -1,13 +1,45 @@
 #ifndef _THINKD_CONFIG_H_
 #define _THINKD_CONFIG_H_
 
-#define EXTENDED_INI_SUPPORT 1
-// #define CONF_DEBUG 1
+/*
+ * Build time features, 1 or 0. The Makefile passes every one of them,
+ * from PROFILE=full or PROFILE=minimal and any WITH_* override; these
+ * defaults only matter when compiling by hand.
+ */
 
-// #define USE_SYSLOG 1 
+/* comment lines and blank lines inside ini sections */
+#ifndef EXTENDED_INI_SUPPORT
+#  define EXTENDED_INI_SUPPORT 1
+#endif
+#ifndef CONF_DEBUG
+#  define CONF_DEBUG 0
+#endif
+
+/* syslog instead of the files below */
+#ifndef USE_SYSLOG
+#  define USE_SYSLOG 0
+#endif
 #define LOG_INFO_PATH "/var/log/thinkd/thinkd.log"
 #define LOG_ERR_PATH  "/var/log/thinkd/thinkd.err"
 #define LOG_DEBUG_PATH "/var/log/thinkd/thinkd.debug"
-#define _DEBUG_LOG 1
+#ifndef _DEBUG_LOG
+#  define _DEBUG_LOG 1
+#endif
+
+/* lock the profiles, for embedders calling in from other threads */
+#ifndef WITH_PTHREAD
+#  define WITH_PTHREAD 1
+#endif
+
+/* knob families, each with the code that finds and writes its devices */
+#ifndef WITH_RADIO_KNOBS
+#  define WITH_RADIO_KNOBS 1	/* bluetooth, wwan, wireless */
+#endif
+#ifndef WITH_GPU_KNOBS
+#  define WITH_GPU_KNOBS 1	/* i915 frequencies, amdgpu level and profile */
+#endif
+#ifndef WITH_CGROUP_KNOBS
+#  define WITH_CGROUP_KNOBS 1	/* Cgroup_Slices weight, quota and cpuset */
+#endif
 
 #endif /* _THINKD_CONFIG_H_ */
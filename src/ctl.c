@@ -0,0 +1,297 @@
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "void.h"
+#include "ctl.h"
+#include "mode.h"
+#include "psi.h"
+#include "apps.h"
+#include "wakers.h"
+#include "notify.h"
+#include "events.h"
+#include "logger.h"
+
+/*
+ * Local control socket. Clients send a single command line and get a
+ * reply before the connection is closed. The socket is either inherited
+ * through socket activation or created by us, and every fd is
+ * non-blocking so a slow client can never stall the power supply handling.
+ */
+
+typedef struct __ctl_client {
+	bool active;
+	int fd;
+	size_t len;
+	char line[CTL_MAX_LINE];
+} ctl_client_t;
+
+typedef struct __ctl_command {
+	const char *name;
+	int (*handler)(const char *args, char *reply, size_t len);
+} ctl_command_t;
+
+static int cmd_status(const char *args, char *reply, size_t len);
+static int cmd_mode(const char *args, char *reply, size_t len);
+static int cmd_reload(const char *args, char *reply, size_t len);
+static int cmd_stats(const char *args, char *reply, size_t len);
+static int cmd_wakers(const char *args, char *reply, size_t len);
+static int cmd_help(const char *args, char *reply, size_t len);
+static void ctl_accept(int fd, short revents, void *data);
+static void ctl_client_read(int fd, short revents, void *data);
+static void ctl_client_timeout(void *data);
+static void ctl_client_close(ctl_client_t *client);
+
+static const ctl_command_t commands[] = {
+	{"status", cmd_status},
+	{"mode", cmd_mode},
+	{"reload", cmd_reload},
+	{"stats", cmd_stats},
+	{"wakers", cmd_wakers},
+	{"help", cmd_help},
+};
+
+static int listen_fd = -1;
+static const char *bound_path;
+static ctl_client_t clients[CTL_MAX_CLIENTS];
+
+int ctl_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	mode_t mask;
+	int bound;
+
+	if (notify_listen_fds() >= 1) {
+		listen_fd = LISTEN_FDS_START;
+		fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+		thinkd_log(LOG_INFO, "using control socket passed by the service manager");
+	}
+	else {
+		if (strlen(path) >= sizeof(addr.sun_path)) {
+			thinkd_log(LOG_ERR, "control socket path %s is too long", path);
+			return -1;
+		}
+
+		listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (listen_fd < 0) {
+			LOG_SIMPLE_ERR("socket");
+			return -1;
+		}
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, path);
+
+		/* a stale socket from a crashed instance would make bind() fail */
+		unlink(path);
+		/* created 0600: a chmod() after bind() would leave a window in
+		   which anyone could connect, we run under umask(0) */
+		mask = umask(0177);
+		bound = bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr));
+		umask(mask);
+		if (bound < 0 || listen(listen_fd, CTL_MAX_CLIENTS) < 0) {
+			thinkd_log(LOG_ERR, "cannot listen on %s: %s", path, strerror(errno));
+			close(listen_fd);
+			listen_fd = -1;
+			return -1;
+		}
+		bound_path = path;
+	}
+
+	return event_add_fd(listen_fd, POLLIN, ctl_accept, NULL);
+}
+
+void ctl_close()
+{
+	for (ctl_client_t *c = clients; c < clients + array_count(clients); ++c)
+		ctl_client_close(c);
+
+	if (listen_fd < 0)
+		return;
+
+	event_del_fd(listen_fd);
+	close(listen_fd);
+	listen_fd = -1;
+
+	/* an inherited socket belongs to the service manager */
+	if (bound_path)
+		unlink(bound_path);
+	bound_path = NULL;
+}
+
+/*
+ * Run one command line, writing the reply (newline terminated) into reply.
+ * Returns 0 on success or -1 for unknown or failed commands.
+ */
+int ctl_execute(char *line, char *reply, size_t len)
+{
+	char *args;
+
+	line[strcspn(line, "\r\n")] = '\0';
+	args = line + strcspn(line, " \t");
+	if (*args)
+		*args++ = '\0';
+
+	for (size_t i = 0; i < array_count(commands); ++i) {
+		if (strcasecmp(line, commands[i].name) == 0)
+			return commands[i].handler(args, reply, len);
+	}
+
+	snprintf(reply, len, "error: unknown command '%s'\n", line);
+	return -1;
+}
+
+static int cmd_status(const char *args, char *reply, size_t len)
+{
+	const char *boost = "none";
+
+	/* pressure and boost applications may both be holding performance */
+	if (psi_boosting() && apps_boosting())
+		boost = "psi,apps";
+	else if (psi_boosting())
+		boost = "psi";
+	else if (apps_boosting())
+		boost = "apps";
+
+	snprintf(reply, len, "mode=%s ac=%s boost=%s probe=%ds forced=%s\n",
+		 mode_name(current_mode), ac_online ? "online" : "offline",
+		 boost, sleep_time, mode_forced() ? "yes" : "no");
+	return 0;
+}
+
+/* mode <name> pins a mode until mode auto */
+static int cmd_mode(const char *args, char *reply, size_t len)
+{
+	power_prefs_t *prefs = NULL;
+
+	if (strcmp(args, "auto") != 0 && ! (prefs = mode_by_name(args))) {
+		snprintf(reply, len, "error: unknown mode '%s'\n", args);
+		return -1;
+	}
+
+	mode_force(prefs);
+	return cmd_status(args, reply, len);
+}
+
+/* reload and stats take the same path as the signals do */
+static int cmd_reload(const char *args, char *reply, size_t len)
+{
+	kill(getpid(), SIGUSR1);
+	snprintf(reply, len, "ok\n");
+	return 0;
+}
+
+static int cmd_stats(const char *args, char *reply, size_t len)
+{
+	kill(getpid(), SIGUSR2);
+	snprintf(reply, len, "ok\n");
+	return 0;
+}
+
+static int cmd_wakers(const char *args, char *reply, size_t len)
+{
+	int top = args && *args ? atoi(args) : WAKERS_TOP;
+
+	wakers_report(reply, len, top > 0 ? top : WAKERS_TOP);
+	return 0;
+}
+
+static int cmd_help(const char *args, char *reply, size_t len)
+{
+	size_t used = 0;
+
+	reply[0] = '\0';
+	for (size_t i = 0; i < array_count(commands) && used < len; ++i)
+		used += snprintf(reply + used, len - used, "%s%s", commands[i].name,
+				 i + 1 < array_count(commands) ? " " : "\n");
+	return 0;
+}
+
+static void ctl_accept(int fd, short revents, void *data)
+{
+	ctl_client_t *client = NULL;
+	int cfd;
+
+	cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (cfd < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			LOG_SIMPLE_ERR("accept");
+		return;
+	}
+
+	for (ctl_client_t *c = clients; c < clients + array_count(clients); ++c) {
+		if (! c->active) {
+			client = c;
+			break;
+		}
+	}
+
+	if (! client || event_add_fd(cfd, POLLIN, ctl_client_read, client) < 0) {
+		close(cfd);
+		return;
+	}
+
+	client->active = true;
+	client->fd = cfd;
+	client->len = 0;
+	/* one that never sends its line doesn't keep the slot */
+	event_timer_set(CTL_TIMEOUT_MS, ctl_client_timeout, client);
+}
+
+static void ctl_client_read(int fd, short revents, void *data)
+{
+	ctl_client_t *client = data;
+	char reply[CTL_MAX_REPLY];
+	ssize_t nread;
+
+	nread = read(fd, client->line + client->len,
+		     sizeof(client->line) - client->len - 1);
+	if (nread < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	if (nread > 0) {
+		client->len += nread;
+		client->line[client->len] = '\0';
+
+		/* wait for the rest of the line unless the buffer is full */
+		if (! memchr(client->line, '\n', client->len) &&
+		    client->len < sizeof(client->line) - 1)
+			return;
+	}
+
+	if (client->len) {
+		ctl_execute(client->line, reply, sizeof(reply));
+		if (write(fd, reply, strlen(reply)) < 0)
+			LOG_SIMPLE_ERR("ctl write");
+	}
+
+	ctl_client_close(client);
+}
+
+static void ctl_client_timeout(void *data)
+{
+	ctl_client_close(data);
+}
+
+static void ctl_client_close(ctl_client_t *client)
+{
+	if (! client->active)
+		return;
+
+	event_timer_cancel(ctl_client_timeout, client);
+	event_del_fd(client->fd);
+	close(client->fd);
+	client->active = false;
+	client->len = 0;
+}
@@ -0,0 +1,15 @@
+#ifndef _CTL_H_
+#define _CTL_H_
+
+#include <stddef.h>
+
+#define CTL_MAX_CLIENTS 4
+#define CTL_MAX_LINE 128
+#define CTL_MAX_REPLY 2048	/* fits the wakers report */
+#define CTL_TIMEOUT_MS 5000
+
+extern int ctl_listen(const char *path);
+extern void ctl_close();
+extern int ctl_execute(char *line, char *reply, size_t len);
+
+#endif /* _CTL_H_ */
@@ -33,3 +33,13 @@ void *ec_calloc(size_t nelems, size_t nbytes)
 	return ptr;
 }
 
+void *ec_realloc(void *ptr, size_t nbytes)
+{
+	void *newptr;
+
+	newptr = ec_allocated(realloc(ptr, nbytes));
+#if _DEBUG_LOG
+	thinkd_log(LOG_DEBUG, "realloc: address=%p; size=%zu", newptr, nbytes);
+#endif
+	return newptr;
+}
@@ -5,5 +5,6 @@
 
 void *ec_malloc(size_t nbytes);
 void *ec_calloc(size_t nelems, size_t nbytes);
+void *ec_realloc(void *ptr, size_t nbytes);
 
 #endif /* _EC_LIB_H_ */
@@ -0,0 +1,242 @@
+#define _GNU_SOURCE 1
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stdbool.h>
+
+#include "void.h"
+#include "events.h"
+#include "logger.h"
+
+/*
+ * A tiny poll() based event loop. File descriptors are watched through
+ * a static pollfd array and one-shot timers are kept in a small table,
+ * so the daemon only wakes up when the kernel has something for us or
+ * when a timer deadline passes.
+ */
+
+typedef struct __event_source {
+	event_fd_cb cb;
+	void *data;
+} event_source_t;
+
+typedef struct __event_timer {
+	uint64_t deadline;
+	event_timer_cb cb;
+	void *data;
+} event_timer_t;
+
+static struct pollfd poll_fds[MAX_EVENT_SOURCES];
+static event_source_t sources[MAX_EVENT_SOURCES];
+static size_t num_sources;
+static event_timer_t timers[MAX_EVENT_TIMERS];
+static uint64_t wakeups;
+static bool virtual_clock;
+static uint64_t virtual_now;
+static sigset_t wait_mask;
+static bool wait_mask_set;
+
+static int next_timeout();
+static void run_timers();
+
+/* number of times poll() returned, i.e. how often the daemon woke up */
+uint64_t event_wakeups()
+{
+	return wakeups;
+}
+
+/*
+ * Drive the timers from a virtual clock starting at `now_ms`: from then on
+ * event_dispatch() doesn't sleep or watch file descriptors but jumps
+ * straight to the next deadline. This is what lets a trace replay run the
+ * real probe loop at many times real speed.
+ */
+void event_set_virtual_clock(uint64_t now_ms)
+{
+	virtual_clock = true;
+	virtual_now = now_ms;
+}
+
+/*
+ * Signals blocked by the caller are only let in while waiting, with `mask`
+ * as the signal mask. A signal that came in while the callbacks ran stays
+ * pending and cuts the next wait short, so its flag is never left unseen
+ * until some timer happens to fire.
+ */
+void event_set_sigmask(const sigset_t *mask)
+{
+	wait_mask = *mask;
+	wait_mask_set = true;
+}
+
+uint64_t event_now_ms()
+{
+	struct timespec ts;
+
+	if (virtual_clock)
+		return virtual_now;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int event_add_fd(int fd, short events, event_fd_cb cb, void *data)
+{
+	size_t idx;
+
+	/* reuse a slot freed by event_del_fd() */
+	for (idx = 0; idx < num_sources; ++idx) {
+		if (poll_fds[idx].fd < 0)
+			break;
+	}
+
+	if (idx == num_sources) {
+		if (num_sources == MAX_EVENT_SOURCES) {
+			thinkd_log(LOG_ERR, "too many event sources, ignoring fd %d", fd);
+			return -1;
+		}
+		++num_sources;
+	}
+
+	poll_fds[idx].fd = fd;
+	poll_fds[idx].events = events;
+	poll_fds[idx].revents = 0;
+	sources[idx].cb = cb;
+	sources[idx].data = data;
+
+	return 0;
+}
+
+void event_del_fd(int fd)
+{
+	for (size_t idx = 0; idx < num_sources; ++idx) {
+		if (poll_fds[idx].fd != fd)
+			continue;
+
+		/* negative fds are ignored by poll() */
+		poll_fds[idx].fd = -1;
+		poll_fds[idx].revents = 0;
+		sources[idx].cb = NULL;
+		sources[idx].data = NULL;
+	}
+
+	while (num_sources && poll_fds[num_sources - 1].fd < 0)
+		--num_sources;
+}
+
+int event_timer_set(unsigned int msecs, event_timer_cb cb, void *data)
+{
+	event_timer_t *free_slot = NULL;
+
+	for (event_timer_t *t = timers; t < timers + array_count(timers); ++t) {
+		if (t->cb == cb && t->data == data) {
+			t->deadline = event_now_ms() + msecs;
+			return 0;
+		}
+
+		if (! t->cb && ! free_slot)
+			free_slot = t;
+	}
+
+	if (! free_slot) {
+		thinkd_log(LOG_ERR, "too many event timers");
+		return -1;
+	}
+
+	free_slot->deadline = event_now_ms() + msecs;
+	free_slot->cb = cb;
+	free_slot->data = data;
+
+	return 0;
+}
+
+void event_timer_cancel(event_timer_cb cb, void *data)
+{
+	for (event_timer_t *t = timers; t < timers + array_count(timers); ++t) {
+		if (t->cb == cb && t->data == data)
+			memset(t, 0, sizeof(struct __event_timer));
+	}
+}
+
+/*
+ * Wait for one round of events and run their callbacks. Returns the number
+ * of ready file descriptors, or -1 when ppoll() failed or was interrupted
+ * by a signal. On a virtual clock -1 means no timer is left to run.
+ */
+int event_dispatch()
+{
+	struct timespec ts, *tsp = NULL;
+	int ready, timeout;
+
+	if (virtual_clock) {
+		if ((timeout = next_timeout()) < 0)
+			return -1;
+
+		virtual_now += timeout;
+		++wakeups;
+		run_timers();
+		return 0;
+	}
+
+	if ((timeout = next_timeout()) >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (long) (timeout % 1000) * 1000000;
+		tsp = &ts;
+	}
+
+	ready = ppoll(poll_fds, num_sources, tsp, wait_mask_set ? &wait_mask : NULL);
+	++wakeups;
+	if (ready < 0) {
+		if (errno != EINTR)
+			LOG_SIMPLE_ERR("ppoll");
+		return -1;
+	}
+
+	for (size_t idx = 0; ready && idx < num_sources; ++idx) {
+		short revents = poll_fds[idx].revents;
+
+		if (! revents)
+			continue;
+
+		poll_fds[idx].revents = 0;
+		if (sources[idx].cb)
+			sources[idx].cb(poll_fds[idx].fd, revents, sources[idx].data);
+	}
+
+	run_timers();
+
+	return ready;
+}
+
+static int next_timeout()
+{
+	uint64_t now, nearest = UINT64_MAX;
+
+	for (event_timer_t *t = timers; t < timers + array_count(timers); ++t) {
+		if (t->cb && t->deadline < nearest)
+			nearest = t->deadline;
+	}
+
+	if (nearest == UINT64_MAX)
+		return -1;
+
+	now = event_now_ms();
+	return nearest > now ? (int) (nearest - now) : 0;
+}
+
+static void run_timers()
+{
+	uint64_t now = event_now_ms();
+
+	for (event_timer_t *t = timers; t < timers + array_count(timers); ++t) {
+		event_timer_cb cb = t->cb;
+		void *data = t->data;
+
+		if (! cb || t->deadline > now)
+			continue;
+
+		/* clear first so the callback can re-arm itself */
+		memset(t, 0, sizeof(struct __event_timer));
+		cb(data);
+	}
+}
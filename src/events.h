@@ -0,0 +1,24 @@
+#ifndef _EVENTS_H_
+#define _EVENTS_H_
+
+#include <stdint.h>
+#include <poll.h>
+#include <signal.h>
+
+#define MAX_EVENT_SOURCES 32
+#define MAX_EVENT_TIMERS 32
+
+typedef void (*event_fd_cb)(int fd, short revents, void *data);
+typedef void (*event_timer_cb)(void *data);
+
+extern int event_add_fd(int fd, short events, event_fd_cb cb, void *data);
+extern void event_del_fd(int fd);
+extern int event_timer_set(unsigned int msecs, event_timer_cb cb, void *data);
+extern void event_timer_cancel(event_timer_cb cb, void *data);
+extern int event_dispatch();
+extern uint64_t event_now_ms();
+extern uint64_t event_wakeups();
+extern void event_set_virtual_clock(uint64_t now_ms);
+extern void event_set_sigmask(const sigset_t *mask);
+
+#endif /* _EVENTS_H_ */
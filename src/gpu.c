@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "void.h"
+#include "gpu.h"
+#include "acpi.h"
+#include "logger.h"
+
+/*
+ * The GPU knobs need to know which card a driver runs, which doesn't
+ * change while the machine is up, so /sys/class/drm is only walked once.
+ * Connectors like card0-eDP-1 share the directory and are skipped.
+ */
+
+static const char *const driver_names[GPU_DRIVERS] = {
+	[GPU_I915] = "i915",
+	[GPU_AMDGPU] = "amdgpu",
+};
+
+const char *const gpu_level_names[GPU_LEVELS] = {
+	"", "auto", "low", "high", "manual",
+	"profile_standard", "profile_min_sclk", "profile_peak",
+};
+
+/* in the order of the kernel's PP_SMC_POWER_PROFILE */
+const char *const gpu_profile_names[GPU_PROFILES] = {
+	"bootup_default", "3d_full_screen", "power_saving", "video", "vr",
+	"compute", "custom",
+};
+
+static sysfs_path_t cards[GPU_DRIVERS];
+
+static int gpu_add(int dirfd, const char *name, void *data);
+
+/* the number of cards with a known driver */
+int gpu_discover()
+{
+	sysfs_path_t drm_dir;
+	int found = 0;
+
+	memset(cards, 0, sizeof(cards));
+	sysroot_sprintf(drm_dir, "%s", GPU_DRM_DIR);
+	/* no GPU, or no DRM at all */
+	if (sysfs_foreach_entry(drm_dir, gpu_add, drm_dir) < 0)
+		return 0;
+
+	for (int i = 0; i < GPU_DRIVERS; ++i) {
+		if (! cards[i][0])
+			continue;
+		thinkd_log(LOG_INFO, "gpu: %s drives %s", driver_names[i], cards[i]);
+		++found;
+	}
+
+	return found;
+}
+
+/* the directory of the first card driven by `driver`, NULL without one */
+const char *gpu_card(gpu_driver_t driver)
+{
+	return cards[driver][0] ? cards[driver] : NULL;
+}
+
+static int gpu_add(int dirfd, const char *name, void *data)
+{
+	const char *drm_dir = data;
+	sysfs_path_t link, target;
+	const char *driver;
+	unsigned int index;
+	char tail;
+	ssize_t len;
+
+	if (sscanf(name, "card%u%c", &index, &tail) != 1)
+		return 0;
+
+	sysfs_sprintf(link, "%s/device/driver", name);
+	len = readlinkat(dirfd, link, target, sizeof(target) - 1);
+	if (len < 0)
+		return 0;
+	target[len] = '\0';
+	driver = strrchr(target, '/') ? strrchr(target, '/') + 1 : target;
+
+	for (int i = 0; i < GPU_DRIVERS; ++i) {
+		if (strcmp(driver, driver_names[i]) == 0 && ! cards[i][0])
+			sysfs_sprintf(cards[i], "%s/%s", drm_dir, name);
+	}
+
+	return 0;
+}
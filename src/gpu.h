@@ -0,0 +1,29 @@
+#ifndef _GPU_H_
+#define _GPU_H_
+
+#include "config.h"
+
+#define GPU_DRM_DIR "/sys/class/drm"
+
+typedef enum __gpu_driver {
+	GPU_I915,
+	GPU_AMDGPU,
+	GPU_DRIVERS,
+} gpu_driver_t;
+
+/* amdgpu power_dpm_force_performance_level values, 0 leaves it alone */
+#define GPU_LEVELS 8
+/* amdgpu pp_power_profile_mode names, stored as index + 1 */
+#define GPU_PROFILES 7
+
+extern const char *const gpu_level_names[GPU_LEVELS];
+extern const char *const gpu_profile_names[GPU_PROFILES];
+
+#if WITH_GPU_KNOBS
+extern int gpu_discover();
+#else
+static inline int gpu_discover() { return 0; }
+#endif
+extern const char *gpu_card(gpu_driver_t driver);
+
+#endif /* _GPU_H_ */
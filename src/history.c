@@ -0,0 +1,584 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "void.h"
+#include "history.h"
+#include "conf_utils.h"
+#include "events.h"
+#include "logger.h"
+
+/*
+ * Battery history in a file of fixed size, for looking at capacity fade
+ * over weeks without a collector. After a header and an index with one
+ * entry per block, the file is a ring of HISTORY_BLOCK_SIZE blocks that
+ * are filled in memory and written whole; once the ring is full the
+ * oldest block is reused, so the file never grows past History_Max_Kb.
+ *
+ * Within a block every sample is a zigzag varint delta against the
+ * previous one of the same battery, usually 6 or 7 bytes in all:
+ *
+ *	time delta, flags (battery | ac << 3 | mode << 4),
+ *	capacity delta, power delta, energy_full delta
+ *
+ * The deltas start from zero in each block, so a block decodes on its
+ * own, and the index holds the time range of each block so a query only
+ * reads the blocks it needs. Values are stored in host byte order.
+ */
+
+#define HISTORY_MAGIC "THKDHIST"
+#define HISTORY_HEADER_SIZE 64
+#define HISTORY_MAX_RECORD 48
+#define HISTORY_INDEX_CHUNK 128
+
+typedef struct __history_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t block_size;
+	uint32_t blocks;
+	uint8_t reserved[HISTORY_HEADER_SIZE - 20];
+} history_header_t;
+
+typedef struct __history_index {
+	uint64_t seq;		/* order blocks were started in, 0 if never used */
+	int64_t first;		/* time of the first and last sample */
+	int64_t last;
+	uint32_t used;		/* bytes of samples */
+	uint32_t count;
+} history_index_t;
+
+/* what each delta is taken against */
+typedef struct __history_deltas {
+	int64_t time;
+	long capacity[HISTORY_MAX_BATTERIES];
+	long power[HISTORY_MAX_BATTERIES];
+	long energy_full[HISTORY_MAX_BATTERIES];
+} history_deltas_t;
+
+/* a query's running averages of the current step */
+typedef struct __history_acc {
+	history_point_t point;
+	long capacity_sum;
+	long long power_sum;
+	unsigned int ac_samples;
+} history_acc_t;
+
+const char *const history_mode_names[8] = {
+	"none", "powersave", "performance", "heavy_powersave", "critical",
+};
+
+static int history_fd = -1;
+static char history_path[MAX_CONF_STR_LEN];
+static unsigned int history_kb;
+static uint32_t num_blocks;
+static uint32_t slot;
+static bool slot_claimed;
+static bool dirty;
+static history_index_t current;
+static history_deltas_t deltas;
+static uint8_t block[HISTORY_BLOCK_SIZE];
+static uint64_t last_sample_ms, last_flush_ms;
+static unsigned long num_writes;
+
+static off_t index_offset(uint32_t n);
+static off_t block_offset(uint32_t n);
+static uint32_t blocks_for(unsigned int max_kb);
+static int history_create(int fd);
+static void block_start(uint32_t n, uint64_t seq);
+static unsigned int mode_index(const char *mode);
+static unsigned int battery_number(const char *name, size_t slot);
+static size_t put_varint(uint8_t *dest, uint64_t value);
+static bool get_varint(const uint8_t **src, const uint8_t *end, uint64_t *value);
+static size_t encode_sample(uint8_t *dest, const history_sample_t *s, history_deltas_t *d);
+static bool decode_sample(const uint8_t **src, const uint8_t *end, history_sample_t *s,
+			  history_deltas_t *d);
+static int compare_seq(const void *a, const void *b);
+static void acc_emit(history_acc_t *acc, history_cb cb, void *data);
+
+static inline uint64_t zigzag(int64_t value)
+{
+	return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value)
+{
+	return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+/* (re)open the History_File, or close it when it was cleared */
+int history_configure()
+{
+	unsigned int max_kb = daemon_prefs.history_max_kb > 0 ? daemon_prefs.history_max_kb : 0;
+
+	if (strcmp(history_path, daemon_prefs.history_file) == 0 && history_kb == max_kb)
+		return 0;
+
+	history_close();
+	if (! daemon_prefs.history_file[0])
+		return 0;
+
+	return history_open(daemon_prefs.history_file, max_kb);
+}
+
+/*
+ * Open or create a history file holding at most `max_kb` kilobytes. New
+ * samples always start a new block; a file of a different size is
+ * started over.
+ */
+int history_open(const char *path, unsigned int max_kb)
+{
+	history_index_t chunk[HISTORY_INDEX_CHUNK];
+	history_header_t header;
+	uint64_t newest_seq = 0;
+	uint32_t newest = 0;
+	int fd;
+
+	history_close();
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		thinkd_log(LOG_ERR, "history: cannot open %s: %s", path, strerror(errno));
+		return -1;
+	}
+
+	num_blocks = blocks_for(max_kb);
+	if (pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+	    memcmp(header.magic, HISTORY_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.version != HISTORY_VERSION || header.block_size != HISTORY_BLOCK_SIZE ||
+	    header.blocks != num_blocks) {
+		if (history_create(fd) < 0) {
+			thinkd_log(LOG_ERR, "history: cannot create %s: %s", path,
+				   strerror(errno));
+			close(fd);
+			return -1;
+		}
+	}
+
+	/* continue after the newest block */
+	for (uint32_t n = 0; n < num_blocks; n += HISTORY_INDEX_CHUNK) {
+		uint32_t len = num_blocks - n < HISTORY_INDEX_CHUNK ?
+			num_blocks - n : HISTORY_INDEX_CHUNK;
+
+		if (pread(fd, chunk, len * sizeof(chunk[0]), index_offset(n)) !=
+		    (ssize_t) (len * sizeof(chunk[0])))
+			break;
+		for (uint32_t i = 0; i < len; ++i) {
+			if (chunk[i].seq > newest_seq) {
+				newest_seq = chunk[i].seq;
+				newest = n + i;
+			}
+		}
+	}
+
+	history_fd = fd;
+	snprintf(history_path, sizeof(history_path), "%s", path);
+	history_kb = max_kb;
+	block_start(newest_seq ? (newest + 1) % num_blocks : 0, newest_seq + 1);
+	last_sample_ms = 0;
+	last_flush_ms = event_now_ms();
+	thinkd_log(LOG_INFO, "history: recording to %s, %u blocks of %d bytes",
+		   path, num_blocks, HISTORY_BLOCK_SIZE);
+
+	return 0;
+}
+
+void history_close()
+{
+	if (history_fd < 0)
+		return;
+
+	history_flush();
+	close(history_fd);
+	history_fd = -1;
+	history_path[0] = '\0';
+	history_kb = 0;
+}
+
+int history_append(const history_sample_t *sample)
+{
+	if (history_fd < 0 || sample->battery >= HISTORY_MAX_BATTERIES)
+		return -1;
+
+	/* a full block goes out, the next one reuses the oldest slot */
+	if (current.used + HISTORY_MAX_RECORD > HISTORY_BLOCK_SIZE) {
+		if (history_flush() < 0)
+			return -1;
+		block_start((slot + 1) % num_blocks, current.seq + 1);
+	}
+
+	if (! current.count) {
+		memset(&deltas, 0, sizeof(struct __history_deltas));
+		deltas.time = sample->time;
+		current.first = sample->time;
+	}
+
+	current.used += encode_sample(block + current.used, sample, &deltas);
+	current.last = sample->time;
+	++current.count;
+	dirty = true;
+
+	return 0;
+}
+
+/*
+ * Write the current block and its index entry. A reused slot's entry is
+ * cleared first, so a crash in between never pairs old times with new
+ * samples.
+ */
+int history_flush()
+{
+	history_index_t unused = { 0 };
+
+	if (history_fd < 0 || ! dirty)
+		return 0;
+
+	if (! slot_claimed) {
+		if (pwrite(history_fd, &unused, sizeof(unused), index_offset(slot)) < 0)
+			goto fail;
+		++num_writes;
+		slot_claimed = true;
+	}
+
+	if (pwrite(history_fd, block, HISTORY_BLOCK_SIZE, block_offset(slot)) !=
+	    HISTORY_BLOCK_SIZE ||
+	    pwrite(history_fd, &current, sizeof(current), index_offset(slot)) !=
+	    (ssize_t) sizeof(current))
+		goto fail;
+
+	num_writes += 2;
+	dirty = false;
+	last_flush_ms = event_now_ms();
+	return 0;
+
+fail:
+	thinkd_log(LOG_ERR, "history: cannot write %s: %s", history_path, strerror(errno));
+	return -1;
+}
+
+/*
+ * Called on every probe: samples every battery each History_Interval
+ * seconds and writes the block out once an hour, or when it is full.
+ */
+void history_record(acpi_psupply_t *ps, const char *mode, bool ac_online)
+{
+	uint64_t now = event_now_ms();
+	uint64_t interval = daemon_prefs.history_interval > 0 ? daemon_prefs.history_interval : 1;
+	history_sample_t sample;
+
+	if (history_fd < 0)
+		return;
+
+	if (last_sample_ms && now - last_sample_ms < interval * 1000) {
+		if (now - last_flush_ms >= HISTORY_FLUSH_SECONDS * 1000ULL)
+			history_flush();
+		return;
+	}
+	last_sample_ms = now;
+
+	/* probes only read the chargers */
+	psupply_read(ps, PSUPPLY_READ_BATTERIES);
+
+	sample.time = time(NULL);
+	sample.mode = mode_index(mode);
+	sample.ac_online = ac_online;
+	for (size_t n = 0; n < ps->count; ++n) {
+		if (ps->types[n] != PSUPPLY_BATTERY)
+			continue;
+
+		sample.battery = battery_number(ps->names[n], n);
+		sample.capacity = ps->capacity[n];
+		sample.power = ps->rate[n] / 1000;
+		sample.energy_full = ps->energy_full[n] / 1000;
+		history_append(&sample);
+	}
+
+	if (now - last_flush_ms >= HISTORY_FLUSH_SECONDS * 1000ULL)
+		history_flush();
+}
+
+/* pwrite() calls so far, to check the batching */
+unsigned long history_writes()
+{
+	return num_writes;
+}
+
+/*
+ * Call `cb` with the averages of every battery over each `step` seconds
+ * in [from, to), oldest first. Only the blocks whose time range overlaps
+ * are read. Returns the number of points or -1.
+ */
+int history_query(const char *path, int64_t from, int64_t to, int step,
+		  history_cb cb, void *data)
+{
+	history_acc_t acc[HISTORY_MAX_BATTERIES];
+	history_header_t header;
+	history_index_t *index;
+	uint8_t buffer[HISTORY_BLOCK_SIZE];
+	uint32_t matches = 0;
+	int fd, points = 0;
+
+	if (step <= 0 || to <= from)
+		return 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+	    memcmp(header.magic, HISTORY_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.version != HISTORY_VERSION || header.block_size != HISTORY_BLOCK_SIZE) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	index = calloc(header.blocks, sizeof(*index));
+	if (! index ||
+	    pread(fd, index, header.blocks * sizeof(*index), HISTORY_HEADER_SIZE) !=
+	    (ssize_t) (header.blocks * sizeof(*index))) {
+		free(index);
+		close(fd);
+		return -1;
+	}
+
+	/* keep the overlapping blocks, in the order they were written */
+	for (uint32_t n = 0; n < header.blocks; ++n) {
+		if (! index[n].seq || ! index[n].count ||
+		    index[n].last < from || index[n].first >= to)
+			continue;
+		index[n].used = index[n].used > HISTORY_BLOCK_SIZE ?
+			HISTORY_BLOCK_SIZE : index[n].used;
+		/* the slot rides along in `count`, which isn't needed anymore */
+		index[n].count = n;
+		index[matches++] = index[n];
+	}
+	qsort(index, matches, sizeof(*index), compare_seq);
+
+	memset(acc, 0, sizeof(acc));
+	for (uint32_t m = 0; m < matches; ++m) {
+		off_t offset = (off_t) (HISTORY_HEADER_SIZE + header.blocks * sizeof(*index) +
+					HISTORY_BLOCK_SIZE - 1) / HISTORY_BLOCK_SIZE *
+			HISTORY_BLOCK_SIZE + (off_t) index[m].count * HISTORY_BLOCK_SIZE;
+		const uint8_t *p = buffer, *end = buffer + index[m].used;
+		history_deltas_t d;
+		history_sample_t s;
+
+		if (pread(fd, buffer, index[m].used, offset) != (ssize_t) index[m].used)
+			continue;
+
+		memset(&d, 0, sizeof(d));
+		d.time = index[m].first;
+		while (decode_sample(&p, end, &s, &d)) {
+			history_acc_t *a = &acc[s.battery];
+			int64_t start;
+
+			if (s.time < from || s.time >= to)
+				continue;
+
+			start = from + (s.time - from) / step * step;
+			if (a->point.samples && a->point.time != start) {
+				acc_emit(a, cb, data);
+				++points;
+			}
+
+			a->point.time = start;
+			a->point.battery = s.battery;
+			a->point.mode = s.mode;
+			a->point.energy_full = s.energy_full;
+			++a->point.samples;
+			a->capacity_sum += s.capacity;
+			a->power_sum += s.power;
+			a->ac_samples += s.ac_online;
+		}
+	}
+
+	for (int b = 0; b < HISTORY_MAX_BATTERIES; ++b) {
+		if (acc[b].point.samples) {
+			acc_emit(&acc[b], cb, data);
+			++points;
+		}
+	}
+
+	free(index);
+	close(fd);
+	return points;
+}
+
+static off_t index_offset(uint32_t n)
+{
+	return HISTORY_HEADER_SIZE + (off_t) n * sizeof(history_index_t);
+}
+
+/* the blocks start on the first block boundary after the index */
+static off_t block_offset(uint32_t n)
+{
+	off_t start = index_offset(num_blocks);
+
+	start = (start + HISTORY_BLOCK_SIZE - 1) / HISTORY_BLOCK_SIZE * HISTORY_BLOCK_SIZE;
+	return start + (off_t) n * HISTORY_BLOCK_SIZE;
+}
+
+static uint32_t blocks_for(unsigned int max_kb)
+{
+	uint32_t blocks = max_kb / (HISTORY_BLOCK_SIZE / 1024);
+
+	/* the index takes some of the room */
+	while (blocks > HISTORY_MIN_BLOCKS &&
+	       (blocks + 1) * HISTORY_BLOCK_SIZE + index_offset(blocks) > max_kb * 1024ULL)
+		--blocks;
+	return blocks < HISTORY_MIN_BLOCKS ? HISTORY_MIN_BLOCKS : blocks;
+}
+
+/* a sparse file of the final size, with an empty index */
+static int history_create(int fd)
+{
+	history_header_t header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, HISTORY_MAGIC, sizeof(header.magic));
+	header.version = HISTORY_VERSION;
+	header.block_size = HISTORY_BLOCK_SIZE;
+	header.blocks = num_blocks;
+
+	if (ftruncate(fd, 0) < 0 || ftruncate(fd, block_offset(num_blocks)) < 0 ||
+	    pwrite(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header))
+		return -1;
+
+	thinkd_log(LOG_INFO, "history: started a new file");
+	return 0;
+}
+
+static void block_start(uint32_t n, uint64_t seq)
+{
+	memset(block, 0, sizeof(block));
+	memset(&current, 0, sizeof(current));
+	current.seq = seq;
+	slot = n;
+	slot_claimed = false;
+	dirty = false;
+}
+
+static unsigned int mode_index(const char *mode)
+{
+	for (unsigned int i = 1; i < array_count(history_mode_names); ++i) {
+		if (history_mode_names[i] && mode && strcmp(mode, history_mode_names[i]) == 0)
+			return i;
+	}
+
+	return 0;
+}
+
+/* BAT0 is 0, batteries without a number go by their slot */
+static unsigned int battery_number(const char *name, size_t slot)
+{
+	const char *digits = name + strlen(name);
+
+	while (digits > name && isdigit((unsigned char) digits[-1]))
+		--digits;
+	if (*digits)
+		return (unsigned int) strtoul(digits, NULL, 10) % HISTORY_MAX_BATTERIES;
+	return (unsigned int) slot % HISTORY_MAX_BATTERIES;
+}
+
+static size_t put_varint(uint8_t *dest, uint64_t value)
+{
+	size_t len = 0;
+
+	while (value >= 0x80) {
+		dest[len++] = (uint8_t) value | 0x80;
+		value >>= 7;
+	}
+	dest[len++] = (uint8_t) value;
+
+	return len;
+}
+
+static bool get_varint(const uint8_t **src, const uint8_t *end, uint64_t *value)
+{
+	const uint8_t *p = *src;
+	unsigned int shift = 0;
+
+	*value = 0;
+	while (p < end && shift < 64) {
+		*value |= (uint64_t) (*p & 0x7f) << shift;
+		if (! (*p++ & 0x80)) {
+			*src = p;
+			return true;
+		}
+		shift += 7;
+	}
+
+	return false;
+}
+
+static size_t encode_sample(uint8_t *dest, const history_sample_t *s, history_deltas_t *d)
+{
+	unsigned int b = s->battery;
+	size_t len = 0;
+
+	len += put_varint(dest + len, zigzag(s->time - d->time));
+	dest[len++] = (uint8_t) (b | (s->ac_online ? 1 << 3 : 0) | (s->mode & 7) << 4);
+	len += put_varint(dest + len, zigzag(s->capacity - d->capacity[b]));
+	len += put_varint(dest + len, zigzag(s->power - d->power[b]));
+	len += put_varint(dest + len, zigzag(s->energy_full - d->energy_full[b]));
+
+	d->time = s->time;
+	d->capacity[b] = s->capacity;
+	d->power[b] = s->power;
+	d->energy_full[b] = s->energy_full;
+	return len;
+}
+
+static bool decode_sample(const uint8_t **src, const uint8_t *end, history_sample_t *s,
+			  history_deltas_t *d)
+{
+	uint64_t time, capacity, power, energy_full;
+	unsigned int b;
+	uint8_t flags;
+
+	if (! get_varint(src, end, &time) || *src >= end)
+		return false;
+	flags = *(*src)++;
+	if (! get_varint(src, end, &capacity) || ! get_varint(src, end, &power) ||
+	    ! get_varint(src, end, &energy_full))
+		return false;
+
+	b = flags & 7;
+	d->time += unzigzag(time);
+	d->capacity[b] += (long) unzigzag(capacity);
+	d->power[b] += (long) unzigzag(power);
+	d->energy_full[b] += (long) unzigzag(energy_full);
+
+	s->time = d->time;
+	s->battery = b;
+	s->ac_online = flags & (1 << 3);
+	s->mode = flags >> 4 & 7;
+	s->capacity = (int) d->capacity[b];
+	s->power = d->power[b];
+	s->energy_full = d->energy_full[b];
+	return true;
+}
+
+static int compare_seq(const void *a, const void *b)
+{
+	uint64_t x = ((const history_index_t *) a)->seq;
+	uint64_t y = ((const history_index_t *) b)->seq;
+
+	return x < y ? -1 : x > y;
+}
+
+static void acc_emit(history_acc_t *acc, history_cb cb, void *data)
+{
+	history_point_t *p = &acc->point;
+
+	p->capacity = (int) (acc->capacity_sum / p->samples);
+	p->power = (long) (acc->power_sum / p->samples);
+	p->ac_percent = (int) (acc->ac_samples * 100 / p->samples);
+	cb(p, data);
+
+	memset(acc, 0, sizeof(struct __history_acc));
+}
@@ -0,0 +1,52 @@
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "psupply.h"
+
+#define HISTORY_VERSION 1
+#define HISTORY_BLOCK_SIZE 4096
+#define HISTORY_MIN_BLOCKS 4
+#define HISTORY_MAX_BATTERIES 8
+#define HISTORY_FLUSH_SECONDS 3600	/* longest a partial block stays in memory */
+
+/* one reading of one battery */
+typedef struct __history_sample {
+	int64_t time;		/* s since the epoch */
+	unsigned int battery;	/* the number in its name, BAT1 is 1 */
+	unsigned int mode;	/* index into history_mode_names */
+	bool ac_online;
+	int capacity;		/* percent */
+	long power;		/* mW (or mA), negative while discharging */
+	long energy_full;	/* mWh (or mAh) */
+} history_sample_t;
+
+/* the samples of one battery within one step of a query, averaged */
+typedef struct __history_point {
+	int64_t time;		/* start of the step */
+	unsigned int battery;
+	unsigned int samples;
+	unsigned int mode;	/* of the last sample */
+	int ac_percent;		/* of the samples taken on AC */
+	int capacity;
+	long power;
+	long energy_full;	/* of the last sample */
+} history_point_t;
+
+typedef void (*history_cb)(const history_point_t *point, void *data);
+
+extern const char *const history_mode_names[8];
+
+extern int history_configure();
+extern int history_open(const char *path, unsigned int max_kb);
+extern void history_close();
+extern int history_append(const history_sample_t *sample);
+extern int history_flush();
+extern void history_record(acpi_psupply_t *ps, const char *mode, bool ac_online);
+extern unsigned long history_writes();
+extern int history_query(const char *path, int64_t from, int64_t to, int step,
+			 history_cb cb, void *data);
+
+#endif /* _HISTORY_H_ */
@@ -0,0 +1,383 @@
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "void.h"
+#include "hooks.h"
+#include "conf_utils.h"
+#include "events.h"
+#include "logger.h"
+
+/*
+ * Commands from the [hooks] section run when a mode is left or entered,
+ * like powersave_enter=systemctl stop syncthing. A transition only
+ * queues them; they are started from the main loop afterwards with
+ * posix_spawn(), which doesn't copy the daemon's memory, each in its own
+ * process group under /bin/sh -c. Their stdout and stderr are logged a
+ * line at a time, their exits are seen through a pidfd, and one that
+ * outlives Timeout seconds gets SIGTERM and then SIGKILL. Nothing ever
+ * waits for a hook, so it can't hold up probes or mode switches.
+ */
+
+typedef struct __hook {
+	pid_t pid;		/* 0 for a free slot */
+	int pidfd;		/* -1 when polled with waitpid() */
+	int out;		/* read end of its stdout and stderr */
+	bool killed;
+	uint64_t started;
+	char name[32];		/* like powersave_enter */
+	size_t len;
+	char line[HOOKS_OUTPUT_LINE];
+} hook_t;
+
+typedef struct __hook_request {
+	char name[32];
+	char mode[32];		/* the one entered */
+	char previous[32];
+} hook_request_t;
+
+static const struct {
+	const char *name;
+	size_t offset;
+} hook_commands[] = {
+	{"powersave_enter", offsetof(hook_prefs_t, powersave_enter)},
+	{"powersave_exit", offsetof(hook_prefs_t, powersave_exit)},
+	{"performance_enter", offsetof(hook_prefs_t, performance_enter)},
+	{"performance_exit", offsetof(hook_prefs_t, performance_exit)},
+	{"heavy_powersave_enter", offsetof(hook_prefs_t, heavy_powersave_enter)},
+	{"heavy_powersave_exit", offsetof(hook_prefs_t, heavy_powersave_exit)},
+	{"critical_enter", offsetof(hook_prefs_t, critical_enter)},
+	{"critical_exit", offsetof(hook_prefs_t, critical_exit)},
+};
+
+static hook_t hooks[HOOKS_SLOTS];
+static hook_request_t queue[HOOKS_MAX_QUEUED];
+static unsigned int queue_head, queue_len;
+
+static const char *hook_command(const char *name);
+static void hook_queue(const char *mode, const char *event, const char *to,
+		       const char *from);
+static void hooks_start(void *data);
+static int hook_spawn(hook_t *h, const char *command, const hook_request_t *req);
+static void hook_output(int fd, short revents, void *data);
+static void hook_drain(hook_t *h);
+static void hook_exited(int fd, short revents, void *data);
+static void hook_poll(void *data);
+static void hook_reap(hook_t *h);
+static void hook_timeout(void *data);
+static void hook_kill(void *data);
+
+/*
+ * Queue the exit hook of `from` (NULL on startup) and the enter hook of
+ * `to`, to be started once the caller is back in the event loop.
+ */
+void hooks_transition(const char *from, const char *to)
+{
+	if (from)
+		hook_queue(from, "exit", to, from);
+	hook_queue(to, "enter", to, from);
+
+	if (queue_len)
+		event_timer_set(0, hooks_start, NULL);
+}
+
+unsigned int hooks_running()
+{
+	unsigned int count = 0;
+
+	for (hook_t *h = hooks; h < hooks + array_count(hooks); ++h)
+		count += h->pid != 0;
+
+	return count;
+}
+
+/* on exit: running hooks are left to finish, but not waited for */
+void hooks_close()
+{
+	event_timer_cancel(hooks_start, NULL);
+	queue_len = 0;
+
+	for (hook_t *h = hooks; h < hooks + array_count(hooks); ++h) {
+		if (! h->pid)
+			continue;
+		event_timer_cancel(hook_timeout, h);
+		event_timer_cancel(hook_kill, h);
+		event_timer_cancel(hook_poll, h);
+		if (h->out >= 0) {
+			event_del_fd(h->out);
+			close(h->out);
+		}
+		if (h->pidfd >= 0) {
+			event_del_fd(h->pidfd);
+			close(h->pidfd);
+		}
+		h->pid = 0;
+	}
+}
+
+static const char *hook_command(const char *name)
+{
+	for (size_t i = 0; i < array_count(hook_commands); ++i) {
+		if (strcmp(hook_commands[i].name, name) == 0)
+			return (const char *) &hook_prefs + hook_commands[i].offset;
+	}
+
+	return "";
+}
+
+static void hook_queue(const char *mode, const char *event, const char *to,
+		       const char *from)
+{
+	hook_request_t *req;
+	char name[32];
+
+	snprintf(name, sizeof(name), "%s_%s", mode, event);
+	if (! hook_command(name)[0])
+		return;
+
+	if (queue_len == HOOKS_MAX_QUEUED) {
+		thinkd_log(LOG_ERR, "hooks: %d waiting already, dropping %s",
+			   HOOKS_MAX_QUEUED, name);
+		return;
+	}
+
+	req = &queue[(queue_head + queue_len++) % HOOKS_MAX_QUEUED];
+	snprintf(req->name, sizeof(req->name), "%s", name);
+	snprintf(req->mode, sizeof(req->mode), "%s", to);
+	snprintf(req->previous, sizeof(req->previous), "%s", from ? from : "");
+}
+
+/* start what is queued, in order, while there are free slots */
+static void hooks_start(void *data)
+{
+	unsigned int limit = hook_prefs.max_running;
+
+	(void) data;
+	if (limit < 1)
+		limit = 1;
+	if (limit > HOOKS_SLOTS)
+		limit = HOOKS_SLOTS;
+
+	while (queue_len && hooks_running() < limit) {
+		hook_request_t *req = &queue[queue_head];
+		const char *command = hook_command(req->name);
+		hook_t *h = hooks;
+
+		queue_head = (queue_head + 1) % HOOKS_MAX_QUEUED;
+		--queue_len;
+
+		/* it may have been removed by a reload since */
+		if (! command[0])
+			continue;
+
+		while (h->pid)
+			++h;
+		hook_spawn(h, command, req);
+	}
+}
+
+static int hook_spawn(hook_t *h, const char *command, const hook_request_t *req)
+{
+	char env_hook[64], env_mode[64], env_previous[64];
+	char *const argv[] = { "/bin/sh", "-c", (char *) command, NULL };
+	char *const envp[] = {
+		"PATH=/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin",
+		env_hook, env_mode, env_previous, NULL
+	};
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t signals;
+	int pipefd[2], err;
+
+	snprintf(env_hook, sizeof(env_hook), "THINKD_HOOK=%s", req->name);
+	snprintf(env_mode, sizeof(env_mode), "THINKD_MODE=%s", req->mode);
+	snprintf(env_previous, sizeof(env_previous), "THINKD_PREVIOUS_MODE=%s", req->previous);
+
+	/* only our end is non-blocking, the hook writes normally */
+	if (pipe2(pipefd, O_CLOEXEC) < 0) {
+		LOG_SIMPLE_ERR("hooks: pipe2");
+		return -1;
+	}
+	fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDERR_FILENO);
+
+	/* a group of its own, so a timeout kills whatever it started too */
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK |
+				 POSIX_SPAWN_SETSIGDEF);
+	posix_spawnattr_setpgroup(&attr, 0);
+	sigemptyset(&signals);
+	posix_spawnattr_setsigmask(&attr, &signals);
+	sigfillset(&signals);
+	posix_spawnattr_setsigdefault(&attr, &signals);
+
+	err = posix_spawn(&h->pid, argv[0], &actions, &attr, argv, envp);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	close(pipefd[1]);
+	if (err) {
+		thinkd_log(LOG_ERR, "hooks: cannot run %s: %s", req->name, strerror(err));
+		close(pipefd[0]);
+		h->pid = 0;
+		return -1;
+	}
+
+	snprintf(h->name, sizeof(h->name), "%s", req->name);
+	h->out = pipefd[0];
+	h->killed = false;
+	h->started = event_now_ms();
+	h->len = 0;
+	event_add_fd(h->out, POLLIN, hook_output, h);
+
+#ifdef SYS_pidfd_open
+	h->pidfd = (int) syscall(SYS_pidfd_open, h->pid, 0);
+#else
+	h->pidfd = -1;
+#endif
+	if (h->pidfd >= 0)
+		event_add_fd(h->pidfd, POLLIN, hook_exited, h);
+	else
+		event_timer_set(HOOKS_POLL_MS, hook_poll, h);
+
+	if (hook_prefs.timeout > 0)
+		event_timer_set(hook_prefs.timeout * 1000, hook_timeout, h);
+
+	thinkd_log(LOG_INFO, "hooks: %s started, pid %d", h->name, (int) h->pid);
+	return 0;
+}
+
+/* log whole lines, splitting the ones longer than the buffer */
+static void hook_output(int fd, short revents, void *data)
+{
+	hook_t *h = data;
+	ssize_t nread;
+
+	(void) revents;
+	while ((nread = read(fd, h->line + h->len, sizeof(h->line) - 1 - h->len)) > 0) {
+		char *start = h->line, *newline;
+
+		h->len += nread;
+		while ((newline = memchr(start, '\n', h->line + h->len - start))) {
+			thinkd_log(LOG_INFO, "hooks: %s: %.*s", h->name,
+				   (int) (newline - start), start);
+			start = newline + 1;
+		}
+
+		h->len -= start - h->line;
+		memmove(h->line, start, h->len);
+		if (h->len == sizeof(h->line) - 1) {
+			thinkd_log(LOG_INFO, "hooks: %s: %.*s", h->name, (int) h->len, h->line);
+			h->len = 0;
+		}
+	}
+
+	if (nread < 0 && errno == EAGAIN)
+		return;
+
+	/* the hook and everything it started closed their output */
+	hook_drain(h);
+}
+
+static void hook_drain(hook_t *h)
+{
+	if (h->out < 0)
+		return;
+
+	if (h->len)
+		thinkd_log(LOG_INFO, "hooks: %s: %.*s", h->name, (int) h->len, h->line);
+	h->len = 0;
+	event_del_fd(h->out);
+	close(h->out);
+	h->out = -1;
+}
+
+static void hook_exited(int fd, short revents, void *data)
+{
+	(void) fd;
+	(void) revents;
+	hook_reap(data);
+}
+
+static void hook_poll(void *data)
+{
+	hook_t *h = data;
+
+	hook_reap(h);
+	if (h->pid)
+		event_timer_set(HOOKS_POLL_MS, hook_poll, h);
+}
+
+static void hook_reap(hook_t *h)
+{
+	uint64_t runtime;
+	int status;
+
+	if (waitpid(h->pid, &status, WNOHANG) != h->pid)
+		return;
+
+	runtime = event_now_ms() - h->started;
+	/* pick up what it wrote right before exiting */
+	if (h->out >= 0)
+		hook_output(h->out, POLLIN, h);
+	hook_drain(h);
+
+	if (h->killed) {
+		/* and whatever it left behind in its group */
+		kill(-h->pid, SIGKILL);
+		thinkd_log(LOG_ERR, "hooks: %s killed after %lu ms", h->name,
+			   (unsigned long) runtime);
+	}
+	else if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		thinkd_log(LOG_INFO, "hooks: %s done in %lu ms", h->name,
+			   (unsigned long) runtime);
+	else if (WIFEXITED(status))
+		thinkd_log(LOG_ERR, "hooks: %s failed with status %d after %lu ms", h->name,
+			   WEXITSTATUS(status), (unsigned long) runtime);
+	else
+		thinkd_log(LOG_ERR, "hooks: %s died of signal %d after %lu ms", h->name,
+			   WTERMSIG(status), (unsigned long) runtime);
+
+	event_timer_cancel(hook_timeout, h);
+	event_timer_cancel(hook_kill, h);
+	event_timer_cancel(hook_poll, h);
+	if (h->pidfd >= 0) {
+		event_del_fd(h->pidfd);
+		close(h->pidfd);
+		h->pidfd = -1;
+	}
+	h->pid = 0;
+
+	hooks_start(NULL);
+}
+
+static void hook_timeout(void *data)
+{
+	hook_t *h = data;
+
+	thinkd_log(LOG_ERR, "hooks: %s still running after %d s, stopping pid %d",
+		   h->name, hook_prefs.timeout, (int) h->pid);
+	h->killed = true;
+	kill(-h->pid, SIGTERM);
+	event_timer_set(HOOKS_KILL_GRACE_MS, hook_kill, h);
+}
+
+static void hook_kill(void *data)
+{
+	hook_t *h = data;
+
+	kill(-h->pid, SIGKILL);
+}
@@ -0,0 +1,14 @@
+#ifndef _HOOKS_H_
+#define _HOOKS_H_
+
+#define HOOKS_SLOTS 4			/* most hooks running at once */
+#define HOOKS_MAX_QUEUED 8
+#define HOOKS_KILL_GRACE_MS 2000	/* between SIGTERM and SIGKILL */
+#define HOOKS_POLL_MS 250		/* for exits, without pidfd_open() */
+#define HOOKS_OUTPUT_LINE 256
+
+extern void hooks_transition(const char *from, const char *to);
+extern unsigned int hooks_running();
+extern void hooks_close();
+
+#endif /* _HOOKS_H_ */
@@ -0,0 +1,66 @@
+#include <string.h>
+
+#include "void.h"
+#include "knobs.h"
+
+/*
+ * Layout of the packed profile, generated from KNOB_LIST. The writers
+ * live in acpi.c and the parsers in conf_utils.c.
+ */
+
+const knob_layout_t knob_layout[KNOB_COUNT] = {
+#define KNOB_LAYOUT(id, key, type, group, ...) \
+	[KNOB_##id] = { key, KNOB_SHIFT_##id, KNOB_WIDTH_##type, group },
+	KNOB_LIST(KNOB_LAYOUT)
+#undef KNOB_LAYOUT
+};
+
+void knob_set(power_prefs_t *prefs, knob_id_t id, unsigned int value)
+{
+	unsigned int shift = knob_layout[id].shift;
+	unsigned int word = shift / KNOB_WORD_BITS;
+	uint64_t mask = ((1ULL << knob_layout[id].width) - 1) << (shift % KNOB_WORD_BITS);
+	uint64_t bits = prefs->words[word];
+
+	if (word + 1 < KNOB_WORDS)
+		bits |= (uint64_t) prefs->words[word + 1] << KNOB_WORD_BITS;
+
+	bits = (bits & ~mask) | (((uint64_t) value << (shift % KNOB_WORD_BITS)) & mask);
+
+	prefs->words[word] = (uint32_t) bits;
+	if (word + 1 < KNOB_WORDS)
+		prefs->words[word + 1] = (uint32_t) (bits >> KNOB_WORD_BITS);
+}
+
+/* the knobs whose values differ between two profiles */
+knob_mask_t knobs_diff(const power_prefs_t *a, const power_prefs_t *b)
+{
+	power_prefs_t delta;
+	uint32_t any = 0;
+	knob_mask_t dirty = 0;
+
+	for (size_t i = 0; i < KNOB_WORDS; ++i)
+		any |= delta.words[i] = a->words[i] ^ b->words[i];
+
+	if (! any)
+		return 0;
+
+	for (int id = 0; id < KNOB_COUNT; ++id) {
+		if (knob_get(&delta, id))
+			dirty |= 1u << id;
+	}
+
+	return dirty;
+}
+
+knob_mask_t knobs_in_groups(unsigned int groups)
+{
+	knob_mask_t mask = 0;
+
+	for (int id = 0; id < KNOB_COUNT; ++id) {
+		if (knob_layout[id].group & groups)
+			mask |= 1u << id;
+	}
+
+	return mask;
+}
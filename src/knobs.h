@@ -0,0 +1,145 @@
+#ifndef _KNOBS_H_
+#define _KNOBS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+/*
+ * Every knob of a power profile, in the order they are applied:
+ *
+ *	X(id, ini key, type, group, target, encoder)
+ *
+ * The ini parser table, the packed profile layout and the apply loop in
+ * acpi.c are all generated from this list. The type decides the parser
+ * and the bit width; the encoder turns the value into writes to the
+ * target, a path relative to the sysroot, for radios an rfkill type and
+ * for GPUs a path relative to the card directory of the driver and for
+ * cgroups the file written in each of the Cgroup_Slices. The radio, GPU
+ * and cgroup families can be left out of the build, see config.h.
+ */
+#define KNOB_LIST(X)								\
+	KNOB_LIST_BASE(X)							\
+	KNOB_LIST_RADIO(X)							\
+	KNOB_LIST_GPU(X)							\
+	KNOB_LIST_CGROUP(X)
+
+#define KNOB_LIST_BASE(X)							\
+	X(BRIGHTNESS, "brightness", PERCENT, KNOBS_VISIBLE,			\
+	  "/sys/class/backlight/acpi_video0", encode_backlight)			\
+	X(THINKLIGHT, "thinklight", BOOL, KNOBS_VISIBLE,			\
+	  "/proc/acpi/ibm/light", encode_on_off)				\
+	X(NMI_WATCHDOG, "nmi_watchdog", BOOL, KNOBS_DEFERRED,			\
+	  "/proc/sys/kernel/nmi_watchdog", encode_int)				\
+	X(AUDIO_POWERSAVE, "audio_powersave", BOOL, KNOBS_DEFERRED,		\
+	  "/sys/module/snd_hda_intel/parameters", encode_hda_powersave)		\
+	X(SOUND_MUTED, "sound_muted", BOOL, KNOBS_DEFERRED,			\
+	  "/proc/acpi/ibm/volume", encode_mute)
+
+#if WITH_RADIO_KNOBS
+#define KNOB_LIST_RADIO(X)							\
+	X(BLUETOOTH, "bluetooth", BOOL, KNOBS_DEFERRED,				\
+	  "bluetooth", encode_rfkill)						\
+	X(WWAN, "wwan", BOOL, KNOBS_DEFERRED,					\
+	  "wwan", encode_rfkill)						\
+	X(WIRELESS, "wireless", BOOL, KNOBS_DEFERRED,				\
+	  "wlan", encode_rfkill)
+#else
+#define KNOB_LIST_RADIO(X)
+#endif
+
+#if WITH_GPU_KNOBS
+#define KNOB_LIST_GPU(X)							\
+	X(GPU_LEVEL, "gpu_level", GPU_LEVEL, KNOBS_DEFERRED,			\
+	  "device/power_dpm_force_performance_level", encode_amdgpu_level)	\
+	X(GPU_PROFILE, "gpu_profile", GPU_PROFILE, KNOBS_DEFERRED,		\
+	  "device/pp_power_profile_mode", encode_amdgpu_profile)		\
+	X(GPU_MIN_FREQ, "gpu_min_freq", MHZ, KNOBS_DEFERRED,			\
+	  "gt_min_freq_mhz", encode_i915_freq)					\
+	X(GPU_MAX_FREQ, "gpu_max_freq", MHZ, KNOBS_DEFERRED,			\
+	  "gt_max_freq_mhz", encode_i915_freq)					\
+	X(GPU_BOOST_FREQ, "gpu_boost_freq", MHZ, KNOBS_DEFERRED,		\
+	  "gt_boost_freq_mhz", encode_i915_freq)
+#else
+#define KNOB_LIST_GPU(X)
+#endif
+
+#if WITH_CGROUP_KNOBS
+#define KNOB_LIST_CGROUP(X)							\
+	X(CGROUP_WEIGHT, "cgroup_weight", WEIGHT, KNOBS_DEFERRED,		\
+	  "cpu.weight", encode_cgroup_weight)					\
+	X(CGROUP_CPU_MAX, "cgroup_cpu_max", PERCENT, KNOBS_DEFERRED,		\
+	  "cpu.max", encode_cgroup_max)						\
+	X(CGROUP_EFFICIENCY_CORES, "cgroup_efficiency_cores", BOOL,		\
+	  KNOBS_DEFERRED, "cpuset.cpus", encode_cgroup_cpuset)
+#else
+#define KNOB_LIST_CGROUP(X)
+#endif
+
+/* knob groups for load_power_knobs() */
+#define KNOBS_VISIBLE 0x1	/* backlight and thinklight */
+#define KNOBS_DEFERRED 0x2	/* nmi watchdog, audio, rfkill, gpu and cgroups */
+#define KNOBS_ALL (KNOBS_VISIBLE | KNOBS_DEFERRED)
+
+#define KNOB_WIDTH_BOOL 1
+#define KNOB_WIDTH_PERCENT 7
+#define KNOB_WIDTH_MHZ 12		/* 0 leaves the driver's setting */
+#define KNOB_WIDTH_WEIGHT 14		/* cgroup cpu.weight, 0 is the default */
+#define KNOB_WIDTH_GPU_LEVEL 3		/* index into gpu_level_names */
+#define KNOB_WIDTH_GPU_PROFILE 4	/* profile + 1, 0 leaves it */
+#define KNOB_WORD_BITS 32
+
+typedef enum __knob_id {
+#define KNOB_ID(id, ...) KNOB_##id,
+	KNOB_LIST(KNOB_ID)
+#undef KNOB_ID
+	KNOB_COUNT,
+} knob_id_t;
+
+/* bit offsets: each knob starts where the previous one ended */
+enum __knob_shift {
+#define KNOB_SHIFT(id, key, type, ...) \
+	KNOB_SHIFT_##id, KNOB_LAST_##id = KNOB_SHIFT_##id + KNOB_WIDTH_##type - 1,
+	KNOB_LIST(KNOB_SHIFT)
+#undef KNOB_SHIFT
+	KNOB_TOTAL_BITS,
+};
+
+#define KNOB_WORDS ((KNOB_TOTAL_BITS + KNOB_WORD_BITS - 1) / KNOB_WORD_BITS)
+
+/* one bit per knob */
+typedef uint32_t knob_mask_t;
+#define KNOB_MASK_ALL ((knob_mask_t) ((1ULL << KNOB_COUNT) - 1))
+
+/* a whole profile packed into words, compared with a word-wise xor */
+typedef struct __power_prefs {
+	uint32_t words[KNOB_WORDS];
+} power_prefs_t;
+
+typedef struct __knob_layout {
+	const char *key;
+	unsigned int shift;
+	unsigned int width;
+	unsigned int group;
+} knob_layout_t;
+
+extern const knob_layout_t knob_layout[KNOB_COUNT];
+
+static inline unsigned int knob_get(const power_prefs_t *prefs, knob_id_t id)
+{
+	unsigned int shift = knob_layout[id].shift;
+	uint32_t mask = (1u << knob_layout[id].width) - 1;
+	uint64_t bits = prefs->words[shift / KNOB_WORD_BITS];
+
+	/* a field may straddle two words */
+	if (shift / KNOB_WORD_BITS + 1 < KNOB_WORDS)
+		bits |= (uint64_t) prefs->words[shift / KNOB_WORD_BITS + 1] << KNOB_WORD_BITS;
+	return (unsigned int) (bits >> (shift % KNOB_WORD_BITS)) & mask;
+}
+
+extern void knob_set(power_prefs_t *prefs, knob_id_t id, unsigned int value);
+extern knob_mask_t knobs_diff(const power_prefs_t *a, const power_prefs_t *b);
+extern knob_mask_t knobs_in_groups(unsigned int groups);
+
+#endif /* _KNOBS_H_ */
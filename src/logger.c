@@ -1,7 +1,9 @@
 #define _BSD_SOURCE 1
 
 #include "logger.h"
+#include "usdt.h"
 #include <stdio.h>
+#include <stdbool.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,6 +19,10 @@
 #define try_lock_log_files() __lock_log_files(LOCK_EX | LOCK_NB)
 #define unlock_log_files() __lock_log_files(LOCK_UN | LOCK_NB)
 
+/* only errors and warnings, for the one-shot commands */
+static bool log_quiet;
+
+#if ! USE_SYSLOG
 static FILE *err_logfile;
 static FILE *info_logfile;
 #if _DEBUG_LOG == 1
@@ -25,7 +31,9 @@ static FILE *debug_logfile;
 
 static void create_dirs();
 static int __lock_log_files(int mode);
+#endif
 
+#if ! USE_SYSLOG
 /*
   TODO: cut down on the #ifs
 */
@@ -156,10 +164,11 @@ static int __lock_log_files(int mode)
 
 	return 0;
 }
+#endif /* ! USE_SYSLOG */
 
 void thinkd_close_log()
 {
-#ifdef USE_SYSLOG
+#if USE_SYSLOG
 	closelog();
 #else
 	int res = 0;
@@ -181,64 +190,76 @@ void thinkd_close_log()
 #endif
 }
 
+void thinkd_log_quiet()
+{
+	log_quiet = true;
+}
+
 void thinkd_log(int priority, const char *format, ...)
 {
 	va_list args;
 	
+	if (log_quiet && priority > LOG_WARNING)
+		return;
+#if ! _DEBUG_LOG
+	/* debug logging is left out of the build */
+	if (priority == LOG_DEBUG)
+		return;
+#endif
+	USDT2(log, priority, format);
 	va_start(args, format);
-#ifdef USE_SYSLOG
+#if USE_SYSLOG
 	vsyslog(priority,format,args);
 #else
 	const int DATE_FORMAT_SIZE = 128;
 	const char *DATE_FORMAT = "%r: ";
+	FILE *fp;
 	time_t t;
-	struct tm *ltime;
-	size_t format_len;
-	char * newl_format;
+	struct tm ltime;
 	char dformat_buffer[DATE_FORMAT_SIZE];
 
 	/* first generate date format */
 	t = time(NULL);
-	ltime = localtime(&t);
-	if (! ltime) {
+	if (! localtime_r(&t, &ltime)) {
 		fprintf(err_logfile, "%s\n", strerror(errno));
 		return;
 	}
 
-	if (! strftime(dformat_buffer, DATE_FORMAT_SIZE, DATE_FORMAT, ltime)) {
+	if (! strftime(dformat_buffer, DATE_FORMAT_SIZE, DATE_FORMAT, &ltime)) {
 		fprintf(err_logfile, "%s\n", strerror(errno));
 		return;
 	}
 	
-	/* we need to add an extra newline character */
-	format_len = strlen(format) + strlen(dformat_buffer);
-	newl_format = (char *) calloc(format_len + 2, sizeof(char));
-	strcpy(newl_format, dformat_buffer);
-	strcat(newl_format, format);
-	newl_format[format_len] = '\n';
-
 	/* syslog.h defines following constants */	
 	switch (priority) {
 #  if _DEBUG_LOG == 1
 	case LOG_DEBUG:
-		vfprintf(debug_logfile, newl_format, args);
+		fp = debug_logfile;
 		break;
 #  endif
 	case LOG_INFO:
 	case LOG_NOTICE:
-		vfprintf(info_logfile, newl_format, args);
+		fp = info_logfile;
 		break;
 
 	case LOG_ERR:
-		vfprintf(err_logfile, newl_format, args);
+		fp = err_logfile;
 		break;
 
 	default:
-		vfprintf(info_logfile, newl_format, args);
+		fp = info_logfile;
 		break;
 	}
 
-	free(newl_format);
+	/* the log isn't opened yet (or at all, like in the benchmarks) */
+	if (! fp)
+		fp = stderr;
+
+	/* the streams are line buffered, so this is still one write; no
+	   copy of the format with the date and newline glued on */
+	fputs(dformat_buffer, fp);
+	vfprintf(fp, format, args);
+	fputc('\n', fp);
 #endif
 	va_end(args);
 }
@@ -24,7 +24,7 @@
 #endif
 
 #ifndef LOG_DEBUG
-#  ifdef USE_SYSLOG
+#  if USE_SYSLOG
 #    define LOG_DEBUG LOG_INFO
 #  else
 #    define LOG_DEBUG LOG_INFO|LOG_NOTICE
@@ -33,6 +33,7 @@
 
 extern int thinkd_open_log();
 extern void thinkd_close_log();
+extern void thinkd_log_quiet();
 extern void thinkd_log(int priority, const char *format, ...) THINKD_ATTR_PRINTF(2);
 
 #endif
@@ -0,0 +1,421 @@
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "void.h"
+#include "metrics.h"
+#include "remote.h"
+#include "mode.h"
+#include "psi.h"
+#include "apps.h"
+#include "stats.h"
+#include "selfcost.h"
+#include "conf_utils.h"
+#include "events.h"
+#include "logger.h"
+
+/*
+ * Prometheus exporter, off unless Metrics_Listen names a unix socket path
+ * or a host:port. The whole HTTP response is rendered into one buffer
+ * whenever the state changes, and once a minute for the latency counters
+ * and self-cost, so a scrape is an accept, a read of the request and a
+ * single write; it never reaches sysfs or the policy code.
+ */
+
+typedef struct __metrics_client {
+	bool active;
+	bool writing;
+	int fd;
+	size_t sent;
+	unsigned long generation;
+} metrics_client_t;
+
+typedef struct __metrics_buf {
+	char *data;
+	size_t len;
+	size_t size;
+} metrics_buf_t;
+
+static const power_prefs_t *known_modes[] = {
+	&mode_performance, &mode_powersave, &mode_heavy_powersave, &mode_critical,
+};
+
+static int listen_fd = -1;
+static char bound_address[MAX_CONF_STR_LEN];
+static bool bound_unix;
+static metrics_client_t clients[METRICS_MAX_CLIENTS];
+static char snapshot[METRICS_MAX_SNAPSHOT];
+static size_t snapshot_len;
+static unsigned long generation;
+static const power_prefs_t *last_mode;
+static unsigned long mode_switches[array_count(known_modes)];
+static selfcost_t cost;
+
+static int metrics_listen(const char *address);
+static bool is_loopback(const char *address);
+static void metrics_accept(int fd, short revents, void *data);
+static void metrics_client_event(int fd, short revents, void *data);
+static void metrics_client_timeout(void *data);
+static void metrics_client_close(metrics_client_t *client);
+static void metrics_refresh(void *data);
+static void render(metrics_buf_t *buf);
+static void emit(metrics_buf_t *buf, const char *format, ...) THINKD_ATTR_PRINTF(2);
+
+int metrics_configure()
+{
+	const char *address = daemon_prefs.metrics_listen;
+
+	if (listen_fd >= 0 && strcmp(address, bound_address) == 0)
+		return 0;
+
+	metrics_close();
+	if (! address[0])
+		return 0;
+
+	if (metrics_listen(address) < 0)
+		return -1;
+
+	metrics_refresh(NULL);
+	return 0;
+}
+
+void metrics_close()
+{
+	for (metrics_client_t *c = clients; c < clients + array_count(clients); ++c)
+		metrics_client_close(c);
+
+	event_timer_cancel(metrics_refresh, NULL);
+	if (listen_fd >= 0) {
+		event_del_fd(listen_fd);
+		close(listen_fd);
+		if (bound_unix)
+			unlink(bound_address);
+	}
+
+	listen_fd = -1;
+	bound_address[0] = '\0';
+}
+
+bool metrics_enabled()
+{
+	return listen_fd >= 0;
+}
+
+/* re-render the response, called by the policy whenever something changed */
+void metrics_update()
+{
+	char body[METRICS_MAX_SNAPSHOT];
+	metrics_buf_t buf = { body, 0, sizeof(body) };
+	int len;
+
+	/* counted even while nobody scrapes, so the totals are right later */
+	if (current_mode != last_mode && current_mode) {
+		for (size_t i = 0; i < array_count(known_modes); ++i) {
+			if (known_modes[i] == current_mode)
+				++mode_switches[i];
+		}
+	}
+	last_mode = current_mode;
+
+	if (listen_fd < 0)
+		return;
+
+	render(&buf);
+	len = snprintf(snapshot, sizeof(snapshot), "HTTP/1.0 200 OK\r\n"
+		       "Content-Type: text/plain; version=0.0.4\r\n"
+		       "Content-Length: %zu\r\n\r\n", buf.len);
+	if (len + buf.len > sizeof(snapshot)) {
+		thinkd_log(LOG_ERR, "metrics: snapshot of %zu bytes doesn't fit", buf.len);
+		return;
+	}
+
+	memcpy(snapshot + len, body, buf.len);
+	snapshot_len = len + buf.len;
+	++generation;
+}
+
+const char *metrics_snapshot(size_t *len)
+{
+	*len = snapshot_len;
+	return snapshot;
+}
+
+static int metrics_listen(const char *address)
+{
+	struct sockaddr_un addr;
+
+	bound_unix = address[0] == '/';
+	if (! bound_unix && ! is_loopback(address))
+		thinkd_log(LOG_ERR, "metrics: %s is not a loopback address, the "
+			   "exporter has no authentication", address);
+	else if (! bound_unix)
+		listen_fd = remote_tcp_listen(address, METRICS_MAX_CLIENTS);
+	else if (strlen(address) < sizeof(addr.sun_path)) {
+		listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, address);
+		unlink(address);
+		if (listen_fd >= 0 &&
+		    (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+		     listen(listen_fd, METRICS_MAX_CLIENTS) < 0)) {
+			thinkd_log(LOG_ERR, "metrics: cannot listen on %s: %s", address,
+				   strerror(errno));
+			close(listen_fd);
+			listen_fd = -1;
+		}
+	}
+
+	if (listen_fd < 0)
+		return -1;
+
+	if (event_add_fd(listen_fd, POLLIN, metrics_accept, NULL) < 0) {
+		close(listen_fd);
+		listen_fd = -1;
+		return -1;
+	}
+
+	snprintf(bound_address, sizeof(bound_address), "%s", address);
+	thinkd_log(LOG_INFO, "metrics: listening on %s", address);
+	return 0;
+}
+
+/* 127.0.0.0/8 or ::1, an empty host would listen everywhere */
+static bool is_loopback(const char *address)
+{
+	char host[NI_MAXHOST], port[NI_MAXSERV];
+	struct in6_addr addr6;
+	struct in_addr addr4;
+
+	if (remote_split_address(address, host, sizeof(host), port, sizeof(port)) < 0)
+		return false;
+
+	if (inet_pton(AF_INET, host, &addr4) == 1)
+		return (ntohl(addr4.s_addr) >> 24) == 127;
+	if (inet_pton(AF_INET6, host, &addr6) == 1)
+		return IN6_IS_ADDR_LOOPBACK(&addr6) ||
+			(IN6_IS_ADDR_V4MAPPED(&addr6) && addr6.s6_addr[12] == 127);
+
+	return false;
+}
+
+static void metrics_accept(int fd, short revents, void *data)
+{
+	metrics_client_t *client = NULL;
+	int cfd;
+
+	cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (cfd < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			LOG_SIMPLE_ERR("accept");
+		return;
+	}
+
+	for (metrics_client_t *c = clients; c < clients + array_count(clients); ++c) {
+		if (! c->active) {
+			client = c;
+			break;
+		}
+	}
+
+	/* wait for the request, answering first would reset the connection */
+	if (! client || event_add_fd(cfd, POLLIN, metrics_client_event, client) < 0) {
+		close(cfd);
+		return;
+	}
+
+	client->active = true;
+	client->writing = false;
+	client->fd = cfd;
+	event_timer_set(METRICS_TIMEOUT_MS, metrics_client_timeout, client);
+}
+
+static void metrics_client_event(int fd, short revents, void *data)
+{
+	metrics_client_t *client = data;
+	char request[1024];
+	ssize_t nwritten;
+
+	if (! client->writing) {
+		/* any request gets the metrics, its contents don't matter */
+		if (read(fd, request, sizeof(request)) < 0 &&
+		    (errno == EAGAIN || errno == EINTR))
+			return;
+
+		client->writing = true;
+		client->sent = 0;
+		client->generation = generation;
+	}
+	else if (client->generation != generation) {
+		/* re-rendered halfway through a slow reader */
+		metrics_client_close(client);
+		return;
+	}
+
+	nwritten = write(fd, snapshot + client->sent, snapshot_len - client->sent);
+	if (nwritten < 0 && errno == EAGAIN)
+		nwritten = 0;
+	if (nwritten < 0) {
+		metrics_client_close(client);
+		return;
+	}
+
+	client->sent += nwritten;
+	if (client->sent < snapshot_len) {
+		/* the rest goes out once the socket drains */
+		event_del_fd(fd);
+		event_add_fd(fd, POLLOUT, metrics_client_event, client);
+		return;
+	}
+
+	shutdown(fd, SHUT_WR);
+	metrics_client_close(client);
+}
+
+static void metrics_client_timeout(void *data)
+{
+	metrics_client_close(data);
+}
+
+static void metrics_client_close(metrics_client_t *client)
+{
+	if (! client->active)
+		return;
+
+	event_timer_cancel(metrics_client_timeout, client);
+	event_del_fd(client->fd);
+	close(client->fd);
+	client->active = false;
+}
+
+/* counters and self-cost move without any state change */
+static void metrics_refresh(void *data)
+{
+	/* sampling reads procfs, so it is kept off the state change path */
+	selfcost_sample(&cost);
+	metrics_update();
+	event_timer_set(METRICS_REFRESH_MS, metrics_refresh, NULL);
+}
+
+static void emit(metrics_buf_t *buf, const char *format, ...)
+{
+	va_list args;
+	int len;
+
+	if (buf->len >= buf->size)
+		return;
+
+	va_start(args, format);
+	len = vsnprintf(buf->data + buf->len, buf->size - buf->len, format, args);
+	va_end(args);
+
+	buf->len += len;
+	if (buf->len > buf->size)
+		buf->len = buf->size;
+}
+
+static void render(metrics_buf_t *buf)
+{
+	const double quantiles[] = { 0.5, 0.9, 0.99 };
+
+	emit(buf, "# HELP thinkd_mode Power mode currently applied.\n"
+		  "# TYPE thinkd_mode gauge\n");
+	for (size_t i = 0; i < array_count(known_modes); ++i)
+		emit(buf, "thinkd_mode{mode=\"%s\"} %d\n", mode_name(known_modes[i]),
+		     known_modes[i] == current_mode);
+
+	emit(buf, "# HELP thinkd_mode_switches_total Times each mode was switched to.\n"
+		  "# TYPE thinkd_mode_switches_total counter\n");
+	for (size_t i = 0; i < array_count(known_modes); ++i)
+		emit(buf, "thinkd_mode_switches_total{mode=\"%s\"} %lu\n",
+		     mode_name(known_modes[i]), mode_switches[i]);
+
+	emit(buf, "# HELP thinkd_mode_forced Whether a mode is pinned by a command.\n"
+		  "# TYPE thinkd_mode_forced gauge\n"
+		  "thinkd_mode_forced %d\n", mode_forced() != NULL);
+	emit(buf, "# HELP thinkd_ac_online Whether any charger is online.\n"
+		  "# TYPE thinkd_ac_online gauge\n"
+		  "thinkd_ac_online %d\n", ac_online);
+	emit(buf, "# HELP thinkd_psi_boosting Whether pressure boosts performance.\n"
+		  "# TYPE thinkd_psi_boosting gauge\n"
+		  "thinkd_psi_boosting %d\n", psi_boosting());
+	emit(buf, "# HELP thinkd_apps_boosting Whether a boost application boosts "
+		  "performance.\n# TYPE thinkd_apps_boosting gauge\n"
+		  "thinkd_apps_boosting %d\n", apps_boosting());
+
+	emit(buf, "# HELP thinkd_battery_capacity_percent Battery charge.\n"
+		  "# TYPE thinkd_battery_capacity_percent gauge\n");
+	for (size_t slot = 0; slot < psupply.count; ++slot) {
+		if (psupply.types[slot] == PSUPPLY_BATTERY)
+			emit(buf, "thinkd_battery_capacity_percent{battery=\"%s\"} %d\n",
+			     psupply.names[slot], psupply.capacity[slot]);
+	}
+	emit(buf, "# HELP thinkd_battery_energy Energy left in uWh, uAh for charge "
+		  "based batteries.\n# TYPE thinkd_battery_energy gauge\n");
+	for (size_t slot = 0; slot < psupply.count; ++slot) {
+		if (psupply.types[slot] == PSUPPLY_BATTERY)
+			emit(buf, "thinkd_battery_energy{battery=\"%s\"} %ld\n",
+			     psupply.names[slot], psupply.energy_now[slot]);
+	}
+	emit(buf, "# HELP thinkd_battery_energy_full Energy when full, same unit.\n"
+		  "# TYPE thinkd_battery_energy_full gauge\n");
+	for (size_t slot = 0; slot < psupply.count; ++slot) {
+		if (psupply.types[slot] == PSUPPLY_BATTERY)
+			emit(buf, "thinkd_battery_energy_full{battery=\"%s\"} %ld\n",
+			     psupply.names[slot], psupply.energy_full[slot]);
+	}
+	emit(buf, "# HELP thinkd_battery_power Power in uW (uA), negative while "
+		  "discharging.\n# TYPE thinkd_battery_power gauge\n");
+	for (size_t slot = 0; slot < psupply.count; ++slot) {
+		if (psupply.types[slot] == PSUPPLY_BATTERY)
+			emit(buf, "thinkd_battery_power{battery=\"%s\"} %ld\n",
+			     psupply.names[slot], psupply.rate[slot]);
+	}
+
+	emit(buf, "# HELP thinkd_operation_seconds Latency of daemon operations.\n"
+		  "# TYPE thinkd_operation_seconds summary\n");
+	for (int op = 0; op < STAT_NUM_OPS; ++op) {
+		const stat_histogram_t *h = stats_histogram(op);
+
+		for (size_t i = 0; i < array_count(quantiles); ++i)
+			emit(buf, "thinkd_operation_seconds{op=\"%s\",quantile=\"%g\"} %.9f\n",
+			     stats_op_name(op), quantiles[i],
+			     stats_percentile(h, quantiles[i] * 100) / 1e9);
+		emit(buf, "thinkd_operation_seconds_sum{op=\"%s\"} %.9f\n"
+			  "thinkd_operation_seconds_count{op=\"%s\"} %llu\n",
+		     stats_op_name(op), h->sum_ns / 1e9,
+		     stats_op_name(op), (unsigned long long) h->count);
+	}
+
+	emit(buf, "# HELP thinkd_wakeups_total Event loop wakeups.\n"
+		  "# TYPE thinkd_wakeups_total counter\n"
+		  "thinkd_wakeups_total %llu\n", (unsigned long long) cost.wakeups);
+	emit(buf, "# HELP thinkd_cpu_seconds_total Cpu time used by thinkd.\n"
+		  "# TYPE thinkd_cpu_seconds_total counter\n"
+		  "thinkd_cpu_seconds_total{mode=\"user\"} %.6f\n"
+		  "thinkd_cpu_seconds_total{mode=\"system\"} %.6f\n",
+		  cost.user_time, cost.sys_time);
+	emit(buf, "# HELP thinkd_context_switches_total Context switches of thinkd.\n"
+		  "# TYPE thinkd_context_switches_total counter\n"
+		  "thinkd_context_switches_total{kind=\"voluntary\"} %ld\n"
+		  "thinkd_context_switches_total{kind=\"involuntary\"} %ld\n",
+		  cost.vol_ctxsw, cost.invol_ctxsw);
+	emit(buf, "# HELP thinkd_rw_calls_total Read and write like syscalls, not all of them.\n"
+		  "# TYPE thinkd_rw_calls_total counter\n"
+		  "thinkd_rw_calls_total %llu\n", (unsigned long long) cost.rw_calls);
+	emit(buf, "# HELP thinkd_resident_memory_bytes Resident set size.\n"
+		  "# TYPE thinkd_resident_memory_bytes gauge\n"
+		  "thinkd_resident_memory_bytes %ld\n", cost.rss_kb * 1024);
+}
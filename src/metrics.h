@@ -0,0 +1,17 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdbool.h>
+
+#define METRICS_MAX_CLIENTS 4
+#define METRICS_MAX_SNAPSHOT 16384
+#define METRICS_TIMEOUT_MS 5000
+#define METRICS_REFRESH_MS 60000
+
+extern int metrics_configure();
+extern void metrics_close();
+extern bool metrics_enabled();
+extern void metrics_update();
+extern const char *metrics_snapshot(size_t *len);
+
+#endif /* _METRICS_H_ */
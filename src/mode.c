@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "void.h"
+#include "mode.h"
+#include "thinkd.h"
+#include "acpi.h"
+#include "psi.h"
+#include "apps.h"
+#include "gpu.h"
+#include "cgroup.h"
+#include "logger.h"
+#include "stats.h"
+#include "notify.h"
+#include "state.h"
+#include "trace.h"
+#include "metrics.h"
+#include "history.h"
+#include "hooks.h"
+#include "wakers.h"
+#include "rules.h"
+#include "events.h"
+#include "usdt.h"
+
+#if WITH_PTHREAD
+#include <pthread.h>
+
+#define conf_lock() pthread_mutex_lock(&conf_mutex)
+#define conf_unlock() pthread_mutex_unlock(&conf_mutex)
+#else
+/* the daemon itself is single threaded */
+#define conf_lock() do { } while (0)
+#define conf_unlock() do { } while (0)
+#endif
+
+/*
+ * Power mode policy: decides which profile applies to the current power
+ * supply state and loads it. Kept apart from the daemon plumbing in
+ * thinkd.c so the same code can be driven against a fake sysfs root.
+ */
+
+power_prefs_t *current_mode = NULL;
+int sleep_time = BAT_SLEEP_TIME;
+bool ac_online = false;
+acpi_psupply_t psupply;
+
+#if WITH_PTHREAD
+static pthread_mutex_t conf_mutex;
+#endif
+static power_prefs_t *forced_mode;
+static unsigned int probes_since_scan;
+/* target of a debounced transition whose deferred knobs are still due */
+static power_prefs_t *pending_mode;
+static bool settling;
+/* the rule behind the last mode requested by a probe */
+static int selected_rule = -1;
+static uint64_t unplugged_ms;
+
+static void psi_boost_changed(bool boosting);
+static void apps_boost_changed(bool boosting);
+static void apply_mode(power_prefs_t *prefs, unsigned int knobs);
+static void write_knobs(const power_prefs_t *prefs, unsigned int knobs);
+static void request_mode(power_prefs_t *prefs, bool now);
+static void transition_settle(void *data);
+static void transition_cancel();
+static power_prefs_t *select_mode();
+
+int mode_init()
+{
+#if WITH_PTHREAD
+	/* Try to initialize the config mutex */
+	if (pthread_mutex_init(&conf_mutex, NULL)) {
+		LOG_SIMPLE_ERR("pthread_mutex_init");
+		return -1;
+	}
+#endif
+
+	/* which driver runs which card and the cpu topology don't change
+	   until a reboot */
+	gpu_discover();
+	cgroup_discover();
+	/* the built-in rules, until a config is read */
+	rules_compile(&rule_prefs);
+
+	return 0;
+}
+
+void mode_cleanup()
+{
+	psi_disable();
+	wakers_close();
+	apps_close();
+	psupply_free(&psupply);
+	knobs_close();
+	hooks_close();
+	rules_close();
+#if WITH_PTHREAD
+	pthread_mutex_destroy(&conf_mutex);
+#endif
+}
+
+void detect_psupply_mode()
+{
+	bool rescan = ! psupply.count || ++probes_since_scan >= PSUPPLY_RESCAN_PROBES;
+	bool was_online = ac_online;
+	STATS_START(start);
+
+	USDT(probe_start);
+	/* a supply that went away also forces a rescan */
+	if (! rescan && psupply_read(&psupply, PSUPPLY_READ_MAINS) < 0)
+		rescan = true;
+
+	if (rescan) {
+		probes_since_scan = 0;
+		if (scan_power_supply(&psupply) < 0) {
+			thinkd_log(LOG_ERR, "failed to detect acpi power supply information");
+			load_psupply_mode(&mode_powersave);
+			STATS_END(STAT_PROBE, start);
+			USDT1(probe_end, -1);
+			return;
+		}
+		psupply_read(&psupply, PSUPPLY_READ_MAINS);
+		/* a dock or a late module load may have brought missing knobs */
+		if (knobs_missing()) {
+			conf_lock();
+			knobs_probe(knobs_missing());
+			conf_unlock();
+		}
+		/* batteries are only read for the exporter, once per scan */
+		if (metrics_enabled())
+			psupply_read(&psupply, PSUPPLY_READ_BATTERIES);
+	}
+
+	/* any online charger, dock or ups counts as AC */
+	ac_online = psupply_ac_online(&psupply);
+	if (! ac_online && (was_online || ! unplugged_ms))
+		unplugged_ms = event_now_ms();
+	trace_supplies(&psupply);
+	history_record(&psupply, mode_name(current_mode), ac_online);
+	if (rescan || ac_online != was_online)
+		metrics_update();
+
+	/* pressure triggers only matter while running on battery */
+	if (ac_online)
+		psi_disable();
+	else
+		psi_enable(psi_boost_changed);
+	wakers_enable(! ac_online);
+
+	/* the first mode, forced ones and boosts don't wait */
+	if (forced_mode)
+		request_mode(forced_mode, true);
+	else {
+		power_prefs_t *prefs = select_mode();
+
+		request_mode(prefs, ! current_mode ||
+			     (prefs == &mode_performance && ! ac_online));
+	}
+
+	STATS_END(STAT_PROBE, start);
+	USDT1(probe_end, ac_online);
+}
+
+/*
+ * A power supply uevent: probe now. A supply that came or went is only
+ * found by a rescan, so one is due.
+ */
+void detect_psupply_change(bool rescan)
+{
+	if (rescan)
+		probes_since_scan = PSUPPLY_RESCAN_PROBES;
+	detect_psupply_mode();
+}
+
+/*
+ * The mode of the first rule that holds. Batteries, thermal zones and the
+ * lid are only read when some rule tests them.
+ */
+static power_prefs_t *select_mode()
+{
+	int inputs[RULE_INPUTS];
+	unsigned int needs = rules_inputs();
+	psupply_summary_t sum;
+
+	inputs[RULE_AC] = ac_online;
+	inputs[RULE_BOOST] = psi_boosting() || apps_boosting();
+	inputs[RULE_BATTERY] = RULES_UNKNOWN;
+	inputs[RULE_ON_BATTERY] = ac_online ? 0 :
+		(int) ((event_now_ms() - unplugged_ms) / 60000);
+
+	if (needs & RULE_NEEDS(RULE_BATTERY)) {
+		psupply_read(&psupply, PSUPPLY_READ_BATTERIES);
+		psupply_summarize(&psupply, &sum);
+		if (sum.capacity >= 0)
+			inputs[RULE_BATTERY] = sum.capacity;
+	}
+	rules_sense(inputs);
+
+	selected_rule = rules_eval(inputs);
+	return rules_mode(selected_rule);
+}
+
+/* apply every knob of a mode right away, dropping a pending transition */
+void load_psupply_mode(power_prefs_t *prefs)
+{
+	transition_cancel();
+	apply_mode(prefs, KNOBS_ALL);
+}
+
+void reload_config()
+{	
+	STATS_START(start);
+
+	conf_lock();
+	if (read_ini() < 0)
+		thinkd_log(LOG_ERR, "cannot read %s: %s", config_file, strerror(errno));
+	rules_compile(&rule_prefs);
+	/* the Cgroup_Slices may have changed */
+	knobs_probe(KNOB_MASK_ALL);
+	conf_unlock();
+	STATS_END(STAT_CONFIG_RELOAD, start);
+
+	/* triggers are re-armed with the new settings by the next probe */
+	psi_disable();
+	apps_configure(apps_boost_changed);
+
+	/* a reload rewrites every knob, whatever was changed behind our back */
+	knobs_forget();
+
+	/* Load mode if one is already set by detect_psupply_mode() */
+	if (current_mode)
+		load_psupply_mode(current_mode);
+}
+
+const char *mode_name(const power_prefs_t *prefs)
+{
+	if (prefs == &mode_performance)
+		return "performance";
+	else if (prefs == &mode_powersave)
+		return "powersave";
+	else if (prefs == &mode_heavy_powersave)
+		return "heavy_powersave";
+	else if (prefs == &mode_critical)
+		return "critical";
+
+	return "none";
+}
+
+power_prefs_t *mode_by_name(const char *name)
+{
+	power_prefs_t *modes[] = {
+		&mode_performance, &mode_powersave,
+		&mode_heavy_powersave, &mode_critical,
+	};
+
+	for (size_t i = 0; i < array_count(modes); ++i) {
+		if (strcmp(name, mode_name(modes[i])) == 0)
+			return modes[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Pin a mode regardless of the power supplies, or hand control back to
+ * the probe with NULL. Either way the result is applied right away.
+ */
+void mode_force(power_prefs_t *prefs)
+{
+	forced_mode = prefs;
+	if (prefs && current_mode != prefs)
+		load_psupply_mode(prefs);
+	else if (! prefs)
+		detect_psupply_mode();
+}
+
+const power_prefs_t *mode_forced()
+{
+	return forced_mode;
+}
+
+static void apply_mode(power_prefs_t *prefs, unsigned int knobs)
+{
+	power_prefs_t *previous = current_mode;
+
+	if (prefs == forced_mode) {
+		thinkd_log(LOG_INFO, "Enabling forced %s mode", mode_name(prefs));
+		sleep_time = ac_online ? AC_SLEEP_TIME : BAT_SLEEP_TIME;
+	}
+	else if (selected_rule >= 0 && ! rules_builtin(selected_rule) &&
+		 rules_mode(selected_rule) == prefs) {
+		thinkd_log(LOG_INFO, "%s. Enabling %s mode", rules_text(selected_rule),
+			   mode_name(prefs));
+		sleep_time = ac_online ? AC_SLEEP_TIME : BAT_SLEEP_TIME;
+	}
+	else if (prefs == &mode_powersave) {
+		thinkd_log(LOG_INFO, "Battery found. Enabling powersave mode");
+		sleep_time = BAT_SLEEP_TIME;
+	}
+	else if (prefs == &mode_performance && ! ac_online) {
+		thinkd_log(LOG_INFO, "%s on battery. Boosting into performance mode",
+			   apps_boosting() ? "Boost application" : "Pressure");
+		sleep_time = BAT_SLEEP_TIME;
+	}
+	else if (prefs == &mode_performance) {
+		thinkd_log(LOG_INFO, "AC adapater is connected. Enabling performance mode");
+		sleep_time = AC_SLEEP_TIME;
+	}
+	else {
+		thinkd_log(LOG_INFO, "Mode unrecognized, setting sleep time to default");
+		sleep_time = BAT_SLEEP_TIME;
+		return;
+	}
+
+	conf_lock();
+	/* on startup the previous instance may have left everything in place */
+	if (! current_mode && state_matches(prefs, mode_name(prefs))) {
+		thinkd_log(LOG_INFO, "%s mode already applied, skipping",
+			   mode_name(prefs));
+		knobs_assume(prefs);
+	}
+	else {
+		write_knobs(prefs, knobs);
+		state_save(prefs, mode_name(prefs));
+	}
+	current_mode = prefs;
+	conf_unlock();
+
+	trace_mode(mode_name(prefs));
+	metrics_update();
+
+	notify_send("STATUS=%s mode, AC %s", mode_name(prefs),
+		    ac_online ? "online" : "offline");
+
+	/* only queued here, they start once we are back in the loop */
+	if (prefs != previous)
+		hooks_transition(previous ? mode_name(previous) : NULL, mode_name(prefs));
+}
+
+/*
+ * Only knobs that changed are written, so the journal keeps collecting
+ * until everything is rewritten and it describes all knobs again.
+ */
+static void write_knobs(const power_prefs_t *prefs, unsigned int knobs)
+{
+	if (knobs_known())
+		state_journal_resume();
+	else
+		state_journal_begin();
+	load_power_knobs(prefs, knobs);
+	state_journal_end();
+}
+
+/*
+ * Move towards `prefs`. Unless `now` is set only the visible knobs follow
+ * at once; the rest waits until the supply held still for the debounce
+ * window, so a flapping charger costs a few backlight writes instead of
+ * a full rfkill and audio rewrite per flap.
+ */
+static void request_mode(power_prefs_t *prefs, bool now)
+{
+	if (prefs == current_mode) {
+		if (pending_mode) {
+			thinkd_log(LOG_INFO, "Power supply settled back, staying in %s mode",
+				   mode_name(current_mode));
+			transition_cancel();
+			conf_lock();
+			write_knobs(current_mode, KNOBS_VISIBLE);
+			conf_unlock();
+		}
+		return;
+	}
+
+	if (now || daemon_prefs.transition_debounce <= 0) {
+		load_psupply_mode(prefs);
+		return;
+	}
+
+	/* the probe after the window confirms the target */
+	if (prefs == pending_mode) {
+		if (settling) {
+			pending_mode = NULL;
+			apply_mode(prefs, KNOBS_DEFERRED);
+		}
+		return;
+	}
+
+	thinkd_log(LOG_INFO, "Switching to %s mode in %d ms", mode_name(prefs),
+		   daemon_prefs.transition_debounce);
+	pending_mode = prefs;
+	conf_lock();
+	write_knobs(prefs, KNOBS_VISIBLE);
+	conf_unlock();
+	event_timer_set(daemon_prefs.transition_debounce, transition_settle, NULL);
+}
+
+static void transition_settle(void *data)
+{
+	(void) data;
+
+	settling = true;
+	detect_psupply_mode();
+	settling = false;
+}
+
+static void transition_cancel()
+{
+	pending_mode = NULL;
+	event_timer_cancel(transition_settle, NULL);
+}
+
+static void psi_boost_changed(bool boosting)
+{
+	trace_pressure(boosting);
+	/* re-evaluate right away instead of waiting for the next probe */
+	detect_psupply_mode();
+	/* the boost gauges change even when the mode stays */
+	metrics_update();
+}
+
+static void apps_boost_changed(bool boosting)
+{
+	thinkd_log(LOG_INFO, boosting ? "apps: boost application started" :
+		   "apps: last boost application exited");
+	detect_psupply_mode();
+	metrics_update();
+}
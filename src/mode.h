@@ -0,0 +1,28 @@
+#ifndef _MODE_H_
+#define _MODE_H_
+
+#include <stdbool.h>
+
+#include "conf_utils.h"
+#include "psupply.h"
+
+/* probes between two rescans of the power supply class for docks */
+#define PSUPPLY_RESCAN_PROBES 12
+
+extern power_prefs_t *current_mode;
+extern int sleep_time;
+extern bool ac_online;
+extern acpi_psupply_t psupply;
+
+extern int mode_init();
+extern void mode_cleanup();
+extern void detect_psupply_mode();
+extern void detect_psupply_change(bool rescan);
+extern void load_psupply_mode(power_prefs_t *prefs);
+extern void reload_config();
+extern const char *mode_name(const power_prefs_t *prefs);
+extern power_prefs_t *mode_by_name(const char *name);
+extern void mode_force(power_prefs_t *prefs);
+extern const power_prefs_t *mode_forced();
+
+#endif /* _MODE_H_ */
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "notify.h"
+#include "logger.h"
+
+/*
+ * The service manager side of sd_notify(3) and sd_listen_fds(3), spoken
+ * directly over the notification socket so we don't need libsystemd.
+ * Everything here is a no-op when not started by a service manager.
+ */
+
+#define MAX_NOTIFY_MSG 256
+
+static int notify_fd = -1;
+static struct sockaddr_un notify_addr;
+static socklen_t notify_addrlen;
+
+int notify_init()
+{
+	const char *path = getenv("NOTIFY_SOCKET");
+	size_t len;
+
+	if (! path || ! path[0])
+		return 0;
+
+	len = strlen(path);
+	if (len >= sizeof(notify_addr.sun_path) || (path[0] != '/' && path[0] != '@')) {
+		thinkd_log(LOG_ERR, "unusable NOTIFY_SOCKET %s", path);
+		return -1;
+	}
+
+	notify_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (notify_fd < 0) {
+		LOG_SIMPLE_ERR("socket");
+		return -1;
+	}
+
+	memset(&notify_addr, 0, sizeof(notify_addr));
+	notify_addr.sun_family = AF_UNIX;
+	memcpy(notify_addr.sun_path, path, len);
+
+	/* a leading '@' denotes the abstract namespace */
+	if (path[0] == '@')
+		notify_addr.sun_path[0] = '\0';
+	notify_addrlen = offsetof(struct sockaddr_un, sun_path) + len;
+
+	/* keep hooks and other children from talking to the manager */
+	unsetenv("NOTIFY_SOCKET");
+	return 0;
+}
+
+int notify_send(const char *format, ...)
+{
+	char message[MAX_NOTIFY_MSG];
+	va_list args;
+	int len;
+
+	if (notify_fd < 0)
+		return 0;
+
+	va_start(args, format);
+	len = vsnprintf(message, sizeof(message), format, args);
+	va_end(args);
+
+	if (len < 0 || len >= (int) sizeof(message))
+		return -1;
+
+	if (sendto(notify_fd, message, len, MSG_NOSIGNAL,
+		   (struct sockaddr *) &notify_addr, notify_addrlen) < 0) {
+		LOG_SIMPLE_ERR("notify");
+		return -1;
+	}
+
+	return 0;
+}
+
+void notify_ready()
+{
+	notify_send("READY=1\nMAINPID=%d", (int) getpid());
+}
+
+void notify_reloading()
+{
+	struct timespec ts;
+
+	/* Type=notify-reload wants the monotonic time of the request */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	notify_send("RELOADING=1\nMONOTONIC_USEC=%llu",
+		    (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+void notify_stopping()
+{
+	notify_send("STOPPING=1");
+}
+
+void notify_close()
+{
+	if (notify_fd >= 0)
+		close(notify_fd);
+	notify_fd = -1;
+}
+
+/*
+ * Number of sockets handed to us through socket activation, starting at
+ * LISTEN_FDS_START. The variables are cleared so children don't see them.
+ */
+int notify_listen_fds()
+{
+	const char *pid_str = getenv("LISTEN_PID");
+	const char *fds_str = getenv("LISTEN_FDS");
+	int count = 0;
+
+	if (pid_str && fds_str && strtol(pid_str, NULL, 10) == getpid()) {
+		count = (int) strtol(fds_str, NULL, 10);
+		for (int fd = LISTEN_FDS_START; fd < LISTEN_FDS_START + count; ++fd)
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+	return count > 0 ? count : 0;
+}
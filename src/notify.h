@@ -0,0 +1,17 @@
+#ifndef _NOTIFY_H_
+#define _NOTIFY_H_
+
+#include "void.h"
+
+/* first fd passed by socket activation, see sd_listen_fds(3) */
+#define LISTEN_FDS_START 3
+
+extern int notify_init();
+extern int notify_send(const char *format, ...) THINKD_ATTR_PRINTF(1);
+extern void notify_ready();
+extern void notify_reloading();
+extern void notify_stopping();
+extern void notify_close();
+extern int notify_listen_fds();
+
+#endif /* _NOTIFY_H_ */
@@ -0,0 +1,190 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "void.h"
+#include "psi.h"
+#include "events.h"
+#include "conf_utils.h"
+#include "acpi.h"
+#include "logger.h"
+
+/*
+ * Pressure stall information triggers. The kernel raises POLLPRI on a
+ * trigger fd at most once per window while the stall threshold is being
+ * exceeded, so pressure is considered gone once no event arrived for two
+ * whole windows. Nothing here samples the pressure files periodically.
+ */
+
+#define PSI_MIN_WINDOW 500
+#define PSI_MAX_WINDOW 10000
+
+typedef struct __psi_trigger {
+	int fd;
+	int hold_ms;
+	bool pressured;
+} psi_trigger_t;
+
+static const char *psi_names[PSI_NUM_RESOURCES] = { "cpu", "io" };
+static psi_trigger_t triggers[PSI_NUM_RESOURCES] = {
+	{ .fd = -1 }, { .fd = -1 },
+};
+static psi_change_cb change_cb;
+
+static void psi_event(int fd, short revents, void *data);
+static void psi_expire(void *data);
+static void psi_release(psi_resource_t res);
+static void psi_update(bool was_boosting);
+
+int psi_open_trigger(const char *path, int stall_ms, int window_ms)
+{
+	char trigger[64];
+	int fd, len;
+
+	if (window_ms < PSI_MIN_WINDOW)
+		window_ms = PSI_MIN_WINDOW;
+	else if (window_ms > PSI_MAX_WINDOW)
+		window_ms = PSI_MAX_WINDOW;
+
+	if (stall_ms <= 0 || stall_ms >= window_ms) {
+		thinkd_log(LOG_ERR, "psi: stall of %d ms does not fit a %d ms window",
+			   stall_ms, window_ms);
+		return -1;
+	}
+
+	fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		thinkd_log(LOG_ERR, "psi: cannot open %s", path);
+		LOG_SIMPLE_ERR("open");
+		return -1;
+	}
+
+	/* the trigger string must be written including the terminating nul */
+	len = snprintf(trigger, sizeof(trigger), "some %d %d",
+		       stall_ms * 1000, window_ms * 1000);
+	if (write(fd, trigger, len + 1) < 0) {
+		thinkd_log(LOG_ERR, "psi: kernel refused trigger \"%s\" on %s",
+			   trigger, path);
+		LOG_SIMPLE_ERR("write");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * Watch an already armed trigger fd. Anything that raises POLLPRI works,
+ * which lets a socketpair with out-of-band data stand in for the kernel.
+ */
+int psi_watch_fd(psi_resource_t res, int fd, int window_ms)
+{
+	psi_release(res);
+
+	if (event_add_fd(fd, POLLPRI, psi_event, (void *) (intptr_t) res) < 0)
+		return -1;
+
+	triggers[res].fd = fd;
+	triggers[res].hold_ms = 2 * window_ms;
+	return 0;
+}
+
+void psi_enable(psi_change_cb on_change)
+{
+	const char *paths[PSI_NUM_RESOURCES] = { PSI_CPU_PATH, PSI_IO_PATH };
+	const int stalls[PSI_NUM_RESOURCES] = {
+		daemon_prefs.psi_cpu_stall, daemon_prefs.psi_io_stall
+	};
+
+	change_cb = on_change;
+	if (! daemon_prefs.psi_boost)
+		return;
+
+	for (int res = 0; res < PSI_NUM_RESOURCES; ++res) {
+		procfs_path_t path;
+		int fd;
+
+		if (triggers[res].fd >= 0)
+			continue;
+
+		sysroot_sprintf(path, "%s", paths[res]);
+		fd = psi_open_trigger(path, stalls[res], daemon_prefs.psi_window);
+		if (fd < 0)
+			continue;
+
+		if (psi_watch_fd(res, fd, daemon_prefs.psi_window) < 0) {
+			close(fd);
+			continue;
+		}
+
+		thinkd_log(LOG_INFO, "psi: watching %s pressure", psi_names[res]);
+	}
+}
+
+void psi_disable()
+{
+	for (int res = 0; res < PSI_NUM_RESOURCES; ++res)
+		psi_release(res);
+}
+
+bool psi_boosting()
+{
+	for (int res = 0; res < PSI_NUM_RESOURCES; ++res) {
+		if (triggers[res].pressured)
+			return true;
+	}
+
+	return false;
+}
+
+static void psi_event(int fd, short revents, void *data)
+{
+	psi_resource_t res = (psi_resource_t) (intptr_t) data;
+	bool was_boosting = psi_boosting();
+
+	if (revents & (POLLERR | POLLNVAL)) {
+		thinkd_log(LOG_ERR, "psi: %s trigger went away", psi_names[res]);
+		psi_release(res);
+	}
+	else if (revents & POLLPRI) {
+		if (! triggers[res].pressured)
+			thinkd_log(LOG_INFO, "psi: sustained %s pressure", psi_names[res]);
+		triggers[res].pressured = true;
+		event_timer_set(triggers[res].hold_ms, psi_expire, data);
+	}
+
+	psi_update(was_boosting);
+}
+
+static void psi_expire(void *data)
+{
+	psi_resource_t res = (psi_resource_t) (intptr_t) data;
+	bool was_boosting = psi_boosting();
+
+	thinkd_log(LOG_INFO, "psi: %s pressure subsided", psi_names[res]);
+	triggers[res].pressured = false;
+	psi_update(was_boosting);
+}
+
+static void psi_release(psi_resource_t res)
+{
+	psi_trigger_t *t = &triggers[res];
+
+	event_timer_cancel(psi_expire, (void *) (intptr_t) res);
+	t->pressured = false;
+	if (t->fd < 0)
+		return;
+
+	event_del_fd(t->fd);
+	close(t->fd);
+	t->fd = -1;
+}
+
+static void psi_update(bool was_boosting)
+{
+	if (change_cb && psi_boosting() != was_boosting)
+		change_cb(psi_boosting());
+}
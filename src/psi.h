@@ -0,0 +1,23 @@
+#ifndef _PSI_H_
+#define _PSI_H_
+
+#include <stdbool.h>
+
+#define PSI_CPU_PATH	"/proc/pressure/cpu"
+#define PSI_IO_PATH	"/proc/pressure/io"
+
+typedef enum __psi_resource {
+	PSI_CPU,
+	PSI_IO,
+	PSI_NUM_RESOURCES,
+} psi_resource_t;
+
+typedef void (*psi_change_cb)(bool boosting);
+
+extern int psi_open_trigger(const char *path, int stall_ms, int window_ms);
+extern int psi_watch_fd(psi_resource_t res, int fd, int window_ms);
+extern void psi_enable(psi_change_cb on_change);
+extern void psi_disable();
+extern bool psi_boosting();
+
+#endif /* _PSI_H_ */
@@ -0,0 +1,482 @@
+#define _GNU_SOURCE 1
+
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stddef.h>
+
+#include "void.h"
+#include "psupply.h"
+#include "acpi.h"
+#include "eclib.h"
+#include "logger.h"
+#include "stats.h"
+
+#define grow_array(arr, slots) \
+	arr = ec_realloc(arr, (slots) * sizeof(*(arr)))
+
+static const struct {
+	const char *name;
+	psupply_type_t type;
+} type_names[] = {
+	{"Mains", PSUPPLY_MAINS},
+	{"USB", PSUPPLY_USB},
+	{"UPS", PSUPPLY_UPS},
+	{"Battery", PSUPPLY_BATTERY},
+};
+
+static const struct {
+	const char *name;
+	unsigned int flag;
+} attr_names[] = {
+	{"online", PSUPPLY_HAS_ONLINE},
+	{"capacity", PSUPPLY_HAS_CAPACITY},
+	{"energy_now", PSUPPLY_HAS_ENERGY},
+	{"charge_now", PSUPPLY_HAS_CHARGE},
+	{"power_now", PSUPPLY_HAS_POWER},
+	{"current_now", PSUPPLY_HAS_CURRENT},
+	{"status", PSUPPLY_HAS_STATUS},
+};
+
+#define UEVENT_PREFIX "POWER_SUPPLY_"
+#define UEVENT_PREFIX_LEN (sizeof(UEVENT_PREFIX) - 1)
+
+/* the uevent keys we keep, without the prefix, matched on length first */
+static const struct {
+	const char *key;
+	size_t len;
+	unsigned int flag;
+	size_t offset;
+} uevent_keys[] = {
+#define UEVENT_KEY(key, flag, field) \
+	{ key, sizeof(key) - 1, flag, offsetof(psupply_snapshot_t, field) }
+	UEVENT_KEY("ONLINE", PSUPPLY_HAS_ONLINE, online),
+	UEVENT_KEY("CAPACITY", PSUPPLY_HAS_CAPACITY, capacity),
+	UEVENT_KEY("ENERGY_NOW", PSUPPLY_HAS_ENERGY, energy_now),
+	UEVENT_KEY("ENERGY_FULL", 0, energy_full),
+	UEVENT_KEY("CHARGE_NOW", PSUPPLY_HAS_CHARGE, charge_now),
+	UEVENT_KEY("CHARGE_FULL", 0, charge_full),
+	UEVENT_KEY("POWER_NOW", PSUPPLY_HAS_POWER, power_now),
+	UEVENT_KEY("CURRENT_NOW", PSUPPLY_HAS_CURRENT, current_now),
+	UEVENT_KEY("VOLTAGE_NOW", PSUPPLY_HAS_VOLTAGE, voltage_now),
+#undef UEVENT_KEY
+};
+
+static void psupply_close(acpi_psupply_t *ps);
+static void psupply_add(acpi_psupply_t *ps, psupply_type_t type, int dirfd,
+			const char *name);
+static int read_battery(acpi_psupply_t *ps, size_t slot);
+static int read_battery_uevent(acpi_psupply_t *ps, size_t slot);
+static void parse_uevent_line(const char *key, size_t key_len, const char *value,
+			      psupply_snapshot_t *snap);
+static int scan_entry(int dirfd, const char *name, void *data);
+
+static inline bool is_mains(psupply_type_t type)
+{
+	return type == PSUPPLY_MAINS || type == PSUPPLY_USB || type == PSUPPLY_UPS;
+}
+
+/*
+ * (Re)build the supply table. Previous handles are closed but the arrays
+ * are kept, so a rescan of an unchanged machine doesn't allocate. Returns
+ * the number of batteries or -1 when the class directory can't be read.
+ */
+int scan_power_supply(acpi_psupply_t *dest)
+{
+	int batt_count = 0;
+	sysfs_path_t psup_root;
+
+	psupply_close(dest);
+
+	sysroot_sprintf(psup_root, "%s", POWER_SUPPLY_DIRECTORY);
+	if (sysfs_foreach_entry(psup_root, scan_entry, dest) < 0) {
+		thinkd_log(LOG_ERR, "can't open power supply dir");
+		return -1;
+	}
+
+	for (size_t slot = 0; slot < dest->count; ++slot) {
+		if (dest->types[slot] == PSUPPLY_BATTERY)
+			++batt_count;
+	}
+
+	return batt_count;
+}
+
+static int scan_entry(int dirfd, const char *name, void *data)
+{
+	acpi_psupply_t *dest = data;
+	sysfs_value_t tmp_type;
+	psupply_type_t type = PSUPPLY_UNKNOWN;
+	int fd;
+
+	fd = openat(dirfd, name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	if (sysfs_read_str_at(fd, "type", tmp_type, sizeof(tmp_type)) >= 0) {
+		for (size_t i = 0; i < array_count(type_names); ++i) {
+			if (strcmp(tmp_type, type_names[i].name) == 0)
+				type = type_names[i].type;
+		}
+	}
+
+	/* a wireless mouse or keyboard has a battery too, but it doesn't run
+	   the machine */
+	if (type != PSUPPLY_UNKNOWN &&
+	    sysfs_read_str_at(fd, "scope", tmp_type, sizeof(tmp_type)) >= 0 &&
+	    strcmp(tmp_type, "Device") == 0)
+		type = PSUPPLY_UNKNOWN;
+
+	if (type == PSUPPLY_UNKNOWN) {
+		close(fd);
+		return 0;
+	}
+
+	psupply_add(dest, type, fd, name);
+	return 0;
+}
+
+/*
+ * Refresh the readings selected by `what`. Returns -1 when a supply went
+ * away underneath us, in which case the table should be rescanned.
+ */
+int psupply_read(acpi_psupply_t *ps, unsigned int what)
+{
+	int ret = 0;
+
+	for (size_t slot = 0; slot < ps->count; ++slot) {
+		long value;
+
+		if (ps->types[slot] == PSUPPLY_BATTERY) {
+			int res = 0;
+
+			if (! (what & PSUPPLY_READ_BATTERIES))
+				continue;
+			if (ps->uevent_fds[slot] >= 0 && ! (what & PSUPPLY_READ_ATTRIBUTES))
+				res = read_battery_uevent(ps, slot);
+			else
+				res = read_battery(ps, slot);
+			if (res < 0)
+				ret = -1;
+			continue;
+		}
+
+		if (! (what & PSUPPLY_READ_MAINS) ||
+		    ! (ps->attrs[slot] & PSUPPLY_HAS_ONLINE))
+			continue;
+
+		if (sysfs_read_long_at(ps->dirfds[slot], "online", &value) < 0) {
+			thinkd_log(LOG_ERR, "cannot read %s/online: %s",
+				   ps->names[slot], strerror(errno));
+			ret = -1;
+			continue;
+		}
+		ps->online[slot] = value != 0;
+	}
+
+	return ret;
+}
+
+/*
+ * Read the whole uevent file of a battery with one pread(). sysfs renders
+ * every property in the same call, which also makes them consistent with
+ * each other, unlike a read per attribute file.
+ */
+int psupply_snapshot(const acpi_psupply_t *ps, size_t slot, psupply_snapshot_t *snap)
+{
+	char buffer[PSUPPLY_UEVENT_SIZE];
+	ssize_t nread;
+	STATS_START(start);
+
+	if (ps->uevent_fds[slot] < 0) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	nread = pread(ps->uevent_fds[slot], buffer, sizeof(buffer), 0);
+	if (nread < 0)
+		return -1;
+
+	psupply_parse_uevent(buffer, (size_t) nread, snap);
+	STATS_END(STAT_SYSFS_READ, start);
+	return 0;
+}
+
+/*
+ * Parse the KEY=value lines of a uevent in a single pass. Lines without
+ * the POWER_SUPPLY_ prefix or cut off at the end of the buffer are skipped.
+ */
+void psupply_parse_uevent(const char *buffer, size_t len, psupply_snapshot_t *snap)
+{
+	const char *line = buffer, *end = buffer + len;
+
+	memset(snap, 0, sizeof(struct __psupply_snapshot));
+
+	while (line < end) {
+		const char *eol = memchr(line, '\n', end - line);
+		const char *eq;
+
+		if (! eol)
+			break;
+
+		if ((size_t) (eol - line) > UEVENT_PREFIX_LEN &&
+		    memcmp(line, UEVENT_PREFIX, UEVENT_PREFIX_LEN) == 0 &&
+		    (eq = memchr(line, '=', eol - line))) {
+			const char *key = line + UEVENT_PREFIX_LEN;
+
+			parse_uevent_line(key, eq - key, eq + 1, snap);
+		}
+
+		line = eol + 1;
+	}
+}
+
+static void parse_uevent_line(const char *key, size_t key_len, const char *value,
+			      psupply_snapshot_t *snap)
+{
+	if (key_len == 6 && memcmp(key, "STATUS", 6) == 0) {
+		snap->attrs |= PSUPPLY_HAS_STATUS;
+		snap->discharging = strncmp(value, "Discharging\n", 12) == 0;
+		return;
+	}
+
+	for (size_t i = 0; i < array_count(uevent_keys); ++i) {
+		if (uevent_keys[i].len != key_len ||
+		    memcmp(uevent_keys[i].key, key, key_len) != 0)
+			continue;
+
+		/* the line ends in a newline, which stops strtol */
+		*(long *) ((char *) snap + uevent_keys[i].offset) = strtol(value, NULL, 10);
+		snap->attrs |= uevent_keys[i].flag;
+		return;
+	}
+}
+
+/* the sysfs spelling of a supply type */
+const char *psupply_type_name(psupply_type_t type)
+{
+	for (size_t i = 0; i < array_count(type_names); ++i) {
+		if (type_names[i].type == type)
+			return type_names[i].name;
+	}
+
+	return "Unknown";
+}
+
+bool psupply_ac_online(const acpi_psupply_t *ps)
+{
+	for (size_t slot = 0; slot < ps->count; ++slot) {
+		if (is_mains(ps->types[slot]) && ps->online[slot])
+			return true;
+	}
+
+	return false;
+}
+
+/* which of `a` and `b` a battery reports, the first one when it has both */
+static inline unsigned int battery_unit(unsigned int attrs, unsigned int a,
+					unsigned int b)
+{
+	return (attrs & a) ? a : attrs & b;
+}
+
+/*
+ * Totals are only added up in one unit. When some batteries report energy
+ * and others only charge, the totals stay 0 and the capacity is the mean
+ * of the percentages; the same goes for power and current.
+ */
+void psupply_summarize(const acpi_psupply_t *ps, psupply_summary_t *sum)
+{
+	unsigned int energy_units = 0, rate_units = 0;
+	int percent_sum = 0;
+
+	memset(sum, 0, sizeof(struct __psupply_summary));
+	sum->ac_online = psupply_ac_online(ps);
+
+	for (size_t slot = 0; slot < ps->count; ++slot) {
+		if (is_mains(ps->types[slot])) {
+			++sum->mains;
+			continue;
+		}
+
+		++sum->batteries;
+		energy_units |= battery_unit(ps->attrs[slot], PSUPPLY_HAS_ENERGY,
+					     PSUPPLY_HAS_CHARGE);
+		rate_units |= battery_unit(ps->attrs[slot], PSUPPLY_HAS_POWER,
+					   PSUPPLY_HAS_CURRENT);
+		percent_sum += ps->capacity[slot];
+		sum->energy_now += ps->energy_now[slot];
+		sum->energy_full += ps->energy_full[slot];
+		sum->rate += ps->rate[slot];
+	}
+
+	if (energy_units == (PSUPPLY_HAS_ENERGY | PSUPPLY_HAS_CHARGE))
+		sum->energy_now = sum->energy_full = 0;
+	if (rate_units == (PSUPPLY_HAS_POWER | PSUPPLY_HAS_CURRENT))
+		sum->rate = 0;
+
+	/* weigh batteries by size when we know it */
+	if (sum->energy_full > 0)
+		sum->capacity = (int) (sum->energy_now * 100 / sum->energy_full);
+	else if (sum->batteries)
+		sum->capacity = percent_sum / sum->batteries;
+	else
+		sum->capacity = -1;
+}
+
+void psupply_free(acpi_psupply_t *ps)
+{
+	psupply_close(ps);
+	free(ps->types);
+	free(ps->attrs);
+	free(ps->dirfds);
+	free(ps->uevent_fds);
+	free(ps->online);
+	free(ps->capacity);
+	free(ps->energy_now);
+	free(ps->energy_full);
+	free(ps->rate);
+	free(ps->names);
+	memset(ps, 0, sizeof(struct __acpi_psupply));
+}
+
+static void psupply_close(acpi_psupply_t *ps)
+{
+	for (size_t slot = 0; slot < ps->count; ++slot) {
+		close(ps->dirfds[slot]);
+		if (ps->uevent_fds[slot] >= 0)
+			close(ps->uevent_fds[slot]);
+	}
+
+	ps->count = 0;
+}
+
+static void psupply_add(acpi_psupply_t *ps, psupply_type_t type, int dirfd,
+			const char *name)
+{
+	size_t slot = ps->count;
+	long full = 0;
+
+	if (slot == ps->slots) {
+		ps->slots = ps->slots ? ps->slots * 2 : PSUPPLY_INITIAL_SLOTS;
+		grow_array(ps->types, ps->slots);
+		grow_array(ps->attrs, ps->slots);
+		grow_array(ps->dirfds, ps->slots);
+		grow_array(ps->uevent_fds, ps->slots);
+		grow_array(ps->online, ps->slots);
+		grow_array(ps->capacity, ps->slots);
+		grow_array(ps->energy_now, ps->slots);
+		grow_array(ps->energy_full, ps->slots);
+		grow_array(ps->rate, ps->slots);
+		grow_array(ps->names, ps->slots);
+	}
+
+	ps->types[slot] = type;
+	ps->dirfds[slot] = dirfd;
+	ps->uevent_fds[slot] = -1;
+	ps->attrs[slot] = 0;
+	ps->online[slot] = 0;
+	ps->capacity[slot] = 0;
+	ps->energy_now[slot] = 0;
+	ps->rate[slot] = 0;
+	snprintf(ps->names[slot], MAX_PSUPPLY_NAME, "%s", name);
+
+	/* probe once which attributes exist, so reads never fail later on */
+	for (size_t i = 0; i < array_count(attr_names); ++i) {
+		if (faccessat(dirfd, attr_names[i].name, R_OK, 0) == 0)
+			ps->attrs[slot] |= attr_names[i].flag;
+	}
+
+	/* the design capacity barely changes, read it once per scan */
+	if (ps->attrs[slot] & PSUPPLY_HAS_ENERGY)
+		sysfs_read_long_at(dirfd, "energy_full", &full);
+	else if (ps->attrs[slot] & PSUPPLY_HAS_CHARGE)
+		sysfs_read_long_at(dirfd, "charge_full", &full);
+	ps->energy_full[slot] = full;
+
+	/* kept open, every battery reading is then a single pread() */
+	if (type == PSUPPLY_BATTERY)
+		ps->uevent_fds[slot] = openat(dirfd, "uevent", O_RDONLY | O_CLOEXEC);
+
+	++ps->count;
+}
+
+static int read_battery(acpi_psupply_t *ps, size_t slot)
+{
+	unsigned int attrs = ps->attrs[slot];
+	int fd = ps->dirfds[slot];
+	sysfs_value_t status;
+	long value;
+
+	if ((attrs & PSUPPLY_HAS_CAPACITY) &&
+	    sysfs_read_long_at(fd, "capacity", &value) == 0)
+		ps->capacity[slot] = (int) value;
+	else if (attrs & PSUPPLY_HAS_CAPACITY)
+		goto gone;
+
+	if (((attrs & PSUPPLY_HAS_ENERGY) &&
+	     sysfs_read_long_at(fd, "energy_now", &value) == 0) ||
+	    ((attrs & PSUPPLY_HAS_CHARGE) &&
+	     sysfs_read_long_at(fd, "charge_now", &value) == 0))
+		ps->energy_now[slot] = value;
+
+	if (((attrs & PSUPPLY_HAS_POWER) &&
+	     sysfs_read_long_at(fd, "power_now", &value) == 0) ||
+	    ((attrs & PSUPPLY_HAS_CURRENT) &&
+	     sysfs_read_long_at(fd, "current_now", &value) == 0)) {
+		/* drivers disagree on the sign, status doesn't */
+		if (value < 0)
+			value = -value;
+		if ((attrs & PSUPPLY_HAS_STATUS) &&
+		    sysfs_read_str_at(fd, "status", status, sizeof(status)) >= 0 &&
+		    strcmp(status, "Discharging") == 0)
+			value = -value;
+		ps->rate[slot] = value;
+	}
+
+	return 0;
+
+gone:
+	thinkd_log(LOG_ERR, "cannot read battery %s: %s",
+		   ps->names[slot], strerror(errno));
+	return -1;
+}
+
+static int read_battery_uevent(acpi_psupply_t *ps, size_t slot)
+{
+	psupply_snapshot_t snap;
+	long rate;
+
+	if (psupply_snapshot(ps, slot, &snap) < 0) {
+		thinkd_log(LOG_ERR, "cannot read battery %s: %s",
+			   ps->names[slot], strerror(errno));
+		return -1;
+	}
+
+	if (snap.attrs & PSUPPLY_HAS_CAPACITY)
+		ps->capacity[slot] = (int) snap.capacity;
+
+	if (snap.attrs & PSUPPLY_HAS_ENERGY) {
+		ps->energy_now[slot] = snap.energy_now;
+		if (snap.energy_full)
+			ps->energy_full[slot] = snap.energy_full;
+	}
+	else if (snap.attrs & PSUPPLY_HAS_CHARGE) {
+		ps->energy_now[slot] = snap.charge_now;
+		if (snap.charge_full)
+			ps->energy_full[slot] = snap.charge_full;
+	}
+
+	if (snap.attrs & (PSUPPLY_HAS_POWER | PSUPPLY_HAS_CURRENT)) {
+		rate = (snap.attrs & PSUPPLY_HAS_POWER) ? snap.power_now : snap.current_now;
+		/* drivers disagree on the sign, status doesn't */
+		if (rate < 0)
+			rate = -rate;
+		ps->rate[slot] = snap.discharging ? -rate : rate;
+	}
+
+	return 0;
+}
@@ -0,0 +1,97 @@
+#ifndef _PSUPPLY_H_
+#define _PSUPPLY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define POWER_SUPPLY_DIRECTORY "/sys/class/power_supply"
+#define MAX_PSUPPLY_NAME 32
+#define PSUPPLY_INITIAL_SLOTS 4
+#define PSUPPLY_UEVENT_SIZE 2048
+
+/* what psupply_read() refreshes */
+#define PSUPPLY_READ_MAINS	(1 << 0)
+#define PSUPPLY_READ_BATTERIES	(1 << 1)
+#define PSUPPLY_READ_ALL	(PSUPPLY_READ_MAINS | PSUPPLY_READ_BATTERIES)
+#define PSUPPLY_READ_ATTRIBUTES	(1 << 2)	/* one file each, even with a uevent */
+
+/* attributes a supply was found to have when it was scanned */
+#define PSUPPLY_HAS_ONLINE	(1 << 0)
+#define PSUPPLY_HAS_CAPACITY	(1 << 1)
+#define PSUPPLY_HAS_ENERGY	(1 << 2)
+#define PSUPPLY_HAS_CHARGE	(1 << 3)
+#define PSUPPLY_HAS_POWER	(1 << 4)
+#define PSUPPLY_HAS_CURRENT	(1 << 5)
+#define PSUPPLY_HAS_STATUS	(1 << 6)
+#define PSUPPLY_HAS_VOLTAGE	(1 << 7)
+
+typedef enum __psupply_type {
+	PSUPPLY_UNKNOWN,
+	PSUPPLY_MAINS,
+	PSUPPLY_USB,		/* USB-C PD and other USB chargers */
+	PSUPPLY_UPS,
+	PSUPPLY_BATTERY,
+} psupply_type_t;
+
+/*
+ * Every supply found under POWER_SUPPLY_DIRECTORY, kept as parallel arrays
+ * indexed by slot so a probe walks a few small contiguous arrays. Each slot
+ * holds an O_PATH handle on the supply directory which attributes are
+ * opened relative to, plus the last readings.
+ */
+typedef struct __acpi_psupply {
+	size_t count;
+	size_t slots;
+	psupply_type_t *types;
+	unsigned int *attrs;
+	int *dirfds;
+	int *uevent_fds;	/* batteries only, -1 without a uevent file */
+	int *online;
+	int *capacity;		/* percent */
+	long *energy_now;	/* uWh, or uAh when only charge_* exists */
+	long *energy_full;
+	long *rate;		/* uW (or uA), negative while discharging */
+	char (*names)[MAX_PSUPPLY_NAME];
+} acpi_psupply_t;
+
+/*
+ * One battery reading, parsed from a single read of its uevent file so
+ * all values come from the same update. `attrs` tells which were there.
+ */
+typedef struct __psupply_snapshot {
+	unsigned int attrs;
+	bool discharging;
+	long online;
+	long capacity;
+	long energy_now;
+	long energy_full;
+	long charge_now;
+	long charge_full;
+	long power_now;
+	long current_now;
+	long voltage_now;
+} psupply_snapshot_t;
+
+/* totals across every supply of a table */
+typedef struct __psupply_summary {
+	bool ac_online;
+	int mains;
+	int batteries;
+	int capacity;		/* percent over all batteries, -1 if unknown */
+	long energy_now;	/* uWh or uAh, 0 when batteries mix both */
+	long energy_full;
+	long rate;		/* uW or uA, 0 when batteries mix both */
+} psupply_summary_t;
+
+extern int scan_power_supply(acpi_psupply_t *dest);
+extern int psupply_read(acpi_psupply_t *ps, unsigned int what);
+extern int psupply_snapshot(const acpi_psupply_t *ps, size_t slot,
+			    psupply_snapshot_t *snap);
+extern void psupply_parse_uevent(const char *buffer, size_t len,
+				 psupply_snapshot_t *snap);
+extern void psupply_summarize(const acpi_psupply_t *ps, psupply_summary_t *sum);
+extern bool psupply_ac_online(const acpi_psupply_t *ps);
+extern const char *psupply_type_name(psupply_type_t type);
+extern void psupply_free(acpi_psupply_t *ps);
+
+#endif /* _PSUPPLY_H_ */
@@ -0,0 +1,389 @@
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+
+#include "void.h"
+#include "remote.h"
+#include "ctl.h"
+#include "conf_utils.h"
+#include "events.h"
+#include "logger.h"
+
+/*
+ * Remote control over TCP for fleets, off unless Remote_Listen is set in
+ * the [daemon] section. Every connection runs one command:
+ *
+ *	server: thinkd 1 <nonce>
+ *	client: <mac> <command line>
+ *	server: <reply>
+ *
+ * where <mac> is the hex HMAC-SHA256 of "<nonce> <command line>" under the
+ * key in Remote_Key_File, so a recorded exchange can't be played again.
+ * Like the control socket everything is non-blocking and driven by the
+ * event loop, and clients that go quiet are dropped after a timeout.
+ */
+
+typedef struct __remote_client {
+	bool active;
+	int fd;
+	size_t len;
+	char nonce[2 * REMOTE_NONCE_LEN + 1];
+	char peer[NI_MAXHOST];
+	char line[REMOTE_MAX_LINE];
+} remote_client_t;
+
+/* what a remote peer may do, a subset of the control socket */
+static const char *remote_commands[] = { "status", "mode", "reload" };
+
+static int listen_fd = -1;
+static char bound_address[MAX_CONF_STR_LEN];
+static uint8_t key[REMOTE_MAX_KEY];
+static size_t key_len;
+static remote_client_t clients[REMOTE_MAX_CLIENTS];
+
+static int remote_listen(const char *address);
+static void remote_accept(int fd, short revents, void *data);
+static void remote_client_read(int fd, short revents, void *data);
+static void remote_client_timeout(void *data);
+static void remote_client_close(remote_client_t *client);
+static void remote_run(remote_client_t *client, char *reply, size_t len);
+static void to_hex(const uint8_t *data, size_t len, char *dest);
+
+/*
+ * Follow the [daemon] settings, called at startup and after every reload.
+ * The key is always read again, the listener only moves when the address
+ * changed.
+ */
+int remote_configure()
+{
+	const char *address = daemon_prefs.remote_listen;
+
+	if (! address[0]) {
+		remote_close();
+		return 0;
+	}
+
+	if (remote_read_key(daemon_prefs.remote_key_file, key, &key_len) < 0) {
+		thinkd_log(LOG_ERR, "remote: no usable key in %s, not listening",
+			   daemon_prefs.remote_key_file);
+		remote_close();
+		return -1;
+	}
+
+	if (listen_fd >= 0 && strcmp(address, bound_address) == 0)
+		return 0;
+
+	remote_close();
+	return remote_listen(address);
+}
+
+void remote_close()
+{
+	for (remote_client_t *c = clients; c < clients + array_count(clients); ++c)
+		remote_client_close(c);
+
+	bound_address[0] = '\0';
+	if (listen_fd < 0)
+		return;
+
+	event_del_fd(listen_fd);
+	close(listen_fd);
+	listen_fd = -1;
+}
+
+/* the key is the file's contents up to the first newline */
+int remote_read_key(const char *path, uint8_t *dest, size_t *len)
+{
+	struct stat st;
+	uint8_t *newline;
+	ssize_t nread;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) == 0 && (st.st_mode & (S_IRWXG | S_IRWXO)))
+		thinkd_log(LOG_ERR, "remote: %s is readable by others", path);
+
+	nread = read(fd, dest, REMOTE_MAX_KEY);
+	close(fd);
+	if (nread <= 0)
+		return -1;
+
+	newline = memchr(dest, '\n', nread);
+	*len = newline ? (size_t) (newline - dest) : (size_t) nread;
+
+	return *len ? 0 : -1;
+}
+
+void remote_sign(const uint8_t *key, size_t key_len, const char *nonce,
+		 const char *command, char mac_hex[REMOTE_MAC_HEX + 1])
+{
+	char message[REMOTE_MAX_LINE + 2 * REMOTE_NONCE_LEN + 2];
+	uint8_t mac[SHA256_LEN];
+	int len;
+
+	len = snprintf(message, sizeof(message), "%s %s", nonce, command);
+	hmac_sha256(key, key_len, message, len, mac);
+	to_hex(mac, sizeof(mac), mac_hex);
+}
+
+/* host:port, [v6 address]:port or just a host */
+int remote_split_address(const char *address, char *host, size_t host_len,
+			 char *port, size_t port_len)
+{
+	const char *colon, *end = address + strlen(address);
+
+	if (address[0] == '[') {
+		const char *bracket = strchr(address, ']');
+
+		if (! bracket)
+			return -1;
+		colon = bracket[1] == ':' ? bracket + 1 : NULL;
+		snprintf(host, host_len, "%.*s", (int) (bracket - address - 1), address + 1);
+	}
+	else {
+		colon = strrchr(address, ':');
+		/* a bare v6 address has more than one colon */
+		if (colon && strchr(address, ':') != colon)
+			colon = NULL;
+		snprintf(host, host_len, "%.*s",
+			 (int) ((colon ? colon : end) - address), address);
+	}
+
+	snprintf(port, port_len, "%s", colon ? colon + 1 : REMOTE_DEFAULT_PORT);
+	return 0;
+}
+
+/*
+ * A non-blocking TCP socket listening on a numeric host:port, numeric only
+ * since a resolver must never stall the daemon; that also keeps a static
+ * build free of glibc's NSS modules. An empty host listens on every IPv4
+ * address. Returns -1 with the reason logged.
+ */
+int remote_tcp_listen(const char *address, int backlog)
+{
+	struct sockaddr_in6 addr6 = { .sin6_family = AF_INET6 };
+	struct sockaddr_in addr4 = { .sin_family = AF_INET };
+	struct sockaddr *addr = (struct sockaddr *) &addr4;
+	socklen_t addr_len = sizeof(addr4);
+	char host[NI_MAXHOST], port[NI_MAXSERV], *end;
+	int fd, one = 1;
+	long number;
+
+	if (remote_split_address(address, host, sizeof(host), port, sizeof(port)) < 0) {
+		thinkd_log(LOG_ERR, "cannot parse address %s", address);
+		return -1;
+	}
+
+	number = strtol(port, &end, 10);
+	if (! port[0] || *end || number < 0 || number > 65535) {
+		thinkd_log(LOG_ERR, "bad address %s: not a port number", address);
+		return -1;
+	}
+
+	if (! host[0])
+		addr4.sin_addr.s_addr = htonl(INADDR_ANY);
+	else if (inet_pton(AF_INET6, host, &addr6.sin6_addr) == 1) {
+		addr = (struct sockaddr *) &addr6;
+		addr_len = sizeof(addr6);
+	}
+	else if (inet_pton(AF_INET, host, &addr4.sin_addr) != 1) {
+		thinkd_log(LOG_ERR, "bad address %s: not a numeric host", address);
+		return -1;
+	}
+	addr4.sin_port = addr6.sin6_port = htons((uint16_t) number);
+
+	fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		LOG_SIMPLE_ERR("socket");
+		return -1;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, addr, addr_len) < 0 || listen(fd, backlog) < 0) {
+		thinkd_log(LOG_ERR, "cannot listen on %s: %s", address, strerror(errno));
+		close(fd);
+		fd = -1;
+	}
+
+	return fd;
+}
+
+static int remote_listen(const char *address)
+{
+	listen_fd = remote_tcp_listen(address, REMOTE_MAX_CLIENTS);
+	if (listen_fd < 0)
+		return -1;
+
+	if (event_add_fd(listen_fd, POLLIN, remote_accept, NULL) < 0) {
+		close(listen_fd);
+		listen_fd = -1;
+		return -1;
+	}
+
+	snprintf(bound_address, sizeof(bound_address), "%s", address);
+	thinkd_log(LOG_INFO, "remote: listening on %s", address);
+	return 0;
+}
+
+static void remote_accept(int fd, short revents, void *data)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+	remote_client_t *client = NULL;
+	uint8_t nonce[REMOTE_NONCE_LEN];
+	char greeting[64];
+	int cfd, len;
+
+	cfd = accept4(fd, (struct sockaddr *) &addr, &addr_len,
+		      SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (cfd < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			LOG_SIMPLE_ERR("accept");
+		return;
+	}
+
+	for (remote_client_t *c = clients; c < clients + array_count(clients); ++c) {
+		if (! c->active) {
+			client = c;
+			break;
+		}
+	}
+
+	if (! client || getrandom(nonce, sizeof(nonce), GRND_NONBLOCK) != sizeof(nonce) ||
+	    event_add_fd(cfd, POLLIN, remote_client_read, client) < 0) {
+		close(cfd);
+		return;
+	}
+
+	client->active = true;
+	client->fd = cfd;
+	client->len = 0;
+	to_hex(nonce, sizeof(nonce), client->nonce);
+	if (getnameinfo((struct sockaddr *) &addr, addr_len, client->peer,
+			sizeof(client->peer), NULL, 0, NI_NUMERICHOST) != 0)
+		snprintf(client->peer, sizeof(client->peer), "unknown");
+
+	/* a fresh socket buffer always has room for this */
+	len = snprintf(greeting, sizeof(greeting), "thinkd 1 %s\n", client->nonce);
+	if (write(cfd, greeting, len) != len) {
+		remote_client_close(client);
+		return;
+	}
+
+	event_timer_set(REMOTE_TIMEOUT_MS, remote_client_timeout, client);
+}
+
+static void remote_client_read(int fd, short revents, void *data)
+{
+	remote_client_t *client = data;
+	char reply[CTL_MAX_REPLY];
+	ssize_t nread;
+
+	nread = read(fd, client->line + client->len,
+		     sizeof(client->line) - client->len - 1);
+	if (nread < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	if (nread > 0) {
+		client->len += nread;
+		client->line[client->len] = '\0';
+
+		if (! memchr(client->line, '\n', client->len) &&
+		    client->len < sizeof(client->line) - 1)
+			return;
+	}
+
+	if (client->len) {
+		remote_run(client, reply, sizeof(reply));
+		if (write(fd, reply, strlen(reply)) < 0)
+			LOG_SIMPLE_ERR("remote write");
+	}
+
+	remote_client_close(client);
+}
+
+static void remote_client_timeout(void *data)
+{
+	remote_client_t *client = data;
+
+	thinkd_log(LOG_INFO, "remote: %s timed out", client->peer);
+	remote_client_close(client);
+}
+
+static void remote_client_close(remote_client_t *client)
+{
+	if (! client->active)
+		return;
+
+	event_timer_cancel(remote_client_timeout, client);
+	event_del_fd(client->fd);
+	close(client->fd);
+	client->active = false;
+	client->len = 0;
+}
+
+static void remote_run(remote_client_t *client, char *reply, size_t len)
+{
+	char expected[REMOTE_MAC_HEX + 1], *command;
+	unsigned char diff = 0;
+	size_t name_len;
+
+	client->line[strcspn(client->line, "\r\n")] = '\0';
+	command = client->line + strcspn(client->line, " ");
+	if (command - client->line != REMOTE_MAC_HEX || ! *command) {
+		snprintf(reply, len, "error: malformed request\n");
+		return;
+	}
+	*command++ = '\0';
+
+	/* compare all of it, the time taken must not leak the mac */
+	remote_sign(key, key_len, client->nonce, command, expected);
+	for (int i = 0; i < REMOTE_MAC_HEX; ++i)
+		diff |= expected[i] ^ client->line[i];
+
+	if (diff) {
+		thinkd_log(LOG_ERR, "remote: authentication failed for %s", client->peer);
+		snprintf(reply, len, "error: authentication failed\n");
+		return;
+	}
+
+	name_len = strcspn(command, " \t");
+	for (size_t i = 0; i < array_count(remote_commands); ++i) {
+		if (name_len == strlen(remote_commands[i]) &&
+		    strncasecmp(command, remote_commands[i], name_len) == 0) {
+			thinkd_log(LOG_INFO, "remote: %s runs '%s'", client->peer, command);
+			ctl_execute(command, reply, len);
+			return;
+		}
+	}
+
+	snprintf(reply, len, "error: '%.*s' is not allowed remotely\n",
+		 (int) name_len, command);
+}
+
+static void to_hex(const uint8_t *data, size_t len, char *dest)
+{
+	static const char digits[] = "0123456789abcdef";
+
+	for (size_t i = 0; i < len; ++i) {
+		*dest++ = digits[data[i] >> 4];
+		*dest++ = digits[data[i] & 0xf];
+	}
+	*dest = '\0';
+}
@@ -0,0 +1,26 @@
+#ifndef _REMOTE_H_
+#define _REMOTE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sha256.h"
+
+#define REMOTE_DEFAULT_PORT "7634"
+#define REMOTE_MAX_CLIENTS 8
+#define REMOTE_MAX_LINE 256
+#define REMOTE_MAX_KEY 64
+#define REMOTE_NONCE_LEN 16
+#define REMOTE_TIMEOUT_MS 5000
+#define REMOTE_MAC_HEX (2 * SHA256_LEN)
+
+extern int remote_configure();
+extern void remote_close();
+extern int remote_read_key(const char *path, uint8_t *key, size_t *len);
+extern void remote_sign(const uint8_t *key, size_t key_len, const char *nonce,
+			const char *command, char mac_hex[REMOTE_MAC_HEX + 1]);
+extern int remote_tcp_listen(const char *address, int backlog);
+extern int remote_split_address(const char *address, char *host, size_t host_len,
+				char *port, size_t port_len);
+
+#endif /* _REMOTE_H_ */
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <linux/rfkill.h>
+
+#include "void.h"
+#include "rfkill.h"
+#include "acpi.h"
+#include "events.h"
+#include "logger.h"
+#include "stats.h"
+#include "state.h"
+
+/*
+ * Radio control through /dev/rfkill. A single RFKILL_OP_CHANGE_ALL write
+ * switches every device of a type, however many there are, and the
+ * kernel reports each device and every change on the same fd, so the
+ * current states are known without reading sysfs. Without the device
+ * (old kernels, fake sysfs roots) callers fall back to the state files.
+ */
+
+typedef struct __rfkill_radio {
+	uint32_t idx;
+	uint8_t type;
+	bool soft;
+	bool hard;
+	bool present;
+} rfkill_radio_t;
+
+static const struct {
+	const char *name;
+	uint8_t type;
+} type_names[] = {
+	{"wlan", RFKILL_TYPE_WLAN},
+	{"bluetooth", RFKILL_TYPE_BLUETOOTH},
+	{"uwb", RFKILL_TYPE_UWB},
+	{"wimax", RFKILL_TYPE_WIMAX},
+	{"wwan", RFKILL_TYPE_WWAN},
+	{"gps", RFKILL_TYPE_GPS},
+	{"fm", RFKILL_TYPE_FM},
+	{"nfc", RFKILL_TYPE_NFC},
+};
+
+static rfkill_radio_t radios[RFKILL_MAX_DEVICES];
+static int rfkill_fd = -1;
+static bool unavailable;
+
+static int rfkill_open();
+static int type_by_name(const char *name);
+static void rfkill_event(int fd, short revents, void *data);
+static void rfkill_drain(int fd);
+static void rfkill_update(const struct rfkill_event *ev);
+
+/*
+ * Soft block or unblock every radio of `type` (the sysfs type name, like
+ * "wlan") with a single write, skipped when they are all there already.
+ * Returns -1 when /dev/rfkill can't be used.
+ */
+int rfkill_set(const char *type, bool on)
+{
+	struct rfkill_event ev;
+	bool pending = false;
+	int rftype;
+	STATS_START(start);
+
+	if ((rftype = type_by_name(type)) < 0 || rfkill_open() < 0)
+		return -1;
+
+	for (rfkill_radio_t *r = radios; r < radios + array_count(radios); ++r) {
+		sysfs_path_t path;
+
+		if (! r->present || r->type != rftype)
+			continue;
+		if (r->soft == on)
+			pending = true;
+
+		/* journaled as the state file, so snapshots can check it */
+		sysroot_sprintf(path, "/sys/class/rfkill/rfkill%u/state", r->idx);
+		state_journal_record(path, on ? "1" : "0");
+	}
+
+	if (! pending)
+		return 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = (uint8_t) rftype;
+	ev.op = RFKILL_OP_CHANGE_ALL;
+	ev.soft = ! on;
+	if (write(rfkill_fd, &ev, sizeof(ev)) != (ssize_t) sizeof(ev)) {
+		thinkd_log(LOG_ERR, "rfkill: cannot switch %s %s: %s", type,
+			   on ? "on" : "off", strerror(errno));
+		stats_error(RFKILL_DEVICE);
+		return -1;
+	}
+	STATS_END(STAT_KNOB_WRITE, start);
+
+	/* the kernel confirms with a change event per device */
+	rfkill_drain(rfkill_fd);
+	return 0;
+}
+
+/*
+ * How the radios of `type` are blocked: bit 0 when any is soft blocked,
+ * bit 1 when any is hard blocked, -1 when that isn't known.
+ */
+int rfkill_blocked(const char *type)
+{
+	int rftype = type_by_name(type), blocked = 0;
+
+	if (rftype < 0 || rfkill_fd < 0)
+		return -1;
+
+	for (rfkill_radio_t *r = radios; r < radios + array_count(radios); ++r) {
+		if (! r->present || r->type != rftype)
+			continue;
+		blocked |= (r->soft ? 1 : 0) | (r->hard ? 2 : 0);
+	}
+
+	return blocked;
+}
+
+void rfkill_close()
+{
+	memset(radios, 0, sizeof(radios));
+	unavailable = false;
+	if (rfkill_fd < 0)
+		return;
+
+	event_del_fd(rfkill_fd);
+	close(rfkill_fd);
+	rfkill_fd = -1;
+}
+
+static int rfkill_open()
+{
+	char path[MAX_SYSFS_PATH_LEN];
+	int fd;
+
+	if (rfkill_fd >= 0)
+		return 0;
+	if (unavailable)
+		return -1;
+
+	sysroot_sprintf(path, "%s", RFKILL_DEVICE);
+	fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		unavailable = true;
+		if (errno != ENOENT)
+			thinkd_log(LOG_ERR, "rfkill: cannot open %s: %s", path,
+				   strerror(errno));
+		return -1;
+	}
+
+	if (event_add_fd(fd, POLLIN, rfkill_event, NULL) < 0) {
+		unavailable = true;
+		close(fd);
+		return -1;
+	}
+
+	/* the kernel starts with an add event for every existing device */
+	rfkill_fd = fd;
+	rfkill_drain(fd);
+	return 0;
+}
+
+static int type_by_name(const char *name)
+{
+	for (size_t i = 0; i < array_count(type_names); ++i) {
+		if (strcmp(type_names[i].name, name) == 0)
+			return type_names[i].type;
+	}
+
+	return -1;
+}
+
+static void rfkill_event(int fd, short revents, void *data)
+{
+	(void) data;
+
+	if (revents & (POLLERR | POLLNVAL)) {
+		thinkd_log(LOG_ERR, "rfkill: %s went away", RFKILL_DEVICE);
+		rfkill_close();
+		return;
+	}
+
+	rfkill_drain(fd);
+}
+
+/* every read returns exactly one event */
+static void rfkill_drain(int fd)
+{
+	struct rfkill_event ev;
+	ssize_t len;
+
+	while ((len = read(fd, &ev, sizeof(ev))) > 0) {
+		if (len >= (ssize_t) RFKILL_EVENT_SIZE_V1)
+			rfkill_update(&ev);
+	}
+
+	if (len < 0 && errno != EAGAIN && errno != EINTR)
+		LOG_SIMPLE_ERR("rfkill read");
+}
+
+static void rfkill_update(const struct rfkill_event *ev)
+{
+	rfkill_radio_t *radio = NULL, *free_slot = NULL;
+
+	/* requests, never sent by the kernel itself */
+	if (ev->op == RFKILL_OP_CHANGE_ALL)
+		return;
+
+	for (rfkill_radio_t *r = radios; r < radios + array_count(radios); ++r) {
+		if (r->present && r->idx == ev->idx)
+			radio = r;
+		else if (! r->present && ! free_slot)
+			free_slot = r;
+	}
+
+	if (ev->op == RFKILL_OP_DEL) {
+		if (radio)
+			radio->present = false;
+		return;
+	}
+
+	if (! radio) {
+		if (! free_slot) {
+			thinkd_log(LOG_ERR, "rfkill: more than %d radios, ignoring rfkill%u",
+				   RFKILL_MAX_DEVICES, ev->idx);
+			return;
+		}
+		radio = free_slot;
+		radio->idx = ev->idx;
+		radio->present = true;
+	}
+	else if (radio->hard != (ev->hard != 0)) {
+		thinkd_log(LOG_INFO, "rfkill: rfkill%u hard %s", ev->idx,
+			   ev->hard ? "blocked" : "unblocked");
+	}
+
+	radio->type = ev->type;
+	radio->soft = ev->soft != 0;
+	radio->hard = ev->hard != 0;
+}
@@ -0,0 +1,19 @@
+#ifndef _RFKILL_H_
+#define _RFKILL_H_
+
+#include <stdbool.h>
+
+#include "config.h"
+
+#define RFKILL_DEVICE "/dev/rfkill"
+#define RFKILL_MAX_DEVICES 32
+
+extern int rfkill_set(const char *type, bool on);
+extern int rfkill_blocked(const char *type);
+#if WITH_RADIO_KNOBS
+extern void rfkill_close();
+#else
+static inline void rfkill_close() { }
+#endif
+
+#endif /* _RFKILL_H_ */
@@ -0,0 +1,479 @@
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "void.h"
+#include "rules.h"
+#include "mode.h"
+#include "acpi.h"
+#include "logger.h"
+
+/*
+ * Mode selection rules from the [rules] section, e.g.
+ *
+ *	Rule1=critical if battery<5 and !ac
+ *	Rule2=powersave if temp>=85
+ *	Rule3=performance if ac and lid=open
+ *
+ * The lowest numbered rule that holds wins. The built-in rules follow
+ * them, so without any the choice is what it always was: performance on
+ * AC or while boosting, powersave otherwise.
+ *
+ * A rule only ANDs comparisons, so it holds over one range of each
+ * input. At config load the bounds of all the ranges cut every input
+ * into intervals, and each interval is given the mask of rules holding
+ * over it. Evaluating looks up the interval of each input, ANDs the
+ * masks and takes the lowest bit: a few binary searches over at most
+ * RULES_MAX_BOUNDS values, whatever the rules.
+ */
+
+typedef struct __rule {
+	power_prefs_t *mode;
+	int lower[RULE_INPUTS];	/* inclusive, INT_MIN while not tested */
+	int upper[RULE_INPUTS];
+	char text[MAX_CONF_STR_LEN + 8];
+	bool builtin;
+} rule_t;
+
+/* the intervals of one input, and the rules holding over each */
+typedef struct __rules_column {
+	unsigned int count;
+	int start[RULES_MAX_BOUNDS];	/* ascending, the first is INT_MIN */
+	rules_mask_t match[RULES_MAX_BOUNDS];
+} rules_column_t;
+
+static const char *const input_names[RULE_INPUTS] = {
+	[RULE_AC] = "ac",
+	[RULE_BOOST] = "boost",
+	[RULE_BATTERY] = "battery",
+	[RULE_TEMP] = "temp",
+	[RULE_ON_BATTERY] = "on_battery",
+	[RULE_LID] = "lid",
+};
+
+static rule_t rules[RULES_MAX];
+static unsigned int num_rules;
+static rules_column_t columns[RULE_INPUTS];
+static unsigned int inputs_used;
+static int zone_fds[RULES_MAX_ZONES];
+static unsigned int num_zones;
+static int lid_fd = -1;
+
+static int parse_rule(const char *text, rule_t *rule);
+static const char *parse_word(const char *p, char *dest, size_t len);
+static int parse_value(rule_input_t input, const char *p, const char **end);
+static void rule_narrow(rule_t *rule, rule_input_t input, int lower, int upper);
+static void rule_add(power_prefs_t *mode, const char *text, rule_input_t input,
+		     int value);
+static void column_build(rule_input_t input);
+static void sensors_open();
+static int zone_open(int dirfd, const char *name, void *data);
+static int lid_open(int dirfd, const char *name, void *data);
+static long read_long(int fd);
+
+/*
+ * Build the table from `prefs`. Rules that don't parse are left out with
+ * an error; returns the number of rules from `prefs` in use.
+ */
+int rules_compile(const rule_prefs_t *prefs)
+{
+	int compiled = 0;
+
+	num_rules = 0;
+	for (int n = 0; n < MAX_CONF_RULES; ++n) {
+		rule_t *rule = &rules[num_rules];
+
+		if (! prefs->rules[n][0])
+			continue;
+
+		snprintf(rule->text, sizeof(rule->text), "Rule%d: %s", n + 1, prefs->rules[n]);
+		if (parse_rule(prefs->rules[n], rule) < 0) {
+			thinkd_log(LOG_ERR, "Rule%d left out: %s", n + 1, prefs->rules[n]);
+			continue;
+		}
+
+		for (int in = 0; in < RULE_INPUTS; ++in) {
+			if (rule->lower[in] > rule->upper[in]) {
+				thinkd_log(LOG_ERR, "Rule%d never holds: %s", n + 1,
+					   prefs->rules[n]);
+				break;
+			}
+		}
+		++num_rules;
+		++compiled;
+	}
+
+	rule_add(&mode_performance, "AC online", RULE_AC, 1);
+	rule_add(&mode_performance, "boosting", RULE_BOOST, 1);
+	rule_add(&mode_powersave, "on battery", RULE_INPUTS, 0);
+
+	inputs_used = 0;
+	for (rule_input_t in = 0; in < RULE_INPUTS; ++in)
+		column_build(in);
+	sensors_open();
+
+	return compiled;
+}
+
+/* the inputs some rule tests, the others needn't be read */
+unsigned int rules_inputs()
+{
+	return inputs_used;
+}
+
+/* read the temperature and lid state, when a rule wants them */
+void rules_sense(int *inputs)
+{
+	inputs[RULE_TEMP] = RULES_UNKNOWN;
+	inputs[RULE_LID] = RULES_UNKNOWN;
+
+	for (unsigned int i = 0; i < num_zones; ++i) {
+		long temp = read_long(zone_fds[i]);
+
+		/* millidegrees, and some zones report nonsense when idle */
+		if (temp > 0 && temp / 1000 > inputs[RULE_TEMP])
+			inputs[RULE_TEMP] = (int) (temp / 1000);
+	}
+
+	if (lid_fd >= 0) {
+		char state[64];
+		ssize_t nread = pread(lid_fd, state, sizeof(state) - 1, 0);
+
+		if (nread > 0) {
+			state[nread] = '\0';
+			inputs[RULE_LID] = strstr(state, "closed") != NULL;
+		}
+	}
+}
+
+/* the rule that wins for `inputs`, every input indexed by rule_input_t */
+int rules_eval(const int *inputs)
+{
+	rules_mask_t match = ~(rules_mask_t) 0;
+
+	for (rule_input_t in = 0; in < RULE_INPUTS; ++in) {
+		const rules_column_t *col = &columns[in];
+		unsigned int lo = 0, hi = col->count;
+
+		/* the last interval starting at or below the value */
+		while (hi - lo > 1) {
+			unsigned int mid = (lo + hi) / 2;
+
+			if (col->start[mid] <= inputs[in])
+				lo = mid;
+			else
+				hi = mid;
+		}
+		match &= col->match[lo];
+	}
+
+	/* the last built-in rule always holds */
+	return match ? __builtin_ctz(match) : (int) num_rules - 1;
+}
+
+power_prefs_t *rules_mode(int rule)
+{
+	return rules[rule].mode;
+}
+
+const char *rules_text(int rule)
+{
+	return rules[rule].text;
+}
+
+bool rules_builtin(int rule)
+{
+	return rules[rule].builtin;
+}
+
+void rules_close()
+{
+	for (unsigned int i = 0; i < num_zones; ++i)
+		close(zone_fds[i]);
+	num_zones = 0;
+
+	if (lid_fd >= 0)
+		close(lid_fd);
+	lid_fd = -1;
+}
+
+/* "MODE [if CONDITION [and CONDITION]...]" */
+static int parse_rule(const char *text, rule_t *rule)
+{
+	char word[MAX_CONF_STR_LEN];
+	const char *p = text;
+
+	for (int in = 0; in < RULE_INPUTS; ++in) {
+		rule->lower[in] = INT_MIN;
+		rule->upper[in] = INT_MAX;
+	}
+	rule->builtin = false;
+
+	p = parse_word(p, word, sizeof(word));
+	if (! (rule->mode = mode_by_name(word))) {
+		thinkd_log(LOG_ERR, "rules: unknown mode '%s'", word);
+		return -1;
+	}
+
+	p = parse_word(p, word, sizeof(word));
+	if (! word[0])
+		return 0;
+	if (strcasecmp(word, "if") != 0) {
+		thinkd_log(LOG_ERR, "rules: expected 'if' instead of '%s'", word);
+		return -1;
+	}
+
+	do {
+		bool negate = false;
+		rule_input_t input;
+		char op[3] = "";
+		int value;
+
+		while (isblank((unsigned char) *p))
+			++p;
+		if (*p == '!') {
+			negate = true;
+			++p;
+		}
+
+		p = parse_word(p, word, sizeof(word));
+		for (input = 0; input < RULE_INPUTS; ++input) {
+			if (strcasecmp(word, input_names[input]) == 0)
+				break;
+		}
+		if (input == RULE_INPUTS) {
+			thinkd_log(LOG_ERR, "rules: unknown input '%s'", word);
+			return -1;
+		}
+
+		while (isblank((unsigned char) *p))
+			++p;
+		for (int i = 0; i < 2 && *p && strchr("<>=!", *p); ++i)
+			op[i] = *p++;
+
+		/* "ac" and "!ac", the same for boost */
+		if (! op[0]) {
+			if (input != RULE_AC && input != RULE_BOOST) {
+				thinkd_log(LOG_ERR, "rules: '%s' needs a comparison", word);
+				return -1;
+			}
+			rule_narrow(rule, input, ! negate, ! negate);
+		}
+		else if (negate) {
+			thinkd_log(LOG_ERR, "rules: '!%s' can't be compared", word);
+			return -1;
+		}
+		else {
+			value = parse_value(input, p, &p);
+			if (value == RULES_UNKNOWN)
+				return -1;
+
+			if (strcmp(op, "<") == 0)
+				rule_narrow(rule, input, INT_MIN, value - 1);
+			else if (strcmp(op, "<=") == 0)
+				rule_narrow(rule, input, INT_MIN, value);
+			else if (strcmp(op, ">") == 0)
+				rule_narrow(rule, input, value + 1, INT_MAX);
+			else if (strcmp(op, ">=") == 0)
+				rule_narrow(rule, input, value, INT_MAX);
+			else if (strcmp(op, "=") == 0)
+				rule_narrow(rule, input, value, value);
+			/* only a yes or no has a single other value */
+			else if (strcmp(op, "!=") == 0 && (input == RULE_AC || input == RULE_BOOST ||
+							  input == RULE_LID))
+				rule_narrow(rule, input, ! value, ! value);
+			else {
+				thinkd_log(LOG_ERR, "rules: '%s' can't be used with %s", op, word);
+				return -1;
+			}
+		}
+
+		p = parse_word(p, word, sizeof(word));
+		if (word[0] && strcasecmp(word, "and") != 0) {
+			thinkd_log(LOG_ERR, "rules: expected 'and' instead of '%s'", word);
+			return -1;
+		}
+	} while (word[0]);
+
+	return 0;
+}
+
+/* the next run of letters, digits and underscores, or an empty word */
+static const char *parse_word(const char *p, char *dest, size_t len)
+{
+	size_t used = 0;
+
+	while (isblank((unsigned char) *p))
+		++p;
+	while ((isalnum((unsigned char) *p) || *p == '_') && used < len - 1)
+		dest[used++] = *p++;
+	dest[used] = '\0';
+
+	return p;
+}
+
+/* a number, or open and closed for the lid */
+static int parse_value(rule_input_t input, const char *p, const char **end)
+{
+	char word[16];
+	long value;
+	char *num_end;
+
+	while (isblank((unsigned char) *p))
+		++p;
+
+	value = strtol(p, &num_end, 10);
+	if (num_end != p && value > INT_MIN + 1 && value < INT_MAX) {
+		*end = num_end;
+		return (int) value;
+	}
+
+	*end = parse_word(p, word, sizeof(word));
+	if (input == RULE_LID && strcasecmp(word, "closed") == 0)
+		return 1;
+	if (input == RULE_LID && strcasecmp(word, "open") == 0)
+		return 0;
+
+	thinkd_log(LOG_ERR, "rules: bad value '%s' for %s", word, input_names[input]);
+	return RULES_UNKNOWN;
+}
+
+/* an input that couldn't be read fails every comparison on it */
+static void rule_narrow(rule_t *rule, rule_input_t input, int lower, int upper)
+{
+	if (lower <= RULES_UNKNOWN)
+		lower = RULES_UNKNOWN + 1;
+	if (lower > rule->lower[input])
+		rule->lower[input] = lower;
+	if (upper < rule->upper[input])
+		rule->upper[input] = upper;
+}
+
+static void rule_add(power_prefs_t *mode, const char *text, rule_input_t input,
+		     int value)
+{
+	rule_t *rule = &rules[num_rules++];
+
+	for (int in = 0; in < RULE_INPUTS; ++in) {
+		rule->lower[in] = INT_MIN;
+		rule->upper[in] = INT_MAX;
+	}
+	if (input < RULE_INPUTS)
+		rule_narrow(rule, input, value, value);
+	rule->mode = mode;
+	rule->builtin = true;
+	snprintf(rule->text, sizeof(rule->text), "%s", text);
+}
+
+static void column_build(rule_input_t input)
+{
+	rules_column_t *col = &columns[input];
+
+	col->count = 0;
+	col->start[col->count++] = INT_MIN;
+
+	/* where some rule starts or stops holding, sorted as they come */
+	for (unsigned int r = 0; r < num_rules; ++r) {
+		const rule_t *rule = &rules[r];
+		int bounds[2] = { rule->lower[input], rule->upper[input] };
+
+		if (bounds[0] == INT_MIN && bounds[1] == INT_MAX)
+			continue;
+		inputs_used |= RULE_NEEDS(input);
+
+		for (int b = 0; b < 2; ++b) {
+			unsigned int pos;
+
+			if (b == 1 && (bounds[1] == INT_MAX || bounds[1] < bounds[0]))
+				break;
+			if (b == 1)
+				++bounds[1];
+
+			for (pos = 0; pos < col->count && col->start[pos] < bounds[b]; ++pos)
+				;
+			if (pos < col->count && col->start[pos] == bounds[b])
+				continue;
+			memmove(col->start + pos + 1, col->start + pos,
+				(col->count - pos) * sizeof(col->start[0]));
+			col->start[pos] = bounds[b];
+			++col->count;
+		}
+	}
+
+	for (unsigned int i = 0; i < col->count; ++i) {
+		col->match[i] = 0;
+		for (unsigned int r = 0; r < num_rules; ++r) {
+			if (rules[r].lower[input] <= col->start[i] &&
+			    col->start[i] <= rules[r].upper[input])
+				col->match[i] |= (rules_mask_t) 1 << r;
+		}
+	}
+}
+
+/* the files of the sensors some rule tests stay open */
+static void sensors_open()
+{
+	sysfs_path_t path;
+
+	rules_close();
+	if (inputs_used & RULE_NEEDS(RULE_TEMP)) {
+		sysroot_sprintf(path, "%s", "/sys/class/thermal");
+		sysfs_foreach_entry(path, zone_open, NULL);
+		if (! num_zones)
+			thinkd_log(LOG_ERR, "rules: no thermal zones, temp is unknown");
+	}
+
+	if (inputs_used & RULE_NEEDS(RULE_LID)) {
+		sysroot_sprintf(path, "%s", "/proc/acpi/button/lid");
+		sysfs_foreach_entry(path, lid_open, NULL);
+		if (lid_fd < 0)
+			thinkd_log(LOG_ERR, "rules: no lid switch, its state is unknown");
+	}
+}
+
+static int zone_open(int dirfd, const char *name, void *data)
+{
+	sysfs_path_t path;
+	int fd;
+
+	(void) data;
+	if (strncmp(name, "thermal_zone", 12) != 0)
+		return 0;
+
+	sysfs_sprintf(path, "%s/temp", name);
+	if ((fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC)) < 0)
+		return 0;
+	zone_fds[num_zones++] = fd;
+
+	return num_zones == RULES_MAX_ZONES;
+}
+
+static int lid_open(int dirfd, const char *name, void *data)
+{
+	sysfs_path_t path;
+
+	(void) data;
+	sysfs_sprintf(path, "%s/state", name);
+	lid_fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+
+	return lid_fd >= 0;
+}
+
+static long read_long(int fd)
+{
+	char buffer[32];
+	ssize_t nread = pread(fd, buffer, sizeof(buffer) - 1, 0);
+
+	if (nread <= 0)
+		return -1;
+	buffer[nread] = '\0';
+
+	return strtol(buffer, NULL, 10);
+}
@@ -0,0 +1,40 @@
+#ifndef _RULES_H_
+#define _RULES_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "conf_utils.h"
+
+#define RULES_BUILTIN 3			/* appended after the [rules] */
+#define RULES_MAX (MAX_CONF_RULES + RULES_BUILTIN)
+#define RULES_MAX_BOUNDS (2 * RULES_MAX + 2)
+#define RULES_MAX_ZONES 16		/* thermal zones read for temp */
+#define RULES_UNKNOWN INT_MIN		/* an input that couldn't be read */
+
+/* what a rule can test, in the units it is written in */
+typedef enum __rule_input {
+	RULE_AC,		/* 1 while any charger is online */
+	RULE_BOOST,		/* 1 while pressure or an application boosts */
+	RULE_BATTERY,		/* percent over all batteries */
+	RULE_TEMP,		/* degrees C, the hottest thermal zone */
+	RULE_ON_BATTERY,	/* minutes since the charger went away */
+	RULE_LID,		/* 1 while closed */
+	RULE_INPUTS,
+} rule_input_t;
+
+#define RULE_NEEDS(input) (1u << (input))
+
+typedef uint32_t rules_mask_t;
+
+extern int rules_compile(const rule_prefs_t *prefs);
+extern unsigned int rules_inputs();
+extern void rules_sense(int *inputs);
+extern int rules_eval(const int *inputs);
+extern power_prefs_t *rules_mode(int rule);
+extern const char *rules_text(int rule);
+extern bool rules_builtin(int rule);
+extern void rules_close();
+
+#endif /* _RULES_H_ */
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "selfcost.h"
+#include "conf_utils.h"
+#include "events.h"
+#include "stats.h"
+#include "logger.h"
+
+/*
+ * Accounting of the daemon's own footprint. A baseline is taken at start
+ * and every sample reports the difference, normalized to one hour, so a
+ * power daemon that starts costing power shows up in its own logs.
+ */
+
+static selfcost_t baseline;
+static uint64_t start_ms;
+
+static void read_counters(selfcost_t *cost);
+static int read_file(const char *path, char *dest, size_t len);
+static void selfcost_tick(void *data);
+
+static double tv_seconds(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void read_counters(selfcost_t *cost)
+{
+	struct rusage usage;
+	struct mallinfo2 heap;
+	char buffer[512], *pch;
+	long pages;
+
+	memset(cost, 0, sizeof(struct __selfcost));
+	cost->wakeups = event_wakeups();
+	cost->probes = stats_histogram(STAT_PROBE)->count;
+
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+		cost->user_time = tv_seconds(&usage.ru_utime);
+		cost->sys_time = tv_seconds(&usage.ru_stime);
+		cost->vol_ctxsw = usage.ru_nvcsw;
+		cost->invol_ctxsw = usage.ru_nivcsw;
+	}
+
+	/* these describe this process, so never under sysroot */
+	if (read_file("/proc/self/io", buffer, sizeof(buffer)) == 0) {
+		unsigned long long count;
+
+		for (pch = buffer; pch; pch = strchr(pch, '\n')) {
+			pch += *pch == '\n';
+			if (sscanf(pch, "syscr: %llu", &count) == 1 ||
+			    sscanf(pch, "syscw: %llu", &count) == 1)
+				cost->rw_calls += count;
+		}
+	}
+
+	if (read_file("/proc/self/statm", buffer, sizeof(buffer)) == 0 &&
+	    (pch = strchr(buffer, ' ')) && sscanf(pch, "%ld", &pages) == 1)
+		cost->rss_kb = pages * (sysconf(_SC_PAGESIZE) / 1024);
+
+	/* what is allocated and not freed, which shouldn't grow after startup */
+	heap = mallinfo2();
+	cost->heap_kb = (long) (heap.uordblks / 1024);
+}
+
+/* without stdio, which would malloc a FILE for every sample */
+static int read_file(const char *path, char *dest, size_t len)
+{
+	ssize_t nread;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+
+	nread = read(fd, dest, len - 1);
+	close(fd);
+	if (nread < 0)
+		return -1;
+
+	dest[nread] = '\0';
+	return 0;
+}
+
+void selfcost_start()
+{
+	start_ms = event_now_ms();
+	read_counters(&baseline);
+}
+
+void selfcost_sample(selfcost_t *cost)
+{
+	read_counters(cost);
+	cost->elapsed = (event_now_ms() - start_ms) / 1000.0;
+	cost->wakeups -= baseline.wakeups;
+	cost->probes -= baseline.probes;
+	cost->user_time -= baseline.user_time;
+	cost->sys_time -= baseline.sys_time;
+	cost->vol_ctxsw -= baseline.vol_ctxsw;
+	cost->invol_ctxsw -= baseline.invol_ctxsw;
+	cost->rw_calls -= baseline.rw_calls;
+}
+
+double selfcost_per_hour(const selfcost_t *cost, double value)
+{
+	return cost->elapsed > 0 ? value * 3600.0 / cost->elapsed : 0.0;
+}
+
+void selfcost_log(const selfcost_t *cost)
+{
+	thinkd_log(LOG_INFO, "selfcost: over %.0fs: wakeups/h=%.1f cpu=%.1fms/h "
+		   "(user %.3fs, sys %.3fs) ctxsw/h=%.1f+%.1f rw_calls/probe=%.1f rss=%ldkB heap=%ldkB",
+		   cost->elapsed,
+		   selfcost_per_hour(cost, cost->wakeups),
+		   selfcost_per_hour(cost, (cost->user_time + cost->sys_time) * 1000),
+		   cost->user_time, cost->sys_time,
+		   selfcost_per_hour(cost, cost->vol_ctxsw),
+		   selfcost_per_hour(cost, cost->invol_ctxsw),
+		   cost->probes ? (double) cost->rw_calls / cost->probes : 0.0,
+		   cost->rss_kb, cost->heap_kb);
+}
+
+/*
+ * Compare a sample against the configured limits, logging every limit that
+ * is exceeded. Returns a mask of SELFCOST_OVER_* bits.
+ */
+int selfcost_check(const selfcost_t *cost)
+{
+	double wakeups = selfcost_per_hour(cost, cost->wakeups);
+	double cpu_ms = selfcost_per_hour(cost, (cost->user_time + cost->sys_time) * 1000);
+	double rw_calls = cost->probes ? (double) cost->rw_calls / cost->probes : 0.0;
+	int over = 0;
+
+	if (daemon_prefs.selfcost_max_wakeups && wakeups > daemon_prefs.selfcost_max_wakeups) {
+		thinkd_log(LOG_ERR, "selfcost: %.1f wakeups/h exceeds limit of %d",
+			   wakeups, daemon_prefs.selfcost_max_wakeups);
+		over |= SELFCOST_OVER_WAKEUPS;
+	}
+
+	if (daemon_prefs.selfcost_max_cpu && cpu_ms > daemon_prefs.selfcost_max_cpu) {
+		thinkd_log(LOG_ERR, "selfcost: %.1fms cpu/h exceeds limit of %dms",
+			   cpu_ms, daemon_prefs.selfcost_max_cpu);
+		over |= SELFCOST_OVER_CPU;
+	}
+
+	if (daemon_prefs.selfcost_max_rw_calls && rw_calls > daemon_prefs.selfcost_max_rw_calls) {
+		thinkd_log(LOG_ERR, "selfcost: %.1f read/write calls per probe exceeds limit of %d",
+			   rw_calls, daemon_prefs.selfcost_max_rw_calls);
+		over |= SELFCOST_OVER_RW_CALLS;
+	}
+
+	return over;
+}
+
+void selfcost_report()
+{
+	selfcost_t cost;
+
+	selfcost_sample(&cost);
+	selfcost_log(&cost);
+	selfcost_check(&cost);
+}
+
+/* (re)arm the periodic report with the configured interval */
+void selfcost_schedule()
+{
+	if (daemon_prefs.selfcost_interval > 0)
+		event_timer_set(daemon_prefs.selfcost_interval * 1000, selfcost_tick, NULL);
+	else
+		event_timer_cancel(selfcost_tick, NULL);
+}
+
+static void selfcost_tick(void *data)
+{
+	selfcost_report();
+	selfcost_schedule();
+}
@@ -0,0 +1,34 @@
+#ifndef _SELFCOST_H_
+#define _SELFCOST_H_
+
+#include <stdint.h>
+
+/* what the daemon itself cost since selfcost_start() */
+typedef struct __selfcost {
+	double elapsed;		/* seconds */
+	uint64_t wakeups;
+	uint64_t probes;
+	double user_time;	/* seconds */
+	double sys_time;
+	long vol_ctxsw;
+	long invol_ctxsw;
+	uint64_t rw_calls;	/* syscr + syscw of /proc/self/io, so no
+				   open, close, getdents or poll */
+	long rss_kb;
+	long heap_kb;		/* in use on the malloc heap */
+} selfcost_t;
+
+/* bits returned by selfcost_check() */
+#define SELFCOST_OVER_WAKEUPS	(1 << 0)
+#define SELFCOST_OVER_CPU	(1 << 1)
+#define SELFCOST_OVER_RW_CALLS	(1 << 2)
+
+extern void selfcost_start();
+extern void selfcost_sample(selfcost_t *cost);
+extern double selfcost_per_hour(const selfcost_t *cost, double value);
+extern void selfcost_log(const selfcost_t *cost);
+extern int selfcost_check(const selfcost_t *cost);
+extern void selfcost_report();
+extern void selfcost_schedule();
+
+#endif /* _SELFCOST_H_ */
@@ -0,0 +1,22 @@
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_LEN 32
+#define SHA256_BLOCK 64
+
+typedef struct __sha256 {
+	uint32_t state[8];
+	uint64_t count;
+	uint8_t block[SHA256_BLOCK];
+} sha256_t;
+
+extern void sha256_init(sha256_t *ctx);
+extern void sha256_update(sha256_t *ctx, const void *data, size_t len);
+extern void sha256_final(sha256_t *ctx, uint8_t digest[SHA256_LEN]);
+extern void hmac_sha256(const void *key, size_t key_len, const void *data,
+			size_t len, uint8_t mac[SHA256_LEN]);
+
+#endif /* _SHA256_H_ */
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "void.h"
+#include "state.h"
+#include "thinkd.h"
+#include "acpi.h"
+#include "mode.h"
+#include "logger.h"
+
+/*
+ * Snapshot of the last applied mode. While a mode is loaded every knob
+ * write is journaled; afterwards each knob is read back and the result is
+ * stored together with the boot id, a hardware fingerprint and a hash of
+ * the profile. A restart that finds the same boot, hardware, profile and
+ * live knob values can then skip load_power_mode() entirely.
+ *
+ * File layout: state_header_t followed by `count` records of
+ * uint16 path length, uint16 value length, path bytes, value bytes.
+ */
+
+#define STATE_MAGIC "TKDS"
+#define STATE_VERSION 2
+#define BOOT_ID_LEN 40
+
+typedef struct __state_header {
+	char magic[4];
+	uint32_t version;
+	char boot_id[BOOT_ID_LEN];
+	uint64_t fingerprint;
+	uint64_t prefs_hash;
+	char mode[16];
+	uint32_t count;
+} state_header_t;
+
+typedef struct __state_knob {
+	sysfs_path_t path;
+	char value[STATE_MAX_VALUE];
+	uint16_t value_len;
+} state_knob_t;
+
+const char *state_file = THINKD_STATEFILE;
+
+static state_knob_t journal[STATE_MAX_KNOBS];
+static unsigned int journal_len;
+static bool journaling;
+static bool journal_overflow;
+
+static uint64_t fnv_hash(uint64_t hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--)
+		hash = (hash ^ *p++) * 1099511628211ULL;
+	return hash;
+}
+
+/* raw contents, not stripped: the comparison is byte for byte */
+static int read_raw(const char *path, char *dest, size_t len)
+{
+	ssize_t nread;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	nread = read(fd, dest, len);
+	close(fd);
+	return (int) nread;
+}
+
+static void read_boot_id(char *dest)
+{
+	procfs_path_t path;
+	int len;
+
+	memset(dest, 0, BOOT_ID_LEN);
+	sysroot_sprintf(path, "%s", "/proc/sys/kernel/random/boot_id");
+	len = read_raw(path, dest, BOOT_ID_LEN - 1);
+	if (len < 0)
+		dest[0] = '\0';
+}
+
+/* identifies the machine: DMI model plus the power supplies found */
+static uint64_t hw_fingerprint()
+{
+	const char *dmi_files[] = {
+		"/sys/class/dmi/id/product_name",
+		"/sys/class/dmi/id/product_version",
+	};
+	uint64_t hash = 14695981039346656037ULL;
+	char buffer[STATE_MAX_VALUE];
+
+	hash = fnv_hash(hash, sysroot, strlen(sysroot));
+	for (size_t i = 0; i < array_count(dmi_files); ++i) {
+		sysfs_path_t path;
+		int len;
+
+		sysroot_sprintf(path, "%s", dmi_files[i]);
+		if ((len = read_raw(path, buffer, sizeof(buffer))) > 0)
+			hash = fnv_hash(hash, buffer, len);
+	}
+
+	for (size_t slot = 0; slot < psupply.count; ++slot)
+		hash = fnv_hash(hash, psupply.names[slot], strlen(psupply.names[slot]));
+
+	return hash;
+}
+
+static void fill_header(state_header_t *hdr, const power_prefs_t *prefs,
+			const char *mode)
+{
+	memset(hdr, 0, sizeof(struct __state_header));
+	memcpy(hdr->magic, STATE_MAGIC, sizeof(hdr->magic));
+	hdr->version = STATE_VERSION;
+	read_boot_id(hdr->boot_id);
+	hdr->fingerprint = hw_fingerprint();
+	hdr->prefs_hash = fnv_hash(14695981039346656037ULL, prefs,
+				   sizeof(struct __power_prefs));
+	snprintf(hdr->mode, sizeof(hdr->mode), "%s", mode);
+}
+
+void state_journal_begin()
+{
+	journal_len = 0;
+	journal_overflow = false;
+	journaling = true;
+}
+
+void state_journal_record(const char *path, const char *value)
+{
+	if (! journaling)
+		return;
+
+	/* a path written twice keeps only its last value */
+	for (unsigned int i = 0; i < journal_len; ++i) {
+		if (strcmp(journal[i].path, path) == 0) {
+			snprintf(journal[i].value, STATE_MAX_VALUE, "%s", value);
+			return;
+		}
+	}
+
+	if (journal_len == STATE_MAX_KNOBS) {
+		journal_overflow = true;
+		return;
+	}
+
+	snprintf(journal[journal_len].path, MAX_SYSFS_PATH_LEN, "%s", path);
+	snprintf(journal[journal_len].value, STATE_MAX_VALUE, "%s", value);
+	++journal_len;
+}
+
+/* keep recording into the current journal, for modes applied in two steps */
+void state_journal_resume()
+{
+	journaling = true;
+}
+
+void state_journal_end()
+{
+	journaling = false;
+}
+
+/*
+ * Store the journal of the mode that was just applied. Knobs are read back
+ * since many of them (like /proc/acpi/ibm/light) don't read back what was
+ * written to them.
+ */
+int state_save(const power_prefs_t *prefs, const char *mode)
+{
+	char buffer[sizeof(state_header_t) +
+		    STATE_MAX_KNOBS * (4 + MAX_SYSFS_PATH_LEN + STATE_MAX_VALUE)];
+	char tmp_path[MAX_SYSFS_PATH_LEN];
+	state_header_t *hdr = (state_header_t *) buffer;
+	size_t used = sizeof(state_header_t);
+	int fd;
+
+	if (journal_overflow) {
+		unlink(state_file);
+		return -1;
+	}
+
+	fill_header(hdr, prefs, mode);
+	for (unsigned int i = 0; i < journal_len; ++i) {
+		uint16_t path_len = strlen(journal[i].path);
+		int value_len = read_raw(journal[i].path, buffer + used + 4 + path_len,
+					 STATE_MAX_VALUE);
+
+		/* an unreadable knob can't be verified on restart */
+		if (value_len < 0)
+			continue;
+
+		memcpy(buffer + used, &path_len, 2);
+		memcpy(buffer + used + 2, &(uint16_t) { value_len }, 2);
+		memcpy(buffer + used + 4, journal[i].path, path_len);
+		used += 4 + path_len + value_len;
+		++hdr->count;
+	}
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", state_file);
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		thinkd_log(LOG_ERR, "cannot write state to %s: %s", tmp_path, strerror(errno));
+		return -1;
+	}
+
+	if (write(fd, buffer, used) != (ssize_t) used) {
+		LOG_SIMPLE_ERR("state write");
+		close(fd);
+		unlink(tmp_path);
+		return -1;
+	}
+
+	close(fd);
+	return rename(tmp_path, state_file);
+}
+
+/*
+ * True when the snapshot describes `prefs` being applied on this boot of
+ * this machine and every recorded knob still holds its recorded value.
+ * The journal then starts out with the recorded knobs, so later writes of
+ * only a few of them still save a complete snapshot.
+ */
+bool state_matches(const power_prefs_t *prefs, const char *mode)
+{
+	char buffer[sizeof(state_header_t) +
+		    STATE_MAX_KNOBS * (4 + MAX_SYSFS_PATH_LEN + STATE_MAX_VALUE)];
+	state_header_t current, *saved = (state_header_t *) buffer;
+	size_t used = sizeof(state_header_t);
+	int len;
+
+	len = read_raw(state_file, buffer, sizeof(buffer));
+	if (len < (int) sizeof(state_header_t))
+		return false;
+
+	fill_header(&current, prefs, mode);
+	if (memcmp(saved->magic, current.magic, sizeof(current.magic)) ||
+	    saved->version != current.version || ! current.boot_id[0] ||
+	    memcmp(saved->boot_id, current.boot_id, BOOT_ID_LEN) ||
+	    saved->fingerprint != current.fingerprint ||
+	    saved->prefs_hash != current.prefs_hash ||
+	    strcmp(saved->mode, current.mode) || saved->count > STATE_MAX_KNOBS)
+		return false;
+
+	journal_len = 0;
+	journal_overflow = false;
+	for (uint32_t i = 0; i < saved->count; ++i) {
+		char path[MAX_SYSFS_PATH_LEN], live[STATE_MAX_VALUE];
+		uint16_t path_len, value_len;
+
+		if (used + 4 > (size_t) len)
+			return false;
+		memcpy(&path_len, buffer + used, 2);
+		memcpy(&value_len, buffer + used + 2, 2);
+		if (path_len >= sizeof(path) || value_len > STATE_MAX_VALUE ||
+		    used + 4 + path_len + value_len > (size_t) len)
+			return false;
+
+		memcpy(path, buffer + used + 4, path_len);
+		path[path_len] = '\0';
+		if (read_raw(path, live, sizeof(live)) != value_len ||
+		    memcmp(live, buffer + used + 4 + path_len, value_len)) {
+			journal_len = 0;
+			return false;
+		}
+
+		memcpy(journal[journal_len].path, path, path_len + 1);
+		++journal_len;
+		used += 4 + path_len + value_len;
+	}
+
+	return saved->count > 0;
+}
@@ -0,0 +1,20 @@
+#ifndef _STATE_H_
+#define _STATE_H_
+
+#include <stdbool.h>
+
+#include "conf_utils.h"
+
+#define STATE_MAX_KNOBS 32
+#define STATE_MAX_VALUE 64
+
+extern const char *state_file;
+
+extern void state_journal_begin();
+extern void state_journal_record(const char *path, const char *value);
+extern void state_journal_resume();
+extern void state_journal_end();
+extern int state_save(const power_prefs_t *prefs, const char *mode);
+extern bool state_matches(const power_prefs_t *prefs, const char *mode);
+
+#endif /* _STATE_H_ */
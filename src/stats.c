@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "void.h"
+#include "stats.h"
+#include "logger.h"
+
+/*
+ * Per-operation latency histograms and per-path error counters. Updates
+ * are relaxed atomic increments on fixed arrays, so recording costs two
+ * clock reads and a handful of adds and can stay enabled permanently.
+ * Error paths are only ever inserted from the main loop.
+ */
+
+typedef struct __stat_error {
+	uint64_t count;
+	char path[STAT_ERROR_PATH_LEN];
+} stat_error_t;
+
+static const char *op_names[STAT_NUM_OPS] = {
+	"sysfs_read",
+	"knob_write",
+	"load_mode",
+	"config_reload",
+	"probe",
+};
+
+static stat_histogram_t histograms[STAT_NUM_OPS];
+static stat_error_t errors[STAT_MAX_ERROR_PATHS];
+static uint64_t errors_dropped;
+
+#define stat_add(ptr, val) __atomic_fetch_add(ptr, val, __ATOMIC_RELAXED)
+
+static unsigned int bucket_of(uint64_t ns)
+{
+	unsigned int msb, idx;
+
+	if (ns < STAT_SUB_BUCKETS)
+		return (unsigned int) ns;
+
+	msb = 63 - __builtin_clzll(ns);
+	idx = (msb - STAT_SUB_BITS + 1) * STAT_SUB_BUCKETS +
+		((ns >> (msb - STAT_SUB_BITS)) & (STAT_SUB_BUCKETS - 1));
+
+	return idx < STAT_BUCKETS ? idx : STAT_BUCKETS - 1;
+}
+
+static uint64_t bucket_upper(unsigned int idx)
+{
+	unsigned int msb;
+
+	if (idx < STAT_SUB_BUCKETS)
+		return idx;
+
+	msb = idx / STAT_SUB_BUCKETS + STAT_SUB_BITS - 1;
+	return (1ULL << msb) +
+		((uint64_t) (idx % STAT_SUB_BUCKETS + 1) << (msb - STAT_SUB_BITS)) - 1;
+}
+
+void stats_record(stat_op_t op, uint64_t start_ns)
+{
+	stat_histogram_t *h = &histograms[op];
+	uint64_t ns = stats_clock() - start_ns;
+	uint64_t max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+
+	stat_add(&h->count, 1);
+	stat_add(&h->sum_ns, ns);
+	stat_add(&h->buckets[bucket_of(ns)], 1);
+
+	while (ns > max &&
+	       ! __atomic_compare_exchange_n(&h->max_ns, &max, ns, true,
+					     __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+void stats_error(const char *path)
+{
+	uint32_t hash = 2166136261u;
+
+	/* FNV-1a, open addressing */
+	for (const char *p = path; *p; ++p)
+		hash = (hash ^ (unsigned char) *p) * 16777619u;
+
+	for (unsigned int i = 0; i < STAT_MAX_ERROR_PATHS; ++i) {
+		stat_error_t *e = &errors[(hash + i) % STAT_MAX_ERROR_PATHS];
+
+		if (! e->path[0])
+			snprintf(e->path, STAT_ERROR_PATH_LEN, "%s", path);
+		else if (strncmp(e->path, path, STAT_ERROR_PATH_LEN - 1) != 0)
+			continue;
+
+		stat_add(&e->count, 1);
+		return;
+	}
+
+	stat_add(&errors_dropped, 1);
+}
+
+const stat_histogram_t *stats_histogram(stat_op_t op)
+{
+	return &histograms[op];
+}
+
+const char *stats_op_name(stat_op_t op)
+{
+	return op_names[op];
+}
+
+uint64_t stats_percentile(const stat_histogram_t *h, double pct)
+{
+	uint64_t rank, seen = 0;
+
+	if (! h->count)
+		return 0;
+
+	rank = (uint64_t) (h->count * pct / 100.0);
+	if (rank >= h->count)
+		rank = h->count - 1;
+
+	for (unsigned int idx = 0; idx < STAT_BUCKETS; ++idx) {
+		seen += h->buckets[idx];
+		if (seen > rank)
+			return bucket_upper(idx) < h->max_ns ? bucket_upper(idx) : h->max_ns;
+	}
+
+	return h->max_ns;
+}
+
+static void format_op(stat_op_t op, char *buf, size_t len)
+{
+	const stat_histogram_t *h = &histograms[op];
+
+	snprintf(buf, len, "%-14s count=%llu mean=%.1fus p50=%.1fus "
+		 "p90=%.1fus p99=%.1fus max=%.1fus", op_names[op],
+		 (unsigned long long) h->count,
+		 h->count ? h->sum_ns / 1000.0 / h->count : 0.0,
+		 stats_percentile(h, 50) / 1000.0,
+		 stats_percentile(h, 90) / 1000.0,
+		 stats_percentile(h, 99) / 1000.0,
+		 h->max_ns / 1000.0);
+}
+
+void stats_log()
+{
+	char line[256];
+
+	for (int op = 0; op < STAT_NUM_OPS; ++op) {
+		format_op(op, line, sizeof(line));
+		thinkd_log(LOG_INFO, "stats: %s", line);
+	}
+
+	for (stat_error_t *e = errors; e < errors + array_count(errors); ++e) {
+		if (e->path[0])
+			thinkd_log(LOG_INFO, "stats: errors=%llu path=%s",
+				   (unsigned long long) e->count, e->path);
+	}
+}
+
+int stats_write_file(const char *path)
+{
+	char tmp_path[256], line[256];
+	FILE *fp;
+
+	/* write next to the target and rename so readers never see half */
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	fp = fopen(tmp_path, "w");
+	if (! fp) {
+		thinkd_log(LOG_ERR, "while opening %s", tmp_path);
+		LOG_SIMPLE_ERR("fopen");
+		return -1;
+	}
+
+	for (int op = 0; op < STAT_NUM_OPS; ++op) {
+		format_op(op, line, sizeof(line));
+		fprintf(fp, "%s\n", line);
+	}
+
+	for (stat_error_t *e = errors; e < errors + array_count(errors); ++e) {
+		if (e->path[0])
+			fprintf(fp, "error %llu %s\n",
+				(unsigned long long) e->count, e->path);
+	}
+
+	if (errors_dropped)
+		fprintf(fp, "error %llu (untracked paths)\n",
+			(unsigned long long) errors_dropped);
+
+	fclose(fp);
+	if (rename(tmp_path, path) < 0) {
+		LOG_SIMPLE_ERR("rename");
+		unlink(tmp_path);
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/*
+ * Latency histograms use log-linear buckets: one group per power of two
+ * nanoseconds, split into STAT_SUB_BUCKETS linear steps, which keeps the
+ * relative error under 25% from 1ns up to about 18 minutes.
+ */
+#define STAT_SUB_BITS 2
+#define STAT_SUB_BUCKETS (1 << STAT_SUB_BITS)
+#define STAT_GROUPS 40
+#define STAT_BUCKETS (STAT_GROUPS * STAT_SUB_BUCKETS)
+#define STAT_MAX_ERROR_PATHS 32
+#define STAT_ERROR_PATH_LEN 96
+
+#define STATS_START(var) uint64_t var = stats_clock()
+#define STATS_END(op, var) stats_record(op, var)
+
+typedef enum __stat_op {
+	STAT_SYSFS_READ,
+	STAT_KNOB_WRITE,
+	STAT_LOAD_MODE,
+	STAT_CONFIG_RELOAD,
+	STAT_PROBE,
+	STAT_NUM_OPS,
+} stat_op_t;
+
+typedef struct __stat_histogram {
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t max_ns;
+	uint64_t buckets[STAT_BUCKETS];
+} stat_histogram_t;
+
+static inline uint64_t stats_clock()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+extern void stats_record(stat_op_t op, uint64_t start_ns);
+extern void stats_error(const char *path);
+extern const stat_histogram_t *stats_histogram(stat_op_t op);
+extern const char *stats_op_name(stat_op_t op);
+extern uint64_t stats_percentile(const stat_histogram_t *h, double pct);
+extern void stats_log();
+extern int stats_write_file(const char *path);
+
+#endif /* _STATS_H_ */
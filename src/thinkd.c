@@ -2,6 +2,20 @@
 #include "thinkd.h"
 #include "conf_utils.h"
 #include "acpi.h"
+#include "events.h"
+#include "mode.h"
+#include "stats.h"
+#include "selfcost.h"
+#include "notify.h"
+#include "ctl.h"
+#include "state.h"
+#include "trace.h"
+#include "remote.h"
+#include "metrics.h"
+#include "rfkill.h"
+#include "history.h"
+#include "wakers.h"
+#include "uevent.h"
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -10,22 +24,27 @@
 #include <getopt.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 #include <stdbool.h>
 #include <string.h>
 #include <syslog.h>
 #include <errno.h>
 #include <signal.h>
-#include <pthread.h>		
+#include <time.h>
 
 /* constants */
 static const char *lockfile = THINKD_LOCKFILE;
 static const char *pidfile = THINKD_PIDFILE;
+static const char *ctl_path = THINKD_SOCKET;
 
 /* static variables */
-static power_prefs_t *current_mode = NULL;
-static int sleep_time = BAT_SLEEP_TIME;
 static bool probing = true;
-static pthread_mutex_t conf_mutex;
+static bool foreground = false;
+static volatile sig_atomic_t reload_pending = 0;
+static volatile sig_atomic_t stats_pending = 0;
+static volatile sig_atomic_t stop_pending = 0;
+static const char *history_spec = NULL;
+static bool probe_capabilities = false;
 
 /* function prototypes */
 static void handle_cmd_args(int *argc, char ***argv);
@@ -35,12 +54,16 @@ static bool std2null();
 static void clean_and_exit() THINKD_ATTR_NORET;
 static void cleanup_before_exit();
 static bool create_pidfile();
-static void detect_psupply_mode();
-static void load_psupply_mode(power_prefs_t *prefs);
 static void print_usage(const struct option *opts, const char **opt_help);
-static void load_config();
+static void request_reload(int signum);
+static void request_stats(int signum);
+static void request_stop(int signum);
+static void probe_tick(void *data);
 static void validate_user();
-static void ipc_listen();
+static bool create_lockfile();
+static int print_history(const char *spec);
+static int print_capabilities();
+static void print_history_point(const history_point_t *point, void *data);
 
 int main(int argc, char *argv[])
 {
@@ -50,31 +73,57 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	/* Try to initialize the config mutex */
-	if (pthread_mutex_init(&conf_mutex, NULL)) {
-		LOG_SIMPLE_ERR("FATAL");
+	if (mode_init())
 		clean_and_exit();
-	}
+
+	/* accept control requests early, they are served once we loop */
+	notify_init();
+	ctl_listen(ctl_path);
 	
 	/* read in configuration */
-	load_config();
-
-	/* initial detecting of power supply */
+	reload_config();
+	remote_configure();
+	metrics_configure();
+	history_configure();
+	wakers_configure();
+	if (trace_file)
+		trace_open(trace_file);
+
+	/* initial detecting of power supply, changes are told from then on */
+	if (probing)
+		uevent_listen(detect_psupply_change);
 	detect_psupply_mode();
-
-	/* Listen for IPC requests */
-	if (! probing) {
-		ipc_listen();
-		return 0;
+	notify_ready();
+
+	/* do the never ending loop, waking up only for probes and events */
+	selfcost_start();
+	selfcost_schedule();
+	if (probing)
+		event_timer_set(sleep_time * 1000, probe_tick, NULL);
+	while (! stop_pending) {
+		event_dispatch();
+		if (reload_pending) {
+			reload_pending = 0;
+			notify_reloading();
+			reload_config();
+			remote_configure();
+			metrics_configure();
+			history_configure();
+			wakers_configure();
+			selfcost_schedule();
+			notify_ready();
+		}
+		if (stats_pending) {
+			stats_pending = 0;
+			stats_log();
+			selfcost_report();
+			wakers_log();
+			stats_write_file(THINKD_STATSFILE);
+		}
 	}
 
-	/* do the never ending loop */
-	while (1) {		
-		sleep(sleep_time);
-		detect_psupply_mode();
-	}
-	
-	return 0;
+	/* the history and the log are flushed here, never from the handler */
+	clean_and_exit();
 }
 
 static void handle_cmd_args(int *argc, char ***argv)
@@ -84,16 +133,32 @@ static void handle_cmd_args(int *argc, char ***argv)
 		{"help", 0, 0, 'h'},
 		{"version", 0, 0, 'v'},
 		{"no-probe", 0, 0, 'n'},
+		{"foreground", 0, 0, 'f'},
+		{"root", 1, 0, 'r'},
+		{"config", 1, 0, 'c'},
+		{"state-file", 1, 0, 's'},
+		{"record", 1, 0, 't'},
+		{"socket", 1, 0, 'S'},
+		{"history", 1, 0, 'H'},
+		{"probe-capabilities", 0, 0, 'p'},
 		{NULL, 0, 0, 0}
 	};
 
 	const char * opts_help[] = {
 		"print help message", /* help */
 		"print version of this program", /* version */
-		"do not try detecting the power mode" /* no-probe */
+		"do not try detecting the power mode", /* no-probe */
+		"don't fork, for Type=notify services", /* foreground */
+		"prefix all /sys and /proc paths with DIR", /* root */
+		"read configuration from FILE", /* config */
+		"keep the applied-state snapshot in FILE", /* state-file */
+		"record a power supply trace to FILE", /* record */
+		"listen for control commands on PATH", /* socket */
+		"print the battery history of the last HOURS[:STEP minutes]", /* history */
+		"list the knobs this machine has and exit" /* probe-capabilities */
 	};
 
-	while ((c = getopt_long(*argc, *argv, "hvn", opts, &option_index)) != -1) {
+	while ((c = getopt_long(*argc, *argv, "hvnfr:c:s:t:S:H:p", opts, &option_index)) != -1) {
 		switch (c) {
 		case 0:
 			/* this option sets a flag */
@@ -102,33 +167,143 @@ static void handle_cmd_args(int *argc, char ***argv)
 			/* stop detecting power mode */
 			probing = false;
 			break;
+		case 'f':
+			foreground = true;
+			break;
+		case 'r':
+			/* daemonize() changes into / */
+			sysroot = realpath(optarg, NULL);
+			if (! sysroot) {
+				fprintf(stderr, "%s: %s\n", optarg, strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'c':
+			config_file = optarg;
+			break;
+		case 's':
+			state_file = optarg;
+			break;
+		case 't':
+			trace_file = optarg;
+			break;
+		case 'S':
+			ctl_path = optarg;
+			break;
+		case 'H':
+			history_spec = optarg;
+			break;
+		case 'p':
+			probe_capabilities = true;
+			break;
 		case 'v':
+			thinkd_log_quiet();
 			printf("%s %s\n", DAEMON_NAME, DAEMON_VERSION);
 			clean_and_exit();
 		case 'h':
+			thinkd_log_quiet();
 			print_usage(opts, opts_help);
 			clean_and_exit();
 		case '?':
 		default:
+			thinkd_log_quiet();
 			print_usage(opts, opts_help);
 			cleanup_before_exit();
 			exit(EXIT_FAILURE);
 			break;
 		}
 	}
+
+	/* after every option, --config included; these print and exit, with
+	   only errors on stderr */
+	if (history_spec || probe_capabilities)
+		thinkd_log_quiet();
+	if (history_spec)
+		exit(print_history(history_spec) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+	if (probe_capabilities)
+		exit(print_capabilities() < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/* HOURS[:STEP], the step in minutes defaulting to an hour */
+static int print_history(const char *spec)
+{
+	int64_t now = time(NULL);
+	long hours, step = 60;
+	char *end;
+	int points;
+
+	hours = strtol(spec, &end, 10);
+	if (*end == ':')
+		step = strtol(end + 1, &end, 10);
+	if (*end || hours <= 0 || step <= 0) {
+		fprintf(stderr, "%s: expected HOURS[:STEP minutes]\n", spec);
+		return -1;
+	}
+
+	if (read_ini() < 0) {
+		fprintf(stderr, "%s: %s\n", config_file, strerror(errno));
+		return -1;
+	}
+	if (! daemon_prefs.history_file[0]) {
+		fprintf(stderr, "no History_File in %s\n", config_file);
+		return -1;
+	}
+
+	printf("%-16s %-4s %8s %9s %11s %5s  %s\n", "time", "bat", "capacity",
+	       "power", "energy_full", "ac", "mode");
+	/* steps start on whole multiples of their length */
+	step *= 60;
+	points = history_query(daemon_prefs.history_file, (now - hours * 3600) / step * step,
+			       now + 1, (int) step, print_history_point, NULL);
+	if (points < 0) {
+		fprintf(stderr, "%s: %s\n", daemon_prefs.history_file, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the same probe the daemon runs before the first load, cgroups included */
+static int print_capabilities()
+{
+	if (read_ini() < 0) {
+		fprintf(stderr, "%s: %s\n", config_file, strerror(errno));
+		return -1;
+	}
+	if (mode_init() < 0)
+		return -1;
+
+	knobs_probe(KNOB_MASK_ALL);
+	knobs_report(stdout);
+	mode_cleanup();
+	return 0;
+}
+
+static void print_history_point(const history_point_t *point, void *data)
+{
+	time_t when = (time_t) point->time;
+	char date[32];
+	struct tm tm;
+
+	(void) data;
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime_r(&when, &tm));
+	printf("%-16s BAT%u %7d%% %7ldmW %9ldmWh %4d%%  %s\n", date, point->battery,
+	       point->capacity, point->power, point->energy_full, point->ac_percent,
+	       history_mode_names[point->mode] ? history_mode_names[point->mode] : "?");
 }
 
 static int open_log()
 {
 	int retval = 0;
 	
-#ifdef USE_SYSLOG
+#if USE_SYSLOG
 	int log_opts;
 
 	log_opts = LOG_NDELAY|LOG_PID|LOG_CONS;
 	openlog(DAEMON_NAME, log_opts, LOG_DAEMON);
 #else	
-	if ((retval = thinkd_open_log()) != 0) {
+	/* stderr goes to the journal, and instances don't fight over the files */
+	if (! foreground && (retval = thinkd_open_log()) != 0) {
 		PRINT_SIMPLE_ERR("OPEN_LOG");
 		return retval;
 	}
@@ -142,58 +317,73 @@ static int open_log()
 static bool daemonize()
 {
 	struct sigaction s_action;
+	sigset_t handled, wait_mask;
 	pid_t pid, sid;
-	int lock_fd;
 
 	/* Make sure the required user runs this process */
 	validate_user();
 
-	/* attempt to create the lockfile */
-	if (lockfile && lockfile[0]) {
-		lock_fd = open(lockfile, O_RDWR|O_CREAT|O_EXCL, (mode_t) 0640);
-		if (lock_fd < 0) {
-			lockfile = NULL;
-			PRINT_SIMPLE_ERR("unable to create lock file");
+	/* one instance per machine, whether forked or supervised */
+	if (! create_lockfile())
+		return false;
+
+	/* in the foreground the service manager tracks and supervises us */
+	if (! foreground) {
+		/* try to fork */
+		pid = fork();
+		if (pid < 0) {
 			return false;
 		}
-	}
 
-	/* try to fork */
-	pid = fork();
-	if (pid < 0) {
-		return false;
-	}
+		/* Good pid, exit the parent process */
+		if (pid > 0) {
+			exit(EXIT_SUCCESS);
+		}
 
-	/* Good pid, exit the parent process */
-	if (pid > 0) {
-		exit(EXIT_SUCCESS);
-	}
+		/* now executing the child process */
+		umask(0);
 
-	/* now executing the child process */
-	umask(0);
+		/* create new sid for child process */
+		sid = setsid();
+		if (sid < 0) {
+			thinkd_log(LOG_ERR, "could not set sid");
+			return false;
+		}
 
-	/* create new sid for child process */
-	sid = setsid();
-	if (sid < 0) {
-		thinkd_log(LOG_ERR, "could not set sid");
-		return false;
+		std2null();
 	}
 
-	std2null();
-
 	/* set signals */
-	s_action.sa_handler = clean_and_exit;
+	s_action.sa_handler = request_stop;
 	sigemptyset(&s_action.sa_mask);
 	s_action.sa_flags = 0;
 
-	/* clean exit when these signals are sent */
+	/* clean exit from the main loop when these signals are sent */
 	sigaction(SIGINT, &s_action, NULL);
 	sigaction(SIGTERM, &s_action, NULL);
 	sigaction(SIGQUIT, &s_action, NULL);
 
-	/* SIGUSR1 to reload configuration */
-	s_action.sa_handler = load_config;
+	/* SIGUSR1 to reload configuration, handled from the main loop */
+	s_action.sa_handler = request_reload;
 	sigaction(SIGUSR1, &s_action, NULL);
+
+	/* SIGUSR2 to dump latency statistics to the log and the stats file */
+	s_action.sa_handler = request_stats;
+	sigaction(SIGUSR2, &s_action, NULL);
+
+	/* the flags are only raised while the loop waits, see event_dispatch() */
+	sigemptyset(&handled);
+	sigaddset(&handled, SIGINT);
+	sigaddset(&handled, SIGTERM);
+	sigaddset(&handled, SIGQUIT);
+	sigaddset(&handled, SIGUSR1);
+	sigaddset(&handled, SIGUSR2);
+	sigprocmask(SIG_BLOCK, &handled, &wait_mask);
+	for (int signum = 1; signum < NSIG; ++signum) {
+		if (sigismember(&handled, signum) == 1)
+			sigdelset(&wait_mask, signum);
+	}
+	event_set_sigmask(&wait_mask);
 	
 	/* chdir to root directory */
 	if (chdir("/") < 0) {
@@ -202,7 +392,38 @@ static bool daemonize()
 	}
 
 	/* lastly create the pidfile */
-	return create_pidfile();
+	return foreground || create_pidfile();
+}
+
+/*
+ * The lock is an flock() on the lockfile rather than its existence, so a
+ * crashed instance doesn't keep the next one from starting. The fd stays
+ * open (and locked) for the lifetime of the process, including the child.
+ * The file is never unlinked: the next instance must lock the same inode
+ * the running one holds. Under --root it lives in the root like the rest.
+ */
+static bool create_lockfile()
+{
+	sysfs_path_t path;
+	int lock_fd;
+
+	if (! lockfile || ! lockfile[0])
+		return true;
+
+	sysroot_sprintf(path, "%s", lockfile);
+	lock_fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, (mode_t) 0640);
+	if (lock_fd < 0) {
+		PRINT_SIMPLE_ERR("unable to create lock file");
+		return false;
+	}
+
+	if (flock(lock_fd, LOCK_EX|LOCK_NB) < 0) {
+		fprintf(stderr, "%s is already running\n", DAEMON_NAME);
+		close(lock_fd);
+		return false;
+	}
+
+	return true;
 }
 
 static bool std2null()
@@ -239,10 +460,17 @@ static void cleanup_before_exit()
 {
 	thinkd_log(LOG_NOTICE, "%s process %d is stopping",
 		   DAEMON_NAME, (int) getpid());
+	notify_stopping();
+	notify_close();
+	uevent_close();
+	ctl_close();
+	remote_close();
+	metrics_close();
+	history_close();
+	rfkill_close();
+	trace_close();
 	thinkd_close_log();
-	pthread_mutex_destroy(&conf_mutex);
-	if (lockfile)
-		unlink(lockfile);
+	mode_cleanup();
 }
 
 static bool create_pidfile()
@@ -270,57 +498,6 @@ static bool create_pidfile()
 	return false;
 }
 
-static void detect_psupply_mode()
-{
-	char buffer[256];
-	int state;
-	int num_batts;
-	acpi_psupply_t power_supply;
-
-	if ((num_batts = scan_power_supply(&power_supply)) < 0) {
-		thinkd_log(LOG_ERR, "failed to detect acpi power supply information");
-		load_psupply_mode(&mode_powersave);
-		return;
-	}
-
-	/* check if ac adapter is online */
-	snprintf(buffer, 256, "%s/%s", power_supply.acdir, "online");
-	state = sysfs_read_int(buffer);
-	if (state) {
-		if (current_mode == &mode_performance) return;
-		load_psupply_mode(&mode_performance);
-		return;
-	}
-
-	/* battery is connected */
-	if (current_mode == &mode_powersave)
-		return;
-
-	load_psupply_mode(&mode_powersave);
-}
-
-static void load_psupply_mode(power_prefs_t *prefs)
-{
-	if (prefs == &mode_powersave) {
-		thinkd_log(LOG_INFO, "Battery found. Enabling powersave mode");
-		sleep_time = BAT_SLEEP_TIME;
-	}
-	else if (prefs == &mode_performance) {
-		thinkd_log(LOG_INFO, "AC adapater is connected. Enabling performance mode");
-		sleep_time = AC_SLEEP_TIME;
-	}
-	else {
-		thinkd_log(LOG_INFO, "Mode unrecognized, setting sleep time to default");
-		sleep_time = BAT_SLEEP_TIME;
-		return;
-	}
-	
-	pthread_mutex_lock(&conf_mutex);
-	load_power_mode(prefs);
-	current_mode = prefs;
-	pthread_mutex_unlock(&conf_mutex);
-}
-
 static void print_usage(const struct option *opts, const char **opt_help)
 {
 	const struct option *opt;
@@ -340,15 +517,25 @@ static void print_usage(const struct option *opts, const char **opt_help)
 	}
 }
 
-static void load_config()
-{	
-	pthread_mutex_lock(&conf_mutex);
-	read_ini();
-	pthread_mutex_unlock(&conf_mutex);
+static void request_reload(int signum)
+{
+	reload_pending = 1;
+}
+
+static void request_stats(int signum)
+{
+	stats_pending = 1;
+}
+
+static void request_stop(int signum)
+{
+	stop_pending = 1;
+}
 
-	/* Load mode if one is already set by detect_psupply_mode() */
-	if (current_mode)
-		load_psupply_mode(current_mode);
+static void probe_tick(void *data)
+{
+	detect_psupply_mode();
+	event_timer_set(sleep_time * 1000, probe_tick, NULL);
 }
 
 static void validate_user()
@@ -362,10 +549,3 @@ static void validate_user()
 	cleanup_before_exit();
 	exit(EXIT_FAILURE);
 }
-
-static void ipc_listen()
-{
-	while (0) {
-		/* wait for incoming socket requests */
-	}
-}
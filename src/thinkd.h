@@ -4,10 +4,17 @@
 
 #define THINKD_PIDFILE	"/var/run/thinkd.pid"
 #define THINKD_LOCKFILE "/var/lock/thinkd"
-#define THINKD_SOCKET	"/var/run/thinkd.socket"
+#define THINKD_SOCKET	"/run/thinkd.socket"
+#define THINKD_STATSFILE "/run/thinkd.stats"
+#define THINKD_STATEFILE "/run/thinkd.state"
 
+/* seconds between probes, override with -D to evaluate them on a replay */
+#ifndef AC_SLEEP_TIME
 #define AC_SLEEP_TIME 5
+#endif
+#ifndef BAT_SLEEP_TIME
 #define BAT_SLEEP_TIME 15
+#endif
 
 #define DAEMON_NAME	"thinkd"
 #define DAEMON_VERSION	"2.1"
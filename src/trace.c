@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+#include <stdarg.h>
+
+#include "void.h"
+#include "trace.h"
+#include "events.h"
+#include "logger.h"
+
+/*
+ * Records what the policy saw, for thinkd-replay to run it again later.
+ * One event per line, stamped with milliseconds since recording started:
+ *
+ *	<ms> supply <name> <type> <energy_full>
+ *	<ms> gone <name>
+ *	<ms> online <name> <0|1>
+ *	<ms> battery <name> <capacity> <energy_now> <rate>
+ *	<ms> mode <name>
+ *	<ms> pressure <0|1>
+ *
+ * Readings are only written when they changed, so a week of probes on an
+ * idle machine stays a few kilobytes.
+ */
+
+typedef struct __trace_supply {
+	char name[MAX_PSUPPLY_NAME];
+	bool present;
+	int online;
+	int capacity;
+	long energy_now;
+	long rate;
+} trace_supply_t;
+
+const char *trace_file = NULL;
+
+static FILE *trace_fp;
+static uint64_t trace_start;
+static trace_supply_t recorded[TRACE_MAX_SUPPLIES];
+
+static trace_supply_t *find_supply(const char *name);
+static void trace_line(const char *format, ...) THINKD_ATTR_PRINTF(1);
+
+int trace_open(const char *path)
+{
+	trace_fp = fopen(path, "w");
+	if (! trace_fp) {
+		thinkd_log(LOG_ERR, "cannot record trace to %s: %s", path, strerror(errno));
+		return -1;
+	}
+
+	/* one line per event, so a crash loses at most the last one */
+	setvbuf(trace_fp, NULL, _IOLBF, 0);
+	memset(recorded, 0, sizeof(recorded));
+	trace_start = event_now_ms();
+	fprintf(trace_fp, "# thinkd trace %d, started %ld\n", TRACE_VERSION,
+		(long) time(NULL));
+
+	return 0;
+}
+
+void trace_close()
+{
+	if (trace_fp)
+		fclose(trace_fp);
+	trace_fp = NULL;
+}
+
+void trace_supplies(acpi_psupply_t *ps)
+{
+	if (! trace_fp)
+		return;
+
+	/* probes only read the chargers, a recording wants the batteries too */
+	psupply_read(ps, PSUPPLY_READ_BATTERIES);
+
+	for (trace_supply_t *r = recorded; r < recorded + array_count(recorded); ++r) {
+		bool found = false;
+
+		for (size_t slot = 0; r->present && slot < ps->count; ++slot)
+			found |= strcmp(ps->names[slot], r->name) == 0;
+
+		if (r->present && ! found) {
+			trace_line("gone %s", r->name);
+			r->present = false;
+		}
+	}
+
+	for (size_t slot = 0; slot < ps->count; ++slot) {
+		trace_supply_t *r = find_supply(ps->names[slot]);
+
+		if (! r)
+			continue;
+
+		if (! r->present) {
+			trace_line("supply %s %s %ld", ps->names[slot],
+				   psupply_type_name(ps->types[slot]),
+				   ps->energy_full[slot]);
+			r->present = true;
+			r->online = -1;
+			r->capacity = -1;
+		}
+
+		if (ps->types[slot] != PSUPPLY_BATTERY) {
+			if (r->online != ps->online[slot])
+				trace_line("online %s %d", r->name, ps->online[slot]);
+			r->online = ps->online[slot];
+			continue;
+		}
+
+		if (r->capacity != ps->capacity[slot] ||
+		    r->energy_now != ps->energy_now[slot] || r->rate != ps->rate[slot])
+			trace_line("battery %s %d %ld %ld", r->name, ps->capacity[slot],
+				   ps->energy_now[slot], ps->rate[slot]);
+		r->capacity = ps->capacity[slot];
+		r->energy_now = ps->energy_now[slot];
+		r->rate = ps->rate[slot];
+	}
+}
+
+void trace_mode(const char *mode)
+{
+	if (trace_fp)
+		trace_line("mode %s", mode);
+}
+
+void trace_pressure(bool boosting)
+{
+	if (trace_fp)
+		trace_line("pressure %d", (int) boosting);
+}
+
+/* the slot recording `name`, claiming a free one for new supplies */
+static trace_supply_t *find_supply(const char *name)
+{
+	trace_supply_t *free_slot = NULL;
+
+	for (trace_supply_t *r = recorded; r < recorded + array_count(recorded); ++r) {
+		if (r->name[0] && strcmp(r->name, name) == 0)
+			return r;
+		if (! r->present && ! free_slot)
+			free_slot = r;
+	}
+
+	if (free_slot)
+		snprintf(free_slot->name, MAX_PSUPPLY_NAME, "%s", name);
+
+	return free_slot;
+}
+
+static void trace_line(const char *format, ...)
+{
+	va_list args;
+
+	fprintf(trace_fp, "%" PRIu64 " ", event_now_ms() - trace_start);
+	va_start(args, format);
+	vfprintf(trace_fp, format, args);
+	va_end(args);
+	fputc('\n', trace_fp);
+}
@@ -0,0 +1,19 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdbool.h>
+
+#include "psupply.h"
+
+#define TRACE_VERSION 1
+#define TRACE_MAX_SUPPLIES 8
+
+extern const char *trace_file;
+
+extern int trace_open(const char *path);
+extern void trace_close();
+extern void trace_supplies(acpi_psupply_t *ps);
+extern void trace_mode(const char *mode);
+extern void trace_pressure(bool boosting);
+
+#endif /* _TRACE_H_ */
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "void.h"
+#include "uevent.h"
+#include "events.h"
+#include "logger.h"
+
+/*
+ * Power supply changes as they happen. The kernel multicasts a uevent
+ * for every change of a power_supply device, so a charger that comes and
+ * goes reaches the probe right away instead of on its next tick, and the
+ * transition debounce sees every flap. All datagrams queued at a wakeup
+ * are read before the probe runs once for them.
+ *
+ * A uevent is "ACTION@DEVPATH" followed by KEY=VALUE strings, each ended
+ * by a NUL.
+ */
+
+static int nl_fd = -1;
+static uevent_supply_cb change_cb;
+
+static void uevent_event(int fd, short revents, void *data);
+static bool supply_event(const char *msg, size_t len, bool *rescan);
+static bool field_is(const char *field, size_t len, const char *value);
+
+int uevent_listen(uevent_supply_cb on_change)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,		/* the kernel's, not udev's */
+	};
+	int fd;
+
+	change_cb = on_change;
+	if (nl_fd >= 0)
+		return 0;
+
+	fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		    NETLINK_KOBJECT_UEVENT);
+	if (fd < 0) {
+		LOG_SIMPLE_ERR("socket");
+		return -1;
+	}
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		thinkd_log(LOG_ERR, "uevent: cannot listen for power supply changes, "
+			   "probing only: %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (event_add_fd(fd, POLLIN, uevent_event, NULL) < 0) {
+		close(fd);
+		return -1;
+	}
+	nl_fd = fd;
+
+	return 0;
+}
+
+void uevent_close()
+{
+	if (nl_fd < 0)
+		return;
+
+	event_del_fd(nl_fd);
+	close(nl_fd);
+	nl_fd = -1;
+}
+
+bool uevent_listening()
+{
+	return nl_fd >= 0;
+}
+
+/* one uevent as the kernel sends it, handed to the callback if it matters */
+void uevent_dispatch(const char *msg, size_t len)
+{
+	bool rescan = false;
+
+	if (change_cb && supply_event(msg, len, &rescan))
+		change_cb(rescan);
+}
+
+static void uevent_event(int fd, short revents, void *data)
+{
+	char buffer[UEVENT_RECV_BUFFER];
+	struct sockaddr_nl from;
+	socklen_t from_len;
+	bool changed = false, rescan = false;
+	ssize_t len;
+
+	(void) data;
+	if (revents & (POLLERR | POLLNVAL)) {
+		thinkd_log(LOG_ERR, "uevent: socket failed, probing only");
+		uevent_close();
+		return;
+	}
+
+	for (;;) {
+		from_len = sizeof(from);
+		len = recvfrom(fd, buffer, sizeof(buffer), 0, (struct sockaddr *) &from,
+			       &from_len);
+		if (len < 0 && errno == ENOBUFS) {
+			/* some were lost, whatever they were */
+			changed = rescan = true;
+			continue;
+		}
+		if (len <= 0) {
+			if (len < 0 && errno != EAGAIN && errno != EINTR)
+				LOG_SIMPLE_ERR("recvfrom");
+			break;
+		}
+
+		/* only the kernel speaks on this group */
+		if (from.nl_pid == 0 && supply_event(buffer, len, &rescan))
+			changed = true;
+	}
+
+	if (changed && change_cb)
+		change_cb(rescan);
+}
+
+static bool supply_event(const char *msg, size_t len, bool *rescan)
+{
+	const char *end = msg + len;
+	bool supply = false, added_or_removed = false;
+
+	for (const char *field = msg; field < end; ) {
+		size_t field_len = strnlen(field, end - field);
+
+		if (field_is(field, field_len, "SUBSYSTEM=power_supply"))
+			supply = true;
+		else if (field_is(field, field_len, "ACTION=add") ||
+			 field_is(field, field_len, "ACTION=remove"))
+			added_or_removed = true;
+		field += field_len + 1;
+	}
+
+	if (supply && added_or_removed)
+		*rescan = true;
+	return supply;
+}
+
+/* the last field may come without its NUL */
+static bool field_is(const char *field, size_t len, const char *value)
+{
+	return len == strlen(value) && memcmp(field, value, len) == 0;
+}
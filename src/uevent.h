@@ -0,0 +1,17 @@
+#ifndef _UEVENT_H_
+#define _UEVENT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define UEVENT_RECV_BUFFER 8192	/* one uevent is at most a page */
+
+/* `rescan` when a supply was added or removed rather than changed */
+typedef void (*uevent_supply_cb)(bool rescan);
+
+extern int uevent_listen(uevent_supply_cb on_change);
+extern void uevent_close();
+extern bool uevent_listening();
+extern void uevent_dispatch(const char *msg, size_t len);
+
+#endif /* _UEVENT_H_ */
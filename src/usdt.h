@@ -0,0 +1,66 @@
+#ifndef _USDT_H_
+#define _USDT_H_
+
+/*
+ * Static tracepoints in the SystemTap SDT format, readable by bpftrace,
+ * perf and stap without linking anything:
+ *
+ *	USDT(probe_start);
+ *	USDT2(knob_end, id, key);
+ *
+ * Each one is a nop plus a .note.stapsdt entry describing where its
+ * arguments live; a tracer attaching turns the nop into a breakpoint.
+ * Arguments are passed as 64 bit values, pointers included. Build with
+ * -DTHINKD_NO_USDT to leave them out.
+ */
+
+#if ! defined(THINKD_NO_USDT) && (defined(__x86_64__) || defined(__aarch64__))
+
+#define __USDT_NOTE(name, args)						\
+	"990:	nop\n"							\
+	"	.pushsection .note.stapsdt,\"?\",\"note\"\n"		\
+	"	.balign 4\n"						\
+	"	.4byte 992f-991f, 994f-993f, 3\n"			\
+	"991:	.asciz \"stapsdt\"\n"					\
+	"992:	.balign 4\n"						\
+	"993:	.8byte 990b\n"						\
+	"	.8byte _.stapsdt.base\n"				\
+	"	.8byte 0\n"						\
+	"	.asciz \"thinkd\"\n"					\
+	"	.asciz \"" #name "\"\n"					\
+	"	.asciz \"" args "\"\n"					\
+	"994:	.balign 4\n"						\
+	"	.popsection\n"						\
+	"	.ifndef _.stapsdt.base\n"				\
+	"	.pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+	"	.weak _.stapsdt.base\n"					\
+	"	.hidden _.stapsdt.base\n"				\
+	"_.stapsdt.base: .space 1\n"					\
+	"	.size _.stapsdt.base, 1\n"				\
+	"	.popsection\n"						\
+	"	.endif\n"
+
+#define __USDT_ARG(x) "nor" ((unsigned long) (x))
+
+#define USDT(name)							\
+	__asm__ __volatile__(__USDT_NOTE(name, ""))
+#define USDT1(name, a1)							\
+	__asm__ __volatile__(__USDT_NOTE(name, "8@%0") :: __USDT_ARG(a1))
+#define USDT2(name, a1, a2)						\
+	__asm__ __volatile__(__USDT_NOTE(name, "8@%0 8@%1")		\
+			     :: __USDT_ARG(a1), __USDT_ARG(a2))
+#define USDT3(name, a1, a2, a3)						\
+	__asm__ __volatile__(__USDT_NOTE(name, "8@%0 8@%1 8@%2")	\
+			     :: __USDT_ARG(a1), __USDT_ARG(a2), __USDT_ARG(a3))
+
+#else
+
+#define USDT(name) do { } while (0)
+#define USDT1(name, a1) do { (void) (a1); } while (0)
+#define USDT2(name, a1, a2) do { (void) (a1); (void) (a2); } while (0)
+#define USDT3(name, a1, a2, a3) \
+	do { (void) (a1); (void) (a2); (void) (a3); } while (0)
+
+#endif
+
+#endif /* _USDT_H_ */
@@ -0,0 +1,634 @@
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <fcntl.h>
+
+#include "void.h"
+#include "wakers.h"
+#include "acpi.h"
+#include "conf_utils.h"
+#include "events.h"
+#include "logger.h"
+
+/*
+ * What keeps the machine awake on battery, without running powertop:
+ * every Wakers_Interval seconds on battery the interrupt counts of
+ * /proc/interrupts, the totals of /proc/stat and the cpu time and run
+ * count (wakeups, near enough) of every process are sampled, and their
+ * deltas are added up until the charger comes back. The system files
+ * and each process's stat and schedstat stay open and are re-read with
+ * pread() into one static buffer, so a sample is mostly a pread per
+ * counter. Its cpu time is measured, and the interval is doubled while
+ * sampling costs more than WAKERS_BUDGET_US per minute.
+ *
+ * A process's run count comes from its main thread's schedstat, its cpu
+ * time from stat, which covers all of its threads. Kernel threads are
+ * left out, and their pids remembered so they aren't opened again. When
+ * the table is full, a newcomer that wakes up more often per second of
+ * its life than the least busy tracked process takes that one's slot.
+ */
+
+#define PF_KTHREAD 0x00200000	/* the flags field of stat */
+
+typedef struct __wakers_irq {
+	char label[12];		/* 16, LOC, ... */
+	char name[40];		/* the handlers, or what it is */
+	uint64_t last;
+	uint64_t count;		/* since going on battery */
+} wakers_irq_t;
+
+typedef struct __wakers_proc {
+	pid_t pid;		/* 0 for a free slot */
+	int stat_fd;		/* -1 once it exited */
+	int sched_fd;
+	bool kthread;
+	char comm[16];
+	uint64_t start;		/* clock ticks after boot */
+	uint64_t last_ticks;
+	uint64_t last_runs;
+	uint64_t ticks;		/* since going on battery */
+	uint64_t runs;
+} wakers_proc_t;
+
+static wakers_irq_t irqs[WAKERS_MAX_IRQS];
+static unsigned int num_irqs;
+static wakers_proc_t procs[WAKERS_MAX_PROCS];
+static pid_t kthreads[WAKERS_MAX_KTHREADS];	/* sorted */
+static unsigned int num_kthreads;
+static char buffer[WAKERS_BUFFER_SIZE];
+static int interrupts_fd = -1, stat_fd = -1;
+static procfs_path_t proc_dir;
+static bool active, first_sample;
+static unsigned int interval;
+static long clock_ticks;
+static uint64_t started_ms, last_ms;
+static uint64_t battery_ticks;		/* after boot, when going on battery */
+static unsigned long num_samples, untracked;
+static uint64_t cpu_ns;
+
+/* /proc/stat: last values and deltas since going on battery */
+static uint64_t last_busy, last_total, last_intr, last_ctxt;
+static uint64_t busy, total, intr, ctxt;
+
+static void wakers_tick(void *data);
+static ssize_t read_all(int fd, char *dest, size_t len);
+static void sample_interrupts();
+static void sample_stat();
+static void sample_procs();
+static int proc_add(int dirfd, const char *name, void *data);
+static bool proc_read(wakers_proc_t *p, uint64_t *ticks, uint64_t *runs);
+static void proc_close(wakers_proc_t *p);
+static uint64_t proc_rate(const wakers_proc_t *p, uint64_t now);
+static bool kthread_known(pid_t pid);
+static void kthread_remember(pid_t pid);
+static uint64_t boot_ticks();
+static uint64_t thread_cpu_ns();
+static int pick_top(const uint64_t *keys, size_t count, int *top, int max);
+
+/*
+ * Called on every probe. Going on battery starts a new tally, coming back
+ * takes a last sample and stops; the report stays until the next one.
+ */
+void wakers_enable(bool on_battery)
+{
+	sysfs_path_t path;
+
+	if ((on_battery && daemon_prefs.wakers_interval > 0) == active)
+		return;
+
+	if (active) {
+		wakers_sample();
+		wakers_close();
+		return;
+	}
+
+	for (wakers_proc_t *p = procs; p < procs + array_count(procs); ++p)
+		p->pid = 0;
+	num_irqs = num_kthreads = 0;
+	num_samples = untracked = 0;
+	cpu_ns = 0;
+	busy = total = intr = ctxt = 0;
+	clock_ticks = sysconf(_SC_CLK_TCK);
+	battery_ticks = boot_ticks();
+
+	sysroot_sprintf(path, "%s", "/proc/interrupts");
+	interrupts_fd = open(path, O_RDONLY | O_CLOEXEC);
+	sysroot_sprintf(path, "%s", "/proc/stat");
+	stat_fd = open(path, O_RDONLY | O_CLOEXEC);
+	sysroot_sprintf(proc_dir, "%s", "/proc");
+
+	active = true;
+	first_sample = true;
+	started_ms = event_now_ms();
+	interval = daemon_prefs.wakers_interval;
+	wakers_sample();
+	first_sample = false;
+	num_samples = 0;
+	cpu_ns = 0;
+	event_timer_set(interval * 1000, wakers_tick, NULL);
+}
+
+/* a reload may change the interval, the tally goes on */
+void wakers_configure()
+{
+	if (! active)
+		return;
+
+	if (daemon_prefs.wakers_interval <= 0) {
+		wakers_close();
+		return;
+	}
+
+	interval = daemon_prefs.wakers_interval;
+	event_timer_set(interval * 1000, wakers_tick, NULL);
+}
+
+void wakers_sample()
+{
+	uint64_t start = thread_cpu_ns(), per_minute;
+
+	if (! active)
+		return;
+
+	sample_interrupts();
+	sample_stat();
+	sample_procs();
+	last_ms = event_now_ms();
+
+	cpu_ns += thread_cpu_ns() - start;
+	++num_samples;
+
+	/* back off instead of becoming what drains the battery */
+	per_minute = cpu_ns / num_samples * 60 / interval;
+	if (! first_sample && per_minute > WAKERS_BUDGET_US * 1000ULL &&
+	    interval < (unsigned int) daemon_prefs.wakers_interval * WAKERS_MAX_BACKOFF) {
+		interval *= 2;
+		thinkd_log(LOG_INFO, "wakers: a sample takes %lu us, sampling every %u s",
+			   (unsigned long) (cpu_ns / num_samples / 1000), interval);
+	}
+}
+
+/*
+ * The busiest interrupts, processes by wakeups and processes by cpu time
+ * since going on battery, `top` of each, one per line.
+ */
+int wakers_report(char *dest, size_t len, int top)
+{
+	uint64_t keys[WAKERS_MAX_PROCS > WAKERS_MAX_IRQS ? WAKERS_MAX_PROCS : WAKERS_MAX_IRQS];
+	int picked[WAKERS_TOP], count;
+	double seconds = (last_ms - started_ms) / 1000.0;
+	size_t used = 0;
+
+#define REPORT(...)							\
+	do {								\
+		if (used < len)						\
+			used += snprintf(dest + used, len - used, __VA_ARGS__); \
+	} while (0)
+
+	if (top > WAKERS_TOP)
+		top = WAKERS_TOP;
+	dest[0] = '\0';
+	if (! num_samples || seconds <= 0) {
+		REPORT("no samples on battery yet\n");
+		return 0;
+	}
+
+	REPORT("%.0f min on battery, %lu samples, %.0f us each\n", seconds / 60,
+	       num_samples, cpu_ns / 1000.0 / num_samples);
+	if (total)
+		REPORT("cpu %.1f%% busy, %.0f interrupts/s, %.0f context switches/s\n",
+		       100.0 * busy / total, intr / seconds, ctxt / seconds);
+
+	for (unsigned int i = 0; i < num_irqs; ++i)
+		keys[i] = irqs[i].count;
+	count = pick_top(keys, num_irqs, picked, top);
+	for (int i = 0; i < count; ++i)
+		REPORT("irq %-6s %-28s %8.1f/s\n", irqs[picked[i]].label,
+		       irqs[picked[i]].name, irqs[picked[i]].count / seconds);
+
+	for (size_t i = 0; i < array_count(procs); ++i)
+		keys[i] = procs[i].pid ? procs[i].runs : 0;
+	count = pick_top(keys, array_count(procs), picked, top);
+	for (int i = 0; i < count; ++i)
+		REPORT("wakeups %-15s %7d %8.1f/s\n", procs[picked[i]].comm,
+		       (int) procs[picked[i]].pid, procs[picked[i]].runs / seconds);
+
+	for (size_t i = 0; i < array_count(procs); ++i)
+		keys[i] = procs[i].pid ? procs[i].ticks : 0;
+	count = pick_top(keys, array_count(procs), picked, top);
+	for (int i = 0; i < count; ++i)
+		REPORT("cpu %-19s %7d %7.2f%%\n", procs[picked[i]].comm,
+		       (int) procs[picked[i]].pid,
+		       100.0 * procs[picked[i]].ticks / clock_ticks / seconds);
+
+	if (untracked)
+		REPORT("%lu processes not tracked, more than %d\n", untracked,
+		       WAKERS_MAX_PROCS);
+#undef REPORT
+
+	return (int) used;
+}
+
+/* on SIGUSR2, next to the statistics */
+void wakers_log()
+{
+	char report[4096], *line, *next;
+
+	if (! num_samples)
+		return;
+
+	wakers_report(report, sizeof(report), WAKERS_TOP);
+	for (line = report; *line; line = next) {
+		next = line + strcspn(line, "\n");
+		if (*next)
+			*next++ = '\0';
+		thinkd_log(LOG_INFO, "wakers: %s", line);
+	}
+}
+
+void wakers_get_cost(wakers_cost_t *cost)
+{
+	cost->samples = num_samples;
+	cost->cpu_ns = cpu_ns;
+	cost->interval = interval;
+}
+
+/* stop sampling, the tally is kept for the report */
+void wakers_close()
+{
+	event_timer_cancel(wakers_tick, NULL);
+	for (wakers_proc_t *p = procs; p < procs + array_count(procs); ++p)
+		proc_close(p);
+
+	if (interrupts_fd >= 0)
+		close(interrupts_fd);
+	if (stat_fd >= 0)
+		close(stat_fd);
+	interrupts_fd = stat_fd = -1;
+	active = false;
+}
+
+static void wakers_tick(void *data)
+{
+	(void) data;
+
+	wakers_sample();
+	event_timer_set(interval * 1000, wakers_tick, NULL);
+}
+
+/* procfs hands out a page or so per read */
+static ssize_t read_all(int fd, char *dest, size_t len)
+{
+	size_t used = 0;
+	ssize_t nread;
+
+	while (used < len - 1 && (nread = pread(fd, dest + used, len - 1 - used, used)) > 0)
+		used += nread;
+	dest[used] = '\0';
+
+	return used ? (ssize_t) used : -1;
+}
+
+/*
+ * "  LOC:   123   456   Local timer interrupts" or, for device
+ * interrupts, "  16:   1   2   IR-IO-APIC   16-fasteoi   i801_smbus":
+ * the counts of every cpu are summed and the handlers named, which come
+ * after the last run of spaces.
+ */
+static void sample_interrupts()
+{
+	char *line, *next;
+	unsigned int hint = 0;
+	int cpus = 0;
+
+	if (interrupts_fd < 0 || read_all(interrupts_fd, buffer, sizeof(buffer)) < 0)
+		return;
+
+	/* the header names the cpus */
+	next = buffer + strcspn(buffer, "\n");
+	for (char *c = buffer; (c = strstr(c, "CPU")) && c < next; c += 3)
+		++cpus;
+
+	for (line = *next ? next + 1 : next; *line; line = next) {
+		char *colon, *p, *name;
+		wakers_irq_t *irq = NULL;
+		uint64_t sum = 0;
+
+		next = line + strcspn(line, "\n");
+		if (*next)
+			*next++ = '\0';
+		if (! (colon = strchr(line, ':')))
+			continue;
+		*colon = '\0';
+		while (isblank((unsigned char) *line))
+			++line;
+
+		p = colon + 1;
+		for (int cpu = 0; cpu < cpus; ++cpu) {
+			char *end;
+			unsigned long long n = strtoull(p, &end, 10);
+
+			if (end == p)
+				break;
+			sum += n;
+			p = end;
+		}
+
+		while (isblank((unsigned char) *p))
+			++p;
+		name = p;
+		for (char *gap; (gap = strstr(name, "  "));) {
+			while (*gap == ' ')
+				++gap;
+			if (! *gap)
+				break;
+			name = gap;
+		}
+
+		/* the lines come in the same order every time */
+		if (hint < num_irqs && strcmp(irqs[hint].label, line) == 0)
+			irq = &irqs[hint];
+		for (unsigned int i = 0; ! irq && i < num_irqs; ++i) {
+			if (strcmp(irqs[i].label, line) == 0)
+				irq = &irqs[i];
+		}
+
+		if (! irq) {
+			if (num_irqs == WAKERS_MAX_IRQS)
+				continue;
+			irq = &irqs[num_irqs++];
+			snprintf(irq->label, sizeof(irq->label), "%s", line);
+			irq->count = 0;
+			/* one that appeared since going on battery counts from zero */
+			irq->last = first_sample ? sum : 0;
+		}
+		snprintf(irq->name, sizeof(irq->name), "%s", *name ? name : "-");
+
+		if (sum >= irq->last)
+			irq->count += sum - irq->last;
+		irq->last = sum;
+		hint = irq - irqs + 1;
+	}
+}
+
+static void sample_stat()
+{
+	unsigned long long v[8] = { 0 }, n;
+	uint64_t sum = 0;
+	char *p;
+
+	if (stat_fd < 0 || read_all(stat_fd, buffer, sizeof(buffer)) < 0)
+		return;
+
+	/* cpu  user nice system idle iowait irq softirq steal */
+	if (sscanf(buffer, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &v[0], &v[1],
+		   &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) < 4)
+		return;
+	for (int i = 0; i < 8; ++i)
+		sum += v[i];
+
+	if (! first_sample) {
+		total += sum - last_total;
+		busy += sum - v[3] - v[4] - last_busy;
+	}
+	last_total = sum;
+	last_busy = sum - v[3] - v[4];
+
+	if ((p = strstr(buffer, "\nintr ")) && sscanf(p, "\nintr %llu", &n) == 1) {
+		if (! first_sample)
+			intr += n - last_intr;
+		last_intr = n;
+	}
+	if ((p = strstr(buffer, "\nctxt ")) && sscanf(p, "\nctxt %llu", &n) == 1) {
+		if (! first_sample)
+			ctxt += n - last_ctxt;
+		last_ctxt = n;
+	}
+}
+
+/* the known processes first, then /proc for new ones */
+static void sample_procs()
+{
+	uint64_t ticks, runs, now = boot_ticks();
+
+	for (wakers_proc_t *p = procs; p < procs + array_count(procs); ++p) {
+		if (! p->pid || p->stat_fd < 0)
+			continue;
+
+		if (! proc_read(p, &ticks, &runs)) {
+			proc_close(p);
+			continue;
+		}
+		p->ticks += ticks - p->last_ticks;
+		p->runs += runs - p->last_runs;
+		p->last_ticks = ticks;
+		p->last_runs = runs;
+	}
+
+	/* counted again on every walk, it is how many are left out now */
+	untracked = 0;
+	sysfs_foreach_entry(proc_dir, proc_add, &now);
+}
+
+static int proc_add(int dirfd, const char *name, void *data)
+{
+	wakers_proc_t new = { 0 }, *slot = NULL, *victim = NULL;
+	uint64_t now = *(uint64_t *) data, victim_rate = 0;
+	char path[32];
+
+	if (! isdigit((unsigned char) name[0]))
+		return 0;
+	new.pid = (pid_t) atoi(name);
+	if (kthread_known(new.pid))
+		return 0;
+
+	for (wakers_proc_t *p = procs; p < procs + array_count(procs); ++p) {
+		if (p->pid == new.pid && p->stat_fd >= 0)
+			return 0;
+		/* exited ones make room, the least busy first */
+		if (! p->pid)
+			slot = slot && ! slot->pid ? slot : p;
+		else if (p->stat_fd < 0 && (! slot || (slot->pid && p->runs < slot->runs)))
+			slot = p;
+		else if (p->stat_fd >= 0 && (! victim || proc_rate(p, now) < victim_rate)) {
+			victim = p;
+			victim_rate = proc_rate(p, now);
+		}
+	}
+
+	snprintf(path, sizeof(path), "%s/stat", name);
+	new.stat_fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+	snprintf(path, sizeof(path), "%s/schedstat", name);
+	new.sched_fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+	if (! proc_read(&new, &new.last_ticks, &new.last_runs) || new.kthread) {
+		if (new.kthread)
+			kthread_remember(new.pid);
+		proc_close(&new);
+		return 0;
+	}
+
+	/* a full table: the least busy goes if this one is busier */
+	if (! slot) {
+		if (! victim || proc_rate(&new, now) <= victim_rate) {
+			++untracked;
+			proc_close(&new);
+			return 0;
+		}
+		proc_close(victim);
+		slot = victim;
+	}
+
+	/* one started since going on battery counts from zero, others from now */
+	if (! first_sample && new.start >= battery_ticks) {
+		new.ticks = new.last_ticks;
+		new.runs = new.last_runs;
+	}
+	*slot = new;
+
+	return 0;
+}
+
+/*
+ * "pid (comm) state ppid pgrp session tty tpgid flags ... utime stime ...
+ * starttime" and "runtime waittime runs"
+ */
+static bool proc_read(wakers_proc_t *p, uint64_t *ticks, uint64_t *runs)
+{
+	char line[512], *open_paren, *close_paren, *field;
+	unsigned long long utime, stime, start, run_count = 0;
+	unsigned int flags;
+	ssize_t nread;
+	int ppid;
+
+	if (p->stat_fd < 0)
+		return false;
+
+	nread = pread(p->stat_fd, line, sizeof(line) - 1, 0);
+	if (nread <= 0)
+		return false;
+	line[nread] = '\0';
+
+	open_paren = strchr(line, '(');
+	close_paren = strrchr(line, ')');
+	if (! open_paren || ! close_paren || close_paren < open_paren)
+		return false;
+	snprintf(p->comm, sizeof(p->comm), "%.*s", (int) (close_paren - open_paren - 1),
+		 open_paren + 1);
+	if (sscanf(close_paren + 1, " %*c %d %*d %*d %*d %*d %u", &ppid, &flags) != 2)
+		return false;
+	p->kthread = (flags & PF_KTHREAD) || ppid == 2;
+
+	/* utime is the 14th field, the 12th after the comm, starttime the 22nd */
+	field = close_paren + 1;
+	for (int i = 0; i < 11 && field; ++i)
+		field = strchr(field + 1, ' ');
+	if (! field || sscanf(field, "%llu %llu %*d %*d %*d %*d %*d %*d %llu", &utime,
+			      &stime, &start) != 3)
+		return false;
+	*ticks = utime + stime;
+	p->start = start;
+
+	if (p->sched_fd >= 0 && (nread = pread(p->sched_fd, line, sizeof(line) - 1, 0)) > 0) {
+		line[nread] = '\0';
+		sscanf(line, "%*u %*u %llu", &run_count);
+	}
+	*runs = run_count;
+
+	return true;
+}
+
+static void proc_close(wakers_proc_t *p)
+{
+	if (p->pid && p->stat_fd >= 0)
+		close(p->stat_fd);
+	if (p->pid && p->sched_fd >= 0)
+		close(p->sched_fd);
+	p->stat_fd = p->sched_fd = -1;
+}
+
+/* runs per thousand clock ticks of its life, what ranks it for a slot */
+static uint64_t proc_rate(const wakers_proc_t *p, uint64_t now)
+{
+	uint64_t age = now > p->start ? now - p->start : 1;
+
+	return p->last_runs * 1000 / age;
+}
+
+static bool kthread_known(pid_t pid)
+{
+	unsigned int low = 0, high = num_kthreads;
+
+	while (low < high) {
+		unsigned int mid = (low + high) / 2;
+
+		if (kthreads[mid] == pid)
+			return true;
+		if (kthreads[mid] < pid)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return false;
+}
+
+/* /proc lists pids in order, so this mostly appends */
+static void kthread_remember(pid_t pid)
+{
+	unsigned int pos = num_kthreads;
+
+	if (num_kthreads == WAKERS_MAX_KTHREADS)
+		return;
+	while (pos > 0 && kthreads[pos - 1] > pid)
+		--pos;
+	memmove(kthreads + pos + 1, kthreads + pos, (num_kthreads - pos) * sizeof(*kthreads));
+	kthreads[pos] = pid;
+	++num_kthreads;
+}
+
+/* the clock of the starttime in stat */
+static uint64_t boot_ticks()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	return (uint64_t) ts.tv_sec * clock_ticks + ts.tv_nsec / (1000000000 / clock_ticks);
+}
+
+static uint64_t thread_cpu_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* indices of the `max` largest non-zero keys, largest first */
+static int pick_top(const uint64_t *keys, size_t count, int *top, int max)
+{
+	int found = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		int pos = found;
+
+		if (! keys[i])
+			continue;
+		while (pos > 0 && keys[top[pos - 1]] < keys[i])
+			--pos;
+		if (pos >= max)
+			continue;
+		if (found < max)
+			++found;
+		memmove(top + pos + 1, top + pos, (found - pos - 1) * sizeof(*top));
+		top[pos] = (int) i;
+	}
+
+	return found;
+}
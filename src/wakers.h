@@ -0,0 +1,31 @@
+#ifndef _WAKERS_H_
+#define _WAKERS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WAKERS_MAX_IRQS 256
+#define WAKERS_MAX_PROCS 256		/* two open fds each */
+#define WAKERS_MAX_KTHREADS 512		/* kernel threads known to skip */
+#define WAKERS_TOP 8			/* entries per list in the report */
+#define WAKERS_BUFFER_SIZE 65536	/* /proc/interrupts of a big machine */
+#define WAKERS_BUDGET_US 2000		/* sampling cpu time per minute */
+#define WAKERS_MAX_BACKOFF 8		/* times Wakers_Interval, over budget */
+
+/* what sampling cost so far */
+typedef struct __wakers_cost {
+	unsigned long samples;
+	uint64_t cpu_ns;
+	unsigned int interval;		/* s, after any backoff */
+} wakers_cost_t;
+
+extern void wakers_enable(bool on_battery);
+extern void wakers_configure();
+extern void wakers_sample();
+extern int wakers_report(char *dest, size_t len, int top);
+extern void wakers_log();
+extern void wakers_get_cost(wakers_cost_t *cost);
+extern void wakers_close();
+
+#endif /* _WAKERS_H_ */
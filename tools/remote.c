@@ -0,0 +1,263 @@
+/*
+ * Runs one command on many thinkd hosts at once:
+ *
+ *	thinkd-remote [-k keyfile] [-t timeout_ms] COMMAND HOST[:PORT]...
+ *
+ * Every host gets its own non-blocking connection and all of them are
+ * driven by a single poll() loop, so a slow or dead host only costs the
+ * timeout and never delays the others. Replies are printed one line per
+ * host in the order given; the exit status is the number of failed hosts
+ * (capped at 100).
+ */
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "remote.h"
+#include "conf_utils.h"
+
+#define DEFAULT_TIMEOUT_MS 5000
+#define MAX_REPLY 512
+
+typedef enum __host_state {
+	HOST_CONNECTING,
+	HOST_GREETING,
+	HOST_REPLY,
+	HOST_DONE,
+} host_state_t;
+
+typedef struct __host {
+	const char *address;
+	int fd;
+	host_state_t state;
+	bool failed;
+	size_t len;
+	char buffer[MAX_REPLY];
+} host_t;
+
+static uint8_t key[REMOTE_MAX_KEY];
+static size_t key_len;
+static const char *command;
+
+static int host_connect(host_t *host);
+static void host_event(host_t *host, short revents);
+static void host_fail(host_t *host, const char *reason);
+static uint64_t now_ms();
+
+int main(int argc, char *argv[])
+{
+	const char *key_file = THINKD_KEY_FILE;
+	unsigned long timeout = DEFAULT_TIMEOUT_MS;
+	struct pollfd *fds;
+	uint64_t deadline;
+	host_t *hosts;
+	int c, count, pending = 0, failed = 0;
+
+	while ((c = getopt(argc, argv, "k:t:")) != -1) {
+		switch (c) {
+		case 'k':
+			key_file = optarg;
+			break;
+		case 't':
+			timeout = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (argc - optind < 2)
+		goto usage;
+
+	if (remote_read_key(key_file, key, &key_len) < 0) {
+		fprintf(stderr, "cannot read a key from %s\n", key_file);
+		return EXIT_FAILURE;
+	}
+
+	command = argv[optind++];
+	count = argc - optind;
+	hosts = calloc(count, sizeof(host_t));
+	fds = calloc(count, sizeof(struct pollfd));
+	if (! hosts || ! fds) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		hosts[i].address = argv[optind + i];
+		if (host_connect(&hosts[i]) == 0)
+			++pending;
+	}
+
+	deadline = now_ms() + timeout;
+	while (pending) {
+		uint64_t now = now_ms();
+		int ready;
+
+		if (now >= deadline)
+			break;
+
+		for (int i = 0; i < count; ++i) {
+			fds[i].fd = hosts[i].state == HOST_DONE ? -1 : hosts[i].fd;
+			fds[i].events = hosts[i].state == HOST_CONNECTING ? POLLOUT : POLLIN;
+			fds[i].revents = 0;
+		}
+
+		ready = poll(fds, count, deadline - now);
+		if (ready < 0 && errno != EINTR) {
+			perror("poll");
+			break;
+		}
+
+		for (int i = 0; ready > 0 && i < count; ++i) {
+			if (! fds[i].revents)
+				continue;
+
+			host_event(&hosts[i], fds[i].revents);
+			if (hosts[i].state == HOST_DONE)
+				--pending;
+		}
+	}
+
+	for (int i = 0; i < count; ++i) {
+		if (hosts[i].state != HOST_DONE)
+			host_fail(&hosts[i], "timed out");
+
+		hosts[i].buffer[strcspn(hosts[i].buffer, "\n")] = '\0';
+		printf("%s: %s\n", hosts[i].address, hosts[i].buffer);
+		if (hosts[i].failed || strncmp(hosts[i].buffer, "error", 5) == 0)
+			++failed;
+	}
+
+	free(hosts);
+	free(fds);
+	return failed > 100 ? 100 : failed;
+
+usage:
+	fprintf(stderr, "usage: %s [-k keyfile] [-t timeout_ms] COMMAND HOST[:PORT]...\n",
+		argv[0]);
+	return EXIT_FAILURE;
+}
+
+/* starts a non-blocking connect, resolving the name first */
+static int host_connect(host_t *host)
+{
+	struct addrinfo hints, *res;
+	char name[NI_MAXHOST], port[NI_MAXSERV];
+	int err;
+
+	host->fd = -1;
+	if (remote_split_address(host->address, name, sizeof(name),
+				 port, sizeof(port)) < 0) {
+		host_fail(host, "bad address");
+		return -1;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if ((err = getaddrinfo(name, port, &hints, &res)) != 0) {
+		host_fail(host, gai_strerror(err));
+		return -1;
+	}
+
+	host->fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (host->fd < 0 ||
+	    (connect(host->fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS)) {
+		freeaddrinfo(res);
+		host_fail(host, strerror(errno));
+		return -1;
+	}
+
+	freeaddrinfo(res);
+	host->state = HOST_CONNECTING;
+	return 0;
+}
+
+static void host_event(host_t *host, short revents)
+{
+	char request[REMOTE_MAX_LINE], mac[REMOTE_MAC_HEX + 1], nonce[64];
+	socklen_t err_len = sizeof(int);
+	ssize_t nread;
+	int err = 0, len;
+
+	switch (host->state) {
+	case HOST_CONNECTING:
+		getsockopt(host->fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+		if (err) {
+			host_fail(host, strerror(err));
+			return;
+		}
+		host->state = HOST_GREETING;
+		return;
+
+	case HOST_GREETING:
+	case HOST_REPLY:
+		nread = read(host->fd, host->buffer + host->len,
+			     sizeof(host->buffer) - host->len - 1);
+		if (nread < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		if (nread <= 0) {
+			if (host->state == HOST_REPLY && host->len) {
+				host->state = HOST_DONE;
+				close(host->fd);
+			}
+			else
+				host_fail(host, nread < 0 ? strerror(errno) : "connection closed");
+			return;
+		}
+
+		host->len += nread;
+		host->buffer[host->len] = '\0';
+		if (host->state == HOST_REPLY || ! strchr(host->buffer, '\n'))
+			return;
+
+		if (sscanf(host->buffer, "thinkd 1 %63s", nonce) != 1) {
+			host_fail(host, "not a thinkd");
+			return;
+		}
+
+		/* the greeting is answered with the signed command */
+		remote_sign(key, key_len, nonce, command, mac);
+		len = snprintf(request, sizeof(request), "%s %s\n", mac, command);
+		if (len >= (int) sizeof(request) || write(host->fd, request, len) != len) {
+			host_fail(host, "cannot send command");
+			return;
+		}
+
+		host->len = 0;
+		host->buffer[0] = '\0';
+		host->state = HOST_REPLY;
+		return;
+
+	case HOST_DONE:
+		return;
+	}
+}
+
+static void host_fail(host_t *host, const char *reason)
+{
+	snprintf(host->buffer, sizeof(host->buffer), "error: %s", reason);
+	host->failed = true;
+	host->state = HOST_DONE;
+	if (host->fd >= 0)
+		close(host->fd);
+	host->fd = -1;
+}
+
+static uint64_t now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}